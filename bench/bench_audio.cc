@@ -0,0 +1,324 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "audio/analysis_file.h"
+#include "audio/audio.h"
+#include "audio/decimator.h"
+#include "audio/feature_extractor.h"
+#include "audio/level_meter.h"
+#include "game/field.h"
+#include "random/random.h"
+
+/**
+ * Creates data similar to an analysed track of given length.
+ * @param[in] num_beats
+ * @return audio data with `num_beats` beats at 120 bpm with 0-5 notes each.
+ */
+AudioData CreateAudioData(size_t num_beats) {
+  AudioData audio_data;
+  audio_data.average_bpm_ = 120;
+  audio_data.average_level_ = 50;
+  for (size_t i=0; i<num_beats; i++) {
+    std::vector<Note> notes;
+    for (size_t j=0; j<i%6; j++) {
+      size_t midi_note = 36 + (i*7+j*5)%48;
+      notes.push_back(Note::FromMidi(midi_note));
+    }
+    audio_data.data_per_beat_.push_back({i*500.0, 120, static_cast<int>(40+i%20), notes, 0});
+  }
+  return audio_data;
+}
+
+/**
+ * Removes file from page cache, so that next read hits the disc.
+ * @param[in] path
+ */
+void DropFromPageCache(std::string path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+  fdatasync(fd);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+TEST_CASE("benchmark loading analysis", "[benchmark]") {
+  // ~4 hours at 120 bpm.
+  AudioData audio_data = CreateAudioData(30000);
+  std::string tmp = std::filesystem::temp_directory_path().string();
+  std::string binary_path = tmp + "/dissonance_bench" ANALYSIS_FILE_EXTENSION;
+  std::string json_path = tmp + "/dissonance_bench.json";
+  AnalysisFile::Write(binary_path, audio_data);
+  Audio::SafeJson(audio_data, json_path);
+
+  BENCHMARK("json: warm load") {
+    return Audio::LoadJson(json_path);
+  };
+  BENCHMARK("binary: warm load") {
+    return Audio::Load(binary_path);
+  };
+  BENCHMARK("binary: warm map (no conversion)") {
+    AnalysisFile file(binary_path);
+    return file.times()[file.num_beats()-1];
+  };
+  BENCHMARK_ADVANCED("json: cold load")(Catch::Benchmark::Chronometer meter) {
+    meter.measure([&] { 
+      DropFromPageCache(json_path);
+      return Audio::LoadJson(json_path); 
+    });
+  };
+  BENCHMARK_ADVANCED("binary: cold load")(Catch::Benchmark::Chronometer meter) {
+    meter.measure([&] { 
+      DropFromPageCache(binary_path);
+      return Audio::Load(binary_path); 
+    });
+  };
+
+  std::filesystem::remove(binary_path);
+  std::filesystem::remove(json_path);
+}
+
+TEST_CASE("benchmark memory of shared analysed data", "[benchmark]") {
+  // ~4 hours at 120 bpm, used by the three generators of a match.
+  auto audio_data = std::make_shared<const AudioData>(CreateAudioData(30000));
+  std::vector<RandomGenerator> generators = {
+    RandomGenerator(audio_data, &RandomGenerator::ran_note),
+    RandomGenerator(audio_data, &RandomGenerator::ran_boolean_minor_interval),
+    RandomGenerator(audio_data, &RandomGenerator::ran_level_peaks),
+  };
+
+  BENCHMARK("generator: deep copy of analysed data") {
+    AudioData copy = *audio_data;
+    return copy.data_per_beat_.size();
+  };
+  BENCHMARK("generator: shared analysed data") {
+    RandomGenerator generator(audio_data, &RandomGenerator::ran_note);
+    return generator.RandomInt(0, 10);
+  };
+
+  size_t bytes = audio_data->data_per_beat_.MemoryUsage();
+  size_t users = audio_data.use_count();
+  std::cout << "analysed data of " << audio_data->data_per_beat_.size() << " beats: " << bytes << " bytes, "
+    << users << " users: deep copies " << users*bytes << " bytes, shared " << bytes << " bytes" << std::endl;
+}
+
+TEST_CASE("benchmark map generation", "[benchmark]") {
+  // ~4 hours at 120 bpm, so generators cycle through many beats.
+  auto audio_data = std::make_shared<const AudioData>(CreateAudioData(30000));
+  RandomGenerator ran_gen(audio_data, &RandomGenerator::ran_note);
+  RandomGenerator map_1(audio_data, &RandomGenerator::ran_boolean_minor_interval);
+  RandomGenerator map_2(audio_data, &RandomGenerator::ran_level_peaks);
+
+  BENCHMARK("generator: 200x200 field with hills") {
+    Field field(200, 200, &ran_gen);
+    field.AddHills(&map_1, &map_2, 0);
+    return field.GetSymbolAtPos({100, 100});
+  };
+  BENCHMARK("generator: 40000 random notes") {
+    size_t sum = 0;
+    for (size_t i=0; i<40000; i++)
+      sum += ran_gen.RandomInt(0, 10);
+    return sum;
+  };
+}
+
+TEST_CASE("benchmark graph", "[benchmark]") {
+  RandomGenerator ran_gen;
+  for (const auto& size : std::vector<position_t>({{40, 74}, {400, 740}})) {
+    Field field(size.first, size.second, &ran_gen);
+    position_t start = {1, 1};
+    position_t target = {size.first-2, size.second-2};
+    std::string name = std::to_string(size.first) + "x" + std::to_string(size.second);
+    BENCHMARK("graph: build " + name) {
+      field.BuildGraph(start, target);
+      return field.InRange(target, ViewRange::GRAPH);
+    };
+    BENCHMARK("graph: find way " + name) {
+      return field.GetWayForSoldier(start, {target}).size();
+    };
+  }
+}
+
+/**
+ * Measures throughput of level kernel.
+ * @param[in] samples interleaved stereo samples.
+ * @param[in] hop_size number of samples per hop.
+ * @param[in] scalar whether to use scalar kernel.
+ * @return samples per second.
+ */
+double MeasureLevelThroughput(const std::vector<float>& samples, size_t hop_size, bool scalar) {
+  size_t repetitions = 20*60;
+  int checksum = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t r=0; r<repetitions; r++) {
+    for (size_t i=0; i+hop_size<=samples.size(); i+=hop_size)
+      checksum += LevelMeter::HopLevel(&samples[i], hop_size, scalar);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  REQUIRE(checksum != 0);
+  return repetitions*samples.size()/elapsed.count();
+}
+
+TEST_CASE("benchmark level kernel", "[benchmark]") {
+  // One second of 44.1 kHz stereo (interleaved), hops of 256 frames. During analysis every hop is read
+  // from aubio's (cached) hop buffer, so a short block is cycled instead of streaming a whole song from
+  // memory, which would only measure memory bandwidth.
+  size_t samplerate = 44100;
+  size_t hop_size = 2*ANALYSIS_HOP_SIZE;
+  std::vector<float> samples(2*samplerate);
+  for (size_t i=0; i<samples.size(); i++)
+    samples[i] = 0.5*std::sin(i*0.01) + 0.1*std::sin(i*0.37);
+
+  BENCHMARK("level of 60s: " + LevelMeter::Kernel()) {
+    int sum = 0;
+    for (size_t r=0; r<60; r++) {
+      for (size_t i=0; i+hop_size<=samples.size(); i+=hop_size)
+        sum += LevelMeter::HopLevel(&samples[i], hop_size);
+    }
+    return sum;
+  };
+  BENCHMARK("level of 60s: scalar") {
+    int sum = 0;
+    for (size_t r=0; r<60; r++) {
+      for (size_t i=0; i+hop_size<=samples.size(); i+=hop_size)
+        sum += LevelMeter::HopLevel(&samples[i], hop_size, true);
+    }
+    return sum;
+  };
+
+  std::cout << "level kernel " << LevelMeter::Kernel() << ": "
+    << MeasureLevelThroughput(samples, hop_size, false) << " samples/s" << std::endl;
+  std::cout << "level kernel scalar: " << MeasureLevelThroughput(samples, hop_size, true) << " samples/s" 
+    << std::endl;
+}
+
+TEST_CASE("benchmark fused feature extractor", "[benchmark]") {
+  // 60s click track at 120 bpm with a chord, analysed hop by hop.
+  uint_t samplerate = 44100;
+  std::vector<float> samples(60*samplerate);
+  for (size_t i=0; i<samples.size(); i++) {
+    samples[i] = 0.1*(std::sin(2*M_PI*261.6*i/samplerate) + std::sin(2*M_PI*329.6*i/samplerate));
+    if (i%(samplerate/2) < 200)
+      samples[i] += 0.8*std::sin(2*M_PI*1000*i/samplerate);
+  }
+
+  BENCHMARK("fused: tempo, notes and chroma of 60s") {
+    FeatureExtractor extractor(samplerate, ANALYSIS_WIN_SIZE, ANALYSIS_HOP_SIZE);
+    Chroma chroma;
+    std::vector<Note> notes;
+    size_t beats = 0;
+    for (size_t i=0; i+ANALYSIS_HOP_SIZE<=samples.size(); i+=ANALYSIS_HOP_SIZE) {
+      if (extractor.Do(&samples[i])) {
+        extractor.TakeBeat(chroma, notes);
+        beats++;
+      }
+    }
+    return beats;
+  };
+
+  // aubio runs tempo- and notes-detection on the same hops (each with it's own spectral analysis).
+  aubio_tempo_t* bpm_obj = new_aubio_tempo("default", ANALYSIS_WIN_SIZE, ANALYSIS_HOP_SIZE, samplerate);
+  aubio_notes_t* notes_obj = new_aubio_notes("default", ANALYSIS_WIN_SIZE, ANALYSIS_HOP_SIZE, samplerate);
+  if (!bpm_obj || !notes_obj) {
+    WARN("aubio not available, skipping aubio benchmark.");
+  }
+  else {
+    fvec_t* in = new_fvec(ANALYSIS_HOP_SIZE);
+    fvec_t* out = new_fvec(1);
+    fvec_t* out_notes = new_fvec(1);
+    BENCHMARK("aubio: tempo and notes of 60s") {
+      size_t beats = 0;
+      for (size_t i=0; i+ANALYSIS_HOP_SIZE<=samples.size(); i+=ANALYSIS_HOP_SIZE) {
+        std::copy(&samples[i], &samples[i]+ANALYSIS_HOP_SIZE, in->data);
+        aubio_tempo_do(bpm_obj, in, out);
+        aubio_notes_do(notes_obj, in, out_notes);
+        beats += out->data[0] != 0;
+      }
+      return beats;
+    };
+    del_fvec(in);
+    del_fvec(out);
+    del_fvec(out_notes);
+  }
+  if (bpm_obj) del_aubio_tempo(bpm_obj);
+  if (notes_obj) del_aubio_notes(notes_obj);
+}
+
+/**
+ * Analyses raw pcm file with given backend and profile.
+ * @param[in] path raw pcm (f32, mono, 44.1 kHz).
+ * @param[in] backend
+ * @param[in] profile
+ * @param[out] seconds duration of analysis.
+ * @return times of all beats.
+ */
+std::vector<double> AnalyzeProfile(std::string path, AnalysisBackend backend, AnalysisProfile profile, 
+    double& seconds) {
+  Audio audio(std::filesystem::temp_directory_path().string());
+  audio.set_analysis_backend(backend);
+  audio.set_analysis_profile(profile);
+  std::vector<double> beats;
+  auto start = std::chrono::steady_clock::now();
+  audio.AnalyzeStream(path, {PCM_F32, 44100, 1}, [&beats](const AudioDataTimePoint& beat) { 
+    beats.push_back(beat.time_); 
+  });
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  seconds = elapsed.count();
+  return beats;
+}
+
+TEST_CASE("benchmark analysis profiles", "[benchmark]") {
+  // 60s at 120 bpm: kick-like clicks and a chord changing every 4 beats.
+  unsigned int samplerate = 44100;
+  std::vector<float> samples(60*samplerate);
+  for (size_t i=0; i<samples.size(); i++) {
+    size_t beat = i/(samplerate/2);
+    double root = 220.0*std::pow(2, ((beat/4)%4)*5/12.0);
+    samples[i] = 0.1*(std::sin(2*M_PI*root*i/samplerate) + std::sin(2*M_PI*root*1.5*i/samplerate));
+    if (i%(samplerate/2) < 400)
+      samples[i] += 0.8*std::sin(2*M_PI*80*i/samplerate)*(1 - (i%(samplerate/2))/400.0);
+  }
+  std::string path = std::filesystem::temp_directory_path().string() + "/dissonance_bench.raw";
+  std::ofstream write(path, std::ios::binary);
+  write.write(reinterpret_cast<const char*>(samples.data()), samples.size()*sizeof(float));
+  write.close();
+
+  // Speedup and mean beat-time deviation compared to accurate profile (native samplerate).
+  std::cout << "decimator kernel: " << Decimator::Kernel() << std::endl;
+  for (AnalysisBackend backend : {BACKEND_AUBIO, BACKEND_FUSED}) {
+    std::string backend_name = (backend == BACKEND_FUSED) ? "fused" : "aubio";
+    double reference_seconds = 0;
+    std::vector<double> reference = AnalyzeProfile(path, backend, PROFILE_ACCURATE, reference_seconds);
+    if (reference.empty()) {
+      WARN(backend_name + ": no beats detected, skipping.");
+      continue;
+    }
+    for (AnalysisProfile profile : {PROFILE_ACCURATE, PROFILE_DEFAULT, PROFILE_FAST}) {
+      double seconds = 0;
+      std::vector<double> beats = AnalyzeProfile(path, backend, profile, seconds);
+      double deviation = 0;
+      for (const auto& beat : beats) {
+        auto it = std::lower_bound(reference.begin(), reference.end(), beat);
+        double next = (it != reference.end()) ? std::abs(*it - beat) : std::numeric_limits<double>::max();
+        double prev = (it != reference.begin()) ? std::abs(*(it-1) - beat) : std::numeric_limits<double>::max();
+        deviation += std::min(next, prev);
+      }
+      std::cout << backend_name << " " << Audio::ProfileName(profile) << ": " << seconds*1000 << "ms, speedup " 
+        << reference_seconds/seconds << ", " << beats.size() << " beats, mean deviation " 
+        << ((beats.empty()) ? 0 : deviation/beats.size()) << "ms" << std::endl;
+    }
+  }
+  std::filesystem::remove(path);
+}
@@ -0,0 +1,26 @@
+#include "spdlog/common.h"
+#include <filesystem>
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <catch2/catch.hpp>
+#include <spdlog/spdlog.h>
+#include "spdlog/sinks/basic_file_sink.h"
+#include "audio/audio.h"
+
+#define LOGGER "logger"
+
+int main( int argc, char* argv[] ) {
+  // global setup...
+  std::filesystem::remove("bench/logs/bench-log.txt");
+
+  srand (time(NULL));
+
+  auto logger = spdlog::basic_logger_mt("logger", "bench/logs/bench-log.txt");
+  spdlog::set_level(spdlog::level::warn);
+
+  Audio::Initialize();
+
+  int result = Catch::Session().run( argc, argv );
+
+  return result;
+}
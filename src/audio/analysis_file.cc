@@ -0,0 +1,124 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "audio/analysis_file.h"
+#include "audio/audio.h"
+#include "spdlog/spdlog.h"
+
+#define LOGGER "logger"
+
+AnalysisFile::AnalysisFile(std::string path) : data_(nullptr), size_(0), header_(nullptr) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw "AnalysisFile: could not open file.";
+  struct stat st;
+  if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(AnalysisFileHeader)) {
+    close(fd);
+    throw "AnalysisFile: file truncated.";
+  }
+  size_ = st.st_size;
+  data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // mapping stays valid after closing descriptor.
+  if (data_ == MAP_FAILED)
+    throw "AnalysisFile: could not map file.";
+  header_ = static_cast<const AnalysisFileHeader*>(data_);
+
+  const char* error = nullptr;
+  if (header_->magic_ != ANALYSIS_FILE_MAGIC)
+    error = "AnalysisFile: not an analysis file.";
+  else if (header_->version_ != ANALYSIS_FILE_VERSION)
+    error = "AnalysisFile: outdated version.";
+  else if (FileSize(header_->num_beats_, header_->num_notes_) != size_)
+    error = "AnalysisFile: file truncated.";
+  if (error) {
+    munmap(data_, size_);
+    throw error;
+  }
+}
+
+AnalysisFile::~AnalysisFile() {
+  munmap(data_, size_);
+}
+
+// getter
+const AnalysisFileHeader& AnalysisFile::header() const {
+  return *header_;
+}
+size_t AnalysisFile::num_beats() const {
+  return header_->num_beats_;
+}
+const double* AnalysisFile::times() const {
+  return reinterpret_cast<const double*>(Column(0));
+}
+const int32_t* AnalysisFile::bpms() const {
+  return reinterpret_cast<const int32_t*>(Column(sizeof(double)*num_beats()));
+}
+const int32_t* AnalysisFile::levels() const {
+  return reinterpret_cast<const int32_t*>(Column((sizeof(double)+sizeof(int32_t))*num_beats()));
+}
+const int32_t* AnalysisFile::intervals() const {
+  return reinterpret_cast<const int32_t*>(Column((sizeof(double)+2*sizeof(int32_t))*num_beats()));
+}
+const uint32_t* AnalysisFile::note_offsets() const {
+  return reinterpret_cast<const uint32_t*>(Column((sizeof(double)+3*sizeof(int32_t))*num_beats()));
+}
+const uint8_t* AnalysisFile::chromas() const {
+  return reinterpret_cast<const uint8_t*>(Column((sizeof(double)+4*sizeof(int32_t))*num_beats() 
+        + sizeof(uint32_t)));
+}
+const uint8_t* AnalysisFile::note_pool() const {
+  return reinterpret_cast<const uint8_t*>(Column((sizeof(double)+4*sizeof(int32_t)+sizeof(Chroma))*num_beats() 
+        + sizeof(uint32_t)));
+}
+
+const char* AnalysisFile::Column(size_t offset) const {
+  return static_cast<const char*>(data_) + sizeof(AnalysisFileHeader) + offset;
+}
+
+size_t AnalysisFile::FileSize(size_t num_beats, size_t num_notes) {
+  return sizeof(AnalysisFileHeader) + (sizeof(double)+4*sizeof(int32_t)+sizeof(Chroma))*num_beats 
+    + sizeof(uint32_t) + num_notes;
+}
+
+template<class T>
+void WriteColumn(std::ofstream& write, const std::vector<T>& column) {
+  write.write(reinterpret_cast<const char*>(column.data()), column.size()*sizeof(T));
+}
+
+void AnalysisFile::Write(std::string path, const AudioData& audio_data) {
+  // Beats are already stored column-wise.
+  const BeatData& beats = audio_data.data_per_beat_;
+  AnalysisFileHeader header = {ANALYSIS_FILE_MAGIC, ANALYSIS_FILE_VERSION, beats.size(), beats.note_pool().size(), 
+    audio_data.duration_, audio_data.average_bpm_, audio_data.average_level_, 
+    static_cast<uint32_t>(audio_data.profile_), audio_data.samplerate_};
+
+  // Write to temporary file, then move to final destination.
+  std::string tmp_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::ofstream write(tmp_path, std::ios::binary);
+  if (!write) {
+    spdlog::get(LOGGER)->error("AnalysisFile::Write: Could not safe at {}", path);
+    return;
+  }
+  write.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  WriteColumn(write, beats.times());
+  WriteColumn(write, beats.bpms());
+  WriteColumn(write, beats.levels());
+  WriteColumn(write, beats.intervals());
+  WriteColumn(write, beats.note_offsets());
+  WriteColumn(write, beats.chromas());
+  WriteColumn(write, beats.note_pool());
+  write.close();
+  if (!write || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    spdlog::get(LOGGER)->error("AnalysisFile::Write: Could not safe at {}", path);
+    std::remove(tmp_path.c_str());
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef SRC_AUDIO_ANALYSIS_FILE_H_
+#define SRC_AUDIO_ANALYSIS_FILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#define ANALYSIS_FILE_MAGIC 0x414e5344  // "DSNA"
+#define ANALYSIS_FILE_VERSION 4
+#define ANALYSIS_FILE_EXTENSION ".dsna"
+
+struct AudioData;
+
+/**
+ * Fixed size header at the beginning of each analysis file. The header is
+ * followed by the columns (each with one entry per beat):
+ * - time (double)
+ * - bpm (int32)
+ * - level (int32)
+ * - interval (int32)
+ * - note offsets (uint32, one additional entry marking the end of the last beat)
+ * - chroma (12 uint8)
+ * and finally the note pool (uint8 midi notes, indexed by note offsets).
+ */
+struct AnalysisFileHeader {
+  uint32_t magic_;
+  uint32_t version_;
+  uint64_t num_beats_;
+  uint64_t num_notes_;
+  double duration_;  ///< milliseconds
+  float average_bpm_;
+  float average_level_;
+  uint32_t profile_;  ///< analysis profile (see AnalysisProfile)
+  uint32_t samplerate_;  ///< samplerate audio was analysed at.
+};
+
+/**
+ * Read-only, memory-mapped view on a binary analysis file. The mapping lives
+ * as long as this object, no data is copied on opening.
+ */
+class AnalysisFile {
+  public:
+    /**
+     * Opens and maps analysis file. Throws if file is missing, truncated or
+     * has an outdated version.
+     * @param[in] path
+     */
+    AnalysisFile(std::string path);
+    ~AnalysisFile();
+
+    AnalysisFile(const AnalysisFile&) = delete;
+    AnalysisFile& operator=(const AnalysisFile&) = delete;
+
+    // getter
+    const AnalysisFileHeader& header() const;
+    size_t num_beats() const;
+    const double* times() const;
+    const int32_t* bpms() const;
+    const int32_t* levels() const;
+    const int32_t* intervals() const;
+    const uint32_t* note_offsets() const;
+    const uint8_t* note_pool() const;
+    const uint8_t* chromas() const;
+
+    /**
+     * Writes analysis in binary format. File is written to a temporary file
+     * first and then renamed, so readers never see a partial file.
+     * @param[in] path
+     * @param[in] audio_data
+     */
+    static void Write(std::string path, const AudioData& audio_data);
+
+    /**
+     * Gets the total size of an analysis file with given number of beats and notes.
+     * @param[in] num_beats
+     * @param[in] num_notes
+     * @return size of analysis file in bytes.
+     */
+    static size_t FileSize(size_t num_beats, size_t num_notes);
+
+  private:
+    void* data_;
+    size_t size_;
+    const AnalysisFileHeader* header_;
+
+    const char* Column(size_t offset) const;
+};
+
+#endif
@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "audio/analysis_file.h"
+#include "audio/analysis_store.h"
+#include "audio/audio.h"
+#include "audio/pcm_buffer.h"
+#include "nlohmann/json.hpp"
+#include "spdlog/spdlog.h"
+#include "utils/utils.h"
+
+#define LOGGER "logger"
+
+// xxh64 primes.
+const uint64_t kXxhPrime1 = 11400714785074694791ULL;
+const uint64_t kXxhPrime2 = 14029467366897019727ULL;
+const uint64_t kXxhPrime3 = 1609587929392839161ULL;
+const uint64_t kXxhPrime4 = 9650029242287828579ULL;
+const uint64_t kXxhPrime5 = 2870177450012600261ULL;
+
+inline uint64_t XxhRotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t XxhRead64(const uint8_t* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t XxhRead32(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t XxhRound(uint64_t acc, uint64_t input) {
+  acc += input * kXxhPrime2;
+  acc = XxhRotl(acc, 31);
+  return acc * kXxhPrime1;
+}
+
+inline uint64_t XxhMergeRound(uint64_t acc, uint64_t val) {
+  acc ^= XxhRound(0, val);
+  return acc * kXxhPrime1 + kXxhPrime4;
+}
+
+AnalysisStore::AnalysisStore(std::string base_path, uintmax_t budget) 
+  : analysis_path_(base_path + "/data/analysis/"), index_path_(base_path + "/data/analysis/index.json"), 
+  total_size_(0), budget_(budget), index_changed_(false), compact_requested_(false), compacting_(false),
+  stop_compactor_(false) {
+  LoadIndex();
+  std::unique_lock ul(mutex_);
+  if (total_size_ > budget_)
+    RequestCompaction();
+}
+
+AnalysisStore::~AnalysisStore() {
+  {
+    std::unique_lock ul(mutex_);
+    stop_compactor_ = true;
+    cv_compact_.notify_all();
+  }
+  if (compactor_.joinable())
+    compactor_.join();
+  SafeIndex();
+}
+
+// getter
+uintmax_t AnalysisStore::budget() const {
+  std::unique_lock ul(mutex_);
+  return budget_;
+}
+
+uintmax_t AnalysisStore::total_size() const {
+  std::unique_lock ul(mutex_);
+  return total_size_;
+}
+
+size_t AnalysisStore::num_files() const {
+  std::unique_lock ul(mutex_);
+  return files_.size();
+}
+
+// setter
+void AnalysisStore::set_budget(uintmax_t budget) {
+  std::unique_lock ul(mutex_);
+  budget_ = budget;
+  if (total_size_ > budget_)
+    RequestCompaction();
+}
+
+// methods
+
+std::string AnalysisStore::GetKey(std::string source_path, std::string version) {
+  std::error_code ec;
+  uintmax_t size = std::filesystem::file_size(source_path, ec);
+  if (ec)
+    return "";
+  int64_t mtime = std::filesystem::last_write_time(source_path, ec).time_since_epoch().count();
+  if (ec)
+    return "";
+  if (version == "")
+    version = Audio::AnalysisVersion();
+
+  // Use digest from index if file is unchanged.
+  {
+    std::unique_lock ul(mutex_);
+    auto it = path_index_.find(source_path);
+    if (it != path_index_.end() && it->second.size_ == size && it->second.mtime_ == mtime)
+      return it->second.digest_ + "_" + version;
+  }
+
+  // Otherwise hash file content (without lock, so other files can be hashed in parallel).
+  uint64_t digest = 0;
+  if (!Digest(source_path, digest))
+    return "";
+  std::stringstream stream;
+  stream << std::hex << std::setw(16) << std::setfill('0') << digest;
+  std::unique_lock ul(mutex_);
+  path_index_[source_path] = {stream.str(), size, mtime};
+  index_changed_ = true;
+  return stream.str() + "_" + version;
+}
+
+std::string AnalysisStore::GetPath(std::string key) const {
+  return analysis_path_ + key + ANALYSIS_FILE_EXTENSION;
+}
+
+std::string AnalysisStore::GetPcmPath(std::string key) const {
+  if (key == "")
+    return "";
+  return analysis_path_ + key.substr(0, key.find('_')) + PCM_FILE_EXTENSION;
+}
+
+bool AnalysisStore::Contains(std::string key) const {
+  if (key == "")
+    return false;
+  std::unique_lock ul(mutex_);
+  return files_.count(GetName(GetPath(key))) > 0;
+}
+
+bool AnalysisStore::Touch(std::string path) {
+  std::unique_lock ul(mutex_);
+  auto it = files_.find(GetName(path));
+  if (it == files_.end())
+    return false;
+  if (it->second.lru_ != lru_.begin()) {
+    lru_.splice(lru_.begin(), lru_, it->second.lru_);
+    index_changed_ = true;
+  }
+  return true;
+}
+
+void AnalysisStore::Add(std::string path, uintmax_t size) {
+  std::string name = GetName(path);
+  if (name == "")
+    return;
+  std::unique_lock ul(mutex_);
+  auto it = files_.find(name);
+  if (it != files_.end()) {
+    total_size_ -= it->second.size_;
+    lru_.erase(it->second.lru_);
+    files_.erase(it);
+  }
+  AddFile(name, size, true);
+  index_changed_ = true;
+  if (total_size_ > budget_)
+    RequestCompaction();
+}
+
+void AnalysisStore::Remove(std::string path) {
+  std::unique_lock ul(mutex_);
+  auto it = files_.find(GetName(path));
+  if (it != files_.end()) {
+    total_size_ -= it->second.size_;
+    lru_.erase(it->second.lru_);
+    files_.erase(it);
+    index_changed_ = true;
+  }
+  std::error_code ec;
+  std::filesystem::remove(path, ec);
+}
+
+size_t AnalysisStore::Compact() {
+  std::unique_lock ul(mutex_);
+  // Files are removed while holding lock, so a file re-added meanwhile is never removed.
+  std::vector<std::string> victims = TakeVictims();
+  for (const auto& it : victims) {
+    std::error_code ec;
+    std::filesystem::remove(it, ec);
+  }
+  if (victims.size() > 0)
+    spdlog::get(LOGGER)->info("AnalysisStore::Compact: evicted {} files, {} bytes left", victims.size(), 
+        total_size_);
+  return victims.size();
+}
+
+size_t AnalysisStore::PrunePaths() {
+  std::vector<std::string> paths;
+  {
+    std::unique_lock ul(mutex_);
+    paths.reserve(path_index_.size());
+    for (const auto& it : path_index_)
+      paths.push_back(it.first);
+  }
+  // Check files without lock, so lookups are not blocked meanwhile.
+  std::vector<std::string> missing;
+  for (const auto& it : paths) {
+    std::error_code ec;
+    if (!std::filesystem::exists(it, ec) && !ec)
+      missing.push_back(it);
+  }
+  if (missing.size() == 0)
+    return 0;
+  std::unique_lock ul(mutex_);
+  for (const auto& it : missing)
+    path_index_.erase(it);
+  index_changed_ = true;
+  return missing.size();
+}
+
+void AnalysisStore::WaitForCompaction() {
+  std::unique_lock ul(mutex_);
+  cv_compact_.wait(ul, [this]() { return !compact_requested_ && !compacting_; });
+}
+
+void AnalysisStore::AddFile(std::string name, uintmax_t size, bool front) {
+  auto pos = (front) ? lru_.insert(lru_.begin(), name) : lru_.insert(lru_.end(), name);
+  files_[name] = {size, pos};
+  total_size_ += size;
+}
+
+std::vector<std::string> AnalysisStore::TakeVictims() {
+  std::vector<std::string> victims;
+  while (total_size_ > budget_ && lru_.size() > 1) {
+    auto it = files_.find(lru_.back());
+    total_size_ -= it->second.size_;
+    victims.push_back(analysis_path_ + it->first);
+    files_.erase(it);
+    lru_.pop_back();
+    index_changed_ = true;
+  }
+  return victims;
+}
+
+void AnalysisStore::RequestCompaction() {
+  compact_requested_ = true;
+  if (!compactor_.joinable())
+    compactor_ = std::thread([this]() { RunCompactor(); });
+  cv_compact_.notify_all();
+}
+
+void AnalysisStore::RunCompactor() {
+  std::unique_lock ul(mutex_);
+  while (true) {
+    cv_compact_.wait(ul, [this]() { return compact_requested_ || stop_compactor_; });
+    if (!compact_requested_)
+      break;
+    compact_requested_ = false;
+    compacting_ = true;
+    ul.unlock();
+    Compact();
+    PrunePaths();
+    ul.lock();
+    compacting_ = false;
+    cv_compact_.notify_all();
+  }
+}
+
+std::string AnalysisStore::GetName(std::string path) const {
+  if (path.compare(0, analysis_path_.size(), analysis_path_) != 0)
+    return "";
+  return path.substr(analysis_path_.size());
+}
+
+void AnalysisStore::LoadIndex() {
+  if (!std::filesystem::exists(index_path_)) {
+    ScanFiles();
+    return;
+  }
+  nlohmann::json index = utils::LoadJsonFromDisc(index_path_);
+  // Index without file list (old format): index only contains paths.
+  bool has_files = index.contains("files");
+  nlohmann::json paths = (index.contains("paths")) ? index["paths"] : index;
+  for (const auto& it : paths.items()) {
+    try {
+      path_index_[it.key()] = {it.value().at("digest"), it.value().at("size"), it.value().at("mtime")};
+    } catch (std::exception& e) {
+      spdlog::get(LOGGER)->warn("AnalysisStore::LoadIndex: invalid entry {}", it.key());
+    }
+  }
+  if (!has_files) {
+    ScanFiles();
+    return;
+  }
+  for (const auto& it : index["files"]) {
+    try {
+      std::string name = it.at("name");
+      if (files_.count(name) == 0)
+        AddFile(name, it.at("size"), false);
+    } catch (std::exception& e) {
+      spdlog::get(LOGGER)->warn("AnalysisStore::LoadIndex: invalid file entry");
+    }
+  }
+}
+
+void AnalysisStore::ScanFiles() {
+  std::error_code ec;
+  if (!std::filesystem::is_directory(analysis_path_, ec))
+    return;
+  std::vector<std::tuple<std::filesystem::file_time_type, std::string, uintmax_t>> found;
+  for (const auto& it : std::filesystem::directory_iterator(analysis_path_, ec)) {
+    std::string extension = it.path().extension().string();
+    if (!it.is_regular_file(ec) || (extension != ANALYSIS_FILE_EXTENSION && extension != PCM_FILE_EXTENSION))
+      continue;
+    found.push_back({it.last_write_time(ec), it.path().filename().string(), it.file_size(ec)});
+  }
+  // Most recently written first.
+  std::sort(found.begin(), found.end(), 
+      [](const auto& a, const auto& b) { return std::get<0>(a) > std::get<0>(b); });
+  for (const auto& it : found)
+    AddFile(std::get<1>(it), std::get<2>(it), false);
+  index_changed_ = true;
+  spdlog::get(LOGGER)->info("AnalysisStore::ScanFiles: indexed {} files ({} bytes)", files_.size(), total_size_);
+}
+
+void AnalysisStore::SafeIndex() {
+  std::unique_lock ul(mutex_);
+  if (!index_changed_)
+    return;
+  nlohmann::json paths = nlohmann::json::object();
+  for (const auto& it : path_index_) {
+    paths[it.first] = {{"digest", it.second.digest_}, {"size", it.second.size_}, {"mtime", it.second.mtime_}};
+  }
+  // Files of store, most recently used first.
+  nlohmann::json files = nlohmann::json::array();
+  for (const auto& it : lru_)
+    files.push_back({{"name", it}, {"size", files_.at(it).size_}});
+  std::filesystem::create_directories(analysis_path_);
+  nlohmann::json index = {{"paths", paths}, {"files", files}};
+  utils::WriteJsonFromDisc(index_path_, index);
+  index_changed_ = false;
+}
+
+bool AnalysisStore::Digest(std::string path, uint64_t& digest) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    digest = Digest(nullptr, 0);
+    return true;
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return false;
+  madvise(data, size, MADV_SEQUENTIAL);
+  digest = Digest(data, size);
+  munmap(data, size);
+  return true;
+}
+
+uint64_t AnalysisStore::Digest(const void* data, size_t len, uint64_t seed) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  const uint8_t* end = p + len;
+  uint64_t h;
+
+  // Process 32 byte stripes in four independent lanes.
+  if (len >= 32) {
+    uint64_t v1 = seed + kXxhPrime1 + kXxhPrime2;
+    uint64_t v2 = seed + kXxhPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - kXxhPrime1;
+    const uint8_t* limit = end - 32;
+    do {
+      v1 = XxhRound(v1, XxhRead64(p));
+      v2 = XxhRound(v2, XxhRead64(p+8));
+      v3 = XxhRound(v3, XxhRead64(p+16));
+      v4 = XxhRound(v4, XxhRead64(p+24));
+      p += 32;
+    } while (p <= limit);
+    h = XxhRotl(v1, 1) + XxhRotl(v2, 7) + XxhRotl(v3, 12) + XxhRotl(v4, 18);
+    h = XxhMergeRound(h, v1);
+    h = XxhMergeRound(h, v2);
+    h = XxhMergeRound(h, v3);
+    h = XxhMergeRound(h, v4);
+  }
+  else {
+    h = seed + kXxhPrime5;
+  }
+  h += static_cast<uint64_t>(len);
+
+  // Process remaining bytes.
+  for (; p + 8 <= end; p += 8)
+    h = XxhRotl(h ^ XxhRound(0, XxhRead64(p)), 27) * kXxhPrime1 + kXxhPrime4;
+  if (p + 4 <= end) {
+    h = XxhRotl(h ^ (static_cast<uint64_t>(XxhRead32(p)) * kXxhPrime1), 23) * kXxhPrime2 + kXxhPrime3;
+    p += 4;
+  }
+  for (; p < end; p++)
+    h = XxhRotl(h ^ ((*p) * kXxhPrime5), 11) * kXxhPrime1;
+
+  // Avalanche.
+  h ^= h >> 33;
+  h *= kXxhPrime2;
+  h ^= h >> 29;
+  h *= kXxhPrime3;
+  h ^= h >> 32;
+  return h;
+}
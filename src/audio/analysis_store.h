@@ -0,0 +1,236 @@
+#ifndef SRC_AUDIO_ANALYSIS_STORE_H_
+#define SRC_AUDIO_ANALYSIS_STORE_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define ANALYSIS_STORE_BUDGET 1073741824  ///< default size limit (bytes) of all files in store (1 GiB).
+
+/**
+ * Content-addressed store for analysis files in `data/analysis`. Analyses are
+ * keyed on a digest of the audio bytes plus the analysis version, so moving or
+ * renaming a file keeps it's analysis, while re-encoding a file or changing
+ * the analysis parameters invalidates it.
+ * A side index (path -> digest, size, modification time) avoids re-hashing
+ * unchanged files. The index also lists all files of the store (analyses and
+ * pcm cache files) with their size, ordered by last access, so lookups never
+ * touch the file system. Once the store exceeds it's byte budget, least
+ * recently used files are evicted by a background compaction.
+ * The store is thread-safe and may be shared by several audio objects.
+ */
+class AnalysisStore {
+  public:
+    /**
+     * Constructor loading side index. Files of the store are listed once if
+     * the index does not list them yet.
+     * @param[in] base_path path to dissonance files.
+     * @param[in] budget max. size (bytes) of all files in store.
+     */
+    AnalysisStore(std::string base_path, uintmax_t budget=ANALYSIS_STORE_BUDGET);
+
+    /**
+     * Destructor finishing compaction and writing side index, if changed.
+     */
+    ~AnalysisStore();
+
+    AnalysisStore(const AnalysisStore&) = delete;
+    AnalysisStore& operator=(const AnalysisStore&) = delete;
+
+    // getter
+    uintmax_t budget() const;
+
+    /**
+     * Gets size of all files in store.
+     * @return size in bytes.
+     */
+    uintmax_t total_size() const;
+
+    /**
+     * Gets number of files in store.
+     */
+    size_t num_files() const;
+
+    // setter
+    /**
+     * Sets budget, compacting store if exceeded.
+     * @param[in] budget max. size (bytes) of all files in store.
+     */
+    void set_budget(uintmax_t budget);
+
+    // methods
+
+    /**
+     * Gets key of analysis of given audio file. Uses digest from side index if
+     * size and modification time are unchanged, otherwise hashes file content.
+     * @param[in] source_path
+     * @param[in] version analysis version (empty: version of default backend,
+     * see Audio::AnalysisVersion).
+     * @return key in format [digest]_[analysis version] or empty string if
+     * file could not be read.
+     */
+    std::string GetKey(std::string source_path, std::string version="");
+
+    /**
+     * Gets path of analysis file for given key.
+     * @param[in] key
+     * @return path of analysis file.
+     */
+    std::string GetPath(std::string key) const;
+
+    /**
+     * Gets path of pcm cache file (decoded audio, see PcmBuffer) for given
+     * key. Decoded audio does not depend on the analysis version, so only the
+     * digest is used.
+     * @param[in] key
+     * @return path of pcm cache file or empty string if key is empty.
+     */
+    std::string GetPcmPath(std::string key) const;
+
+    /**
+     * Checks whether analysis for given key exists (index lookup).
+     * @param[in] key
+     * @return whether analysis for given key exists.
+     */
+    bool Contains(std::string key) const;
+
+    /**
+     * Marks file of store as used (most recently used file is evicted last).
+     * @param[in] path path of analysis or pcm cache file.
+     * @return false if file is not in store.
+     */
+    bool Touch(std::string path);
+
+    /**
+     * Adds file (or updates it's size) as most recently used file. Starts
+     * background compaction if budget is exceeded.
+     * @param[in] path path of analysis or pcm cache file (may still be written).
+     * @param[in] size size of file in bytes.
+     */
+    void Add(std::string path, uintmax_t size);
+
+    /**
+     * Removes file from store (and disc).
+     * @param[in] path path of analysis or pcm cache file.
+     */
+    void Remove(std::string path);
+
+    /**
+     * Evicts least recently used files until store fits into budget. The most
+     * recently used file is never evicted, even if exceeding the budget alone.
+     * @return number of evicted files.
+     */
+    size_t Compact();
+
+    /**
+     * Forgets side index entries of files which no longer exist. Checks every
+     * indexed path, so it only runs in background compaction and in the batch
+     * library analysis, never on lookups.
+     * @return number of forgotten entries.
+     */
+    size_t PrunePaths();
+
+    /**
+     * Waits until background compaction (if running) is finished.
+     */
+    void WaitForCompaction();
+
+    /**
+     * Writes side index to disc, if it changed since last write. Does not
+     * touch the indexed files (see PrunePaths).
+     */
+    void SafeIndex();
+
+    /**
+     * Computes 64-bit digest (xxh64) of file content.
+     * @param[in] path
+     * @param[out] digest
+     * @return false if file could not be read.
+     */
+    static bool Digest(std::string path, uint64_t& digest);
+
+    /**
+     * Computes 64-bit digest (xxh64) of given bytes.
+     * @param[in] data
+     * @param[in] len
+     * @param[in] seed
+     * @return digest.
+     */
+    static uint64_t Digest(const void* data, size_t len, uint64_t seed=0);
+
+  private:
+    struct IndexEntry {
+      std::string digest_;
+      uintmax_t size_;
+      int64_t mtime_;
+    };
+
+    struct FileEntry {
+      uintmax_t size_;
+      std::list<std::string>::iterator lru_;  ///< position in lru list.
+    };
+
+    const std::string analysis_path_;
+    const std::string index_path_;
+    std::unordered_map<std::string, IndexEntry> path_index_;
+    std::unordered_map<std::string, FileEntry> files_;  ///< file name -> entry.
+    std::list<std::string> lru_;  ///< file names, most recently used first.
+    uintmax_t total_size_;
+    uintmax_t budget_;
+    bool index_changed_;
+    mutable std::mutex mutex_;
+
+    std::thread compactor_;
+    std::condition_variable cv_compact_;
+    bool compact_requested_;
+    bool compacting_;
+    bool stop_compactor_;
+
+    void LoadIndex();
+
+    /**
+     * Lists all files of the store on disc (oldest modification first is
+     * evicted first).
+     */
+    void ScanFiles();
+
+    /**
+     * Adds file (lock must be held).
+     * @param[in] name file name.
+     * @param[in] size
+     * @param[in] front if set, added as most recently used, otherwise as least.
+     */
+    void AddFile(std::string name, uintmax_t size, bool front);
+
+    /**
+     * Removes entries of least recently used files until store fits into
+     * budget (lock must be held).
+     * @return paths of removed files.
+     */
+    std::vector<std::string> TakeVictims();
+
+    /**
+     * Signals compactor thread (lock must be held), starting it if not running.
+     */
+    void RequestCompaction();
+
+    /**
+     * Runs compactions when requested (runs as thread).
+     */
+    void RunCompactor();
+
+    /**
+     * Gets name of file in store.
+     * @param[in] path
+     * @return file name or empty string if path is not inside store.
+     */
+    std::string GetName(std::string path) const;
+};
+
+#endif
@@ -1,13 +1,20 @@
-#include <atomic>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iterator>
+#include <limits>
 #include <nlohmann/json.hpp>
 #include <string>
+#include <thread>
 #include <vector>
+#include "audio/analysis_file.h"
 #include "audio/audio.h"
 #include "constants/codes.h"
 #include "spdlog/spdlog.h"
@@ -16,23 +23,69 @@
 #define LOGGER "logger"
 
 
-std::atomic<bool> pause_audio(false);
+uint16_t Audio::key_masks_[12][2] = {};
 
-const std::vector<std::string> Audio::note_names_ = {
-  "C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B"
-};
-std::map<std::string, std::vector<std::string>> Audio::keys_ = {};
 
+Audio::Audio(std::string base_path, std::shared_ptr<AnalysisStore> store) 
+  : base_path_(base_path), store_(store), stop_analysis_(false), analysing_(false), analysis_threads_(1), 
+  segment_min_length_(ANALYSIS_SEGMENT_MIN_LENGTH), num_segments_(0), pcm_cache_(false), backend_(BACKEND_AUBIO), profile_(PROFILE_DEFAULT), output_channels_(0), output_samplerate_(0),
+  song_start_(0), song_first_interval_(0), next_queued_(false), next_ready_(false) {
+  if (!store_)
+    store_ = std::make_shared<AnalysisStore>(base_path);
+  NewTimeline(0);
+  lead_data_ = PublishData();
+}
 
-Audio::Audio(std::string base_path) : base_path_(base_path) {}
+Audio::~Audio() {
+  StopAnalysis();
+  if (next_)
+    next_->stop_analysis_ = true;
+  if (next_thread_.joinable())
+    next_thread_.join();
+}
 
 // getter 
-AudioData& Audio::analysed_data() {
-  return analysed_data_;
+std::shared_ptr<const AudioData> Audio::analysed_data() const {
+  std::unique_lock ul(data_mutex_);
+  return published_data_;
+}
+
+std::shared_ptr<const AudioData> Audio::lead_data() const {
+  std::unique_lock ul(data_mutex_);
+  return lead_data_;
+}
+
+std::shared_ptr<const BeatTimeline> Audio::timeline() const {
+  return timelines_.Get();
+}
+
+const VersionedTimeline& Audio::timelines() const {
+  return timelines_;
+}
+
+size_t Audio::underruns() const {
+  return (stream_) ? stream_->underruns() : 0;
+}
+
+size_t Audio::overruns() const {
+  return (stream_) ? stream_->overruns() : 0;
 }
 
-std::map<std::string, std::vector<std::string>> Audio::keys() {
-  return keys_;
+bool Audio::next_queued() const {
+  return next_queued_;
+}
+
+double Audio::song_start() const {
+  std::unique_lock ul(data_mutex_);
+  return song_start_;
+}
+
+double Audio::position() const {
+  return (stream_) ? stream_->position() : 0;
+}
+
+size_t Audio::num_segments() const {
+  return num_segments_;
 }
 
 // setter 
@@ -40,110 +93,736 @@ void Audio::set_source_path(std::string source_path) {
   source_path_ = source_path;
 }
 
+void Audio::set_analysis_threads(unsigned int analysis_threads) {
+  analysis_threads_ = std::max(1u, analysis_threads);
+}
+
+void Audio::set_segment_min_length(double segment_min_length) {
+  segment_min_length_ = segment_min_length;
+}
+
+void Audio::set_pcm_cache(bool pcm_cache) {
+  pcm_cache_ = pcm_cache;
+}
+
+void Audio::set_analysis_backend(AnalysisBackend backend) {
+  backend_ = backend;
+}
+
+void Audio::set_analysis_profile(AnalysisProfile profile) {
+  profile_ = profile;
+}
+
+bool Audio::IsCached() {
+  return store_->Contains(store_->GetKey(source_path_, AnalysisVersion(backend_, profile_))) 
+    || std::filesystem::exists(GetLegacyOutPath(source_path_));
+}
+
 void Audio::Analyze() {
-  spdlog::get(LOGGER)->debug("Audio::Analyze: starting analyses. Starting audi-data extraction");
+  StartAnalysis(ANALYSIS_INTERVALS, false);
+  WaitForAnalysis();
+}
+
+void Audio::StartAnalysis(size_t lead_intervals, bool progressive) {
+  spdlog::get(LOGGER)->debug("Audio::StartAnalysis: starting analyses. Starting audi-data extraction");
+  StopAnalysis();
+  lead_intervals = std::max(lead_intervals, static_cast<size_t>(1));
 
   // Load or analyse data.
   std::string out_path = GetOutPath(source_path_);
-  if (std::filesystem::exists(out_path))
-    analysed_data_ = Load(out_path);
-  else  {
-    analysed_data_ = AnalyzeFile(source_path_);
+  std::string legacy_out_path = GetLegacyOutPath(source_path_);
+  bool loaded = false;
+  bool converted = false;
+  std::shared_ptr<BeatTimeline> refined;  ///< timeline the lead is taken from.
+  analysed_data_ = AudioData();
+  PublishData();
+  if (out_path != "" && store_->Touch(out_path)) {
+    try {
+      analysed_data_ = Load(out_path);
+      loaded = true;
+    } catch (const char* e) {
+      spdlog::get(LOGGER)->warn("Audio::StartAnalysis: could not load {}: {}", out_path, e);
+      store_->Remove(out_path);
+    }
+  }
+  // Convert analysis in old json-format (no intervals stored).
+  else if (std::filesystem::exists(legacy_out_path)) {
+    analysed_data_ = LoadJson(legacy_out_path);
+    std::filesystem::remove(legacy_out_path);
+    converted = analysed_data_.data_per_beat_.size() > 0;
+    if (converted) {
+      analysed_data_.duration_ = analysed_data_.data_per_beat_.back().time_;
+      auto& beats = analysed_data_.data_per_beat_;
+      for (size_t i=0; i<beats.size(); i++)
+        beats.set_interval(i, GetIntervalForTime(beats.times()[i], analysed_data_.duration_));
+    }
   }
 
-  spdlog::get(LOGGER)->info("Analyzing max peak");
-  int max = 0;
-  for (const auto& it : analysed_data_.data_per_beat_) {
-    int new_max = it.level_- analysed_data_.average_level_;
-    if (new_max > max)
-      max = new_max;
+  // Publish loaded data at once.
+  if (loaded || converted) {
+    NewTimeline(analysed_data_.duration_);
+    PublishAnalysedData(*timeline_);
+    if (converted)
+      Safe(analysed_data_, out_path);
+    PublishData();
+    store_->SafeIndex();
+    timeline_->Finish();
+    refined = timeline_;
+    // Decoded audio is only needed for playback: start decoding in background.
+    try {
+      LoadPcm();
+    } catch (const char* e) {
+      spdlog::get(LOGGER)->warn("Audio::StartAnalysis: could not decode {}: {}", source_path_, e);
+    }
+  }
+  // Otherwise start analysis, which publishes beats interval by interval.
+  else {
+    LoadPcm();
+    analysed_data_.duration_ = pcm_->duration();
+    analysed_data_.profile_ = profile_;
+    analysed_data_.samplerate_ = pcm_->samplerate()/Decimator::Factor(pcm_->samplerate(), ProfileSamplerate(profile_));
+    NewTimeline(analysed_data_.duration_);
+    refined = timeline_;
+    if (progressive) {
+      refined = std::make_shared<BeatTimeline>();
+      refined->Reset(analysed_data_.duration_, false);
+    }
+    stop_analysis_ = false;
+    analysing_ = true;
+    analysis_thread_ = std::thread([this, pcm=pcm_, out_path, refined]() { 
+      AnalyzeFile(pcm, out_path, refined); 
+      analysing_ = false;
+    });
   }
-  analysed_data_.max_peak_ = max;
-  spdlog::get(LOGGER)->info("Done");
 
-  // Create analysed_data.
-  // Add information on keys
-  CreateLevels(8);
+  // Wait until lead is available on the current (coarse, if progressive)
+  // timeline, so consumers find at least one beat and interval.
+  timeline_->WaitFor(lead_intervals);
+  std::string lead_path = GetLeadPath(source_path_, lead_intervals);
+  std::shared_ptr<const AudioData> lead_data;
+  // Lead of coarse pass is stored, so map (built from lead) is the same on
+  // each play, whether cached or not.
+  if ((loaded || converted) && lead_path != "" && store_->Touch(lead_path)) {
+    try {
+      lead_data = std::make_shared<const AudioData>(LoadLead(lead_path, lead_intervals));
+    } catch (const char* e) {
+      spdlog::get(LOGGER)->warn("Audio::StartAnalysis: could not load {}: {}", lead_path, e);
+      store_->Remove(lead_path);
+    }
+  }
+  if (!lead_data) {
+    lead_data = std::make_shared<const AudioData>(timeline_->Snapshot(lead_intervals));
+    // Coarse pass failed: wait for lead of complete analysis.
+    if (lead_data->data_per_beat_.size() == 0 && refined != timeline_) {
+      refined->WaitFor(lead_intervals);
+      lead_data = std::make_shared<const AudioData>(refined->Snapshot(lead_intervals));
+    }
+    else if (refined != timeline_ && lead_path != "") {
+      Safe(*lead_data, lead_path);
+      store_->SafeIndex();
+    }
+  }
+  SetLeadData(lead_data);
+  spdlog::get(LOGGER)->info("Audio::StartAnalysis: lead of {} beats available.", lead_data->data_per_beat_.size());
 }
 
-AudioData Audio::AnalyzeFile(std::string source_path) {
-  spdlog::get(LOGGER)->debug("Audio::AnalyzeFile: starting analyses of {}", source_path); 
-  std::list<AudioDataTimePoint> data_per_beat;
-  uint_t samplerate = 0;
-  uint_t win_size = 1024; // window size
-  uint_t hop_size = win_size / 4;
-  uint_t n_frames = 0, read = 0;
+void Audio::StartStreamAnalysis(std::string stream_path, PcmStreamFormat format, size_t lead_intervals) {
+  StopAnalysis();
+  auto stream = std::make_shared<PcmStream>(stream_path, format);
+  analysed_data_ = AudioData();
+  PublishData();
+  NewTimeline(0, true);
+  stop_analysis_ = false;
+  analysing_ = true;
+  analysis_thread_ = std::thread([this, stream]() { 
+    AnalyzePcmStream(*stream, nullptr); 
+    analysing_ = false;
+  });
+  timeline_->WaitFor(std::max(lead_intervals, static_cast<size_t>(1)));
+  auto lead_data = std::make_shared<const AudioData>(timeline_->Snapshot(lead_intervals));
+  SetLeadData(lead_data);
+  spdlog::get(LOGGER)->info("Audio::StartStreamAnalysis: lead of {} beats available.", 
+      lead_data->data_per_beat_.size());
+}
 
-  // Load audio-file
-  aubio_source_t * source = new_aubio_source(source_path.c_str(), samplerate, hop_size);
-  if (!source) { 
-    aubio_cleanup();
-    throw "Could not load audio-source";
+void Audio::AnalyzeStream(std::string stream_path, PcmStreamFormat format, 
+    std::function<void(const AudioDataTimePoint&)> on_publish) {
+  StopAnalysis();
+  PcmStream stream(stream_path, format);
+  analysed_data_ = AudioData();
+  PublishData();
+  NewTimeline(0, true);
+  stop_analysis_ = false;
+  AnalyzePcmStream(stream, on_publish);
+}
+
+void Audio::AnalyzePcmStream(PcmStream& stream, 
+    const std::function<void(const AudioDataTimePoint&)>& on_publish) {
+  spdlog::get(LOGGER)->debug("Audio::AnalyzePcmStream: starting analyses of stream"); 
+  unsigned int samplerate = stream.format().samplerate_;
+  analysed_data_.profile_ = profile_;
+  analysed_data_.samplerate_ = samplerate/Decimator::Factor(samplerate, ProfileSamplerate(profile_));
+  std::vector<AudioDataTimePoint> interval_beats;
+  size_t cur_interval = 0;
+  bool open_ended = false;  ///< last interval of timeline is published.
+  auto publish_interval = [&]() {
+    PublishInterval(*timeline_, cur_interval, interval_beats);
+    if (on_publish) {
+      for (const auto& it : interval_beats)
+        on_publish(it);
+    }
+    interval_beats.clear();
+  };
+  auto on_beat = [&](const AudioDataTimePoint& data_at_beat) {
+    size_t interval = data_at_beat.time_/ANALYSIS_STREAM_INTERVAL;
+    for (; !open_ended && interval > cur_interval; cur_interval++) {
+      publish_interval();
+      open_ended = cur_interval == TIMELINE_MAX_INTERVALS-1;
+    }
+    AudioDataTimePoint beat = data_at_beat;
+    beat.interval_ = std::min(interval, static_cast<size_t>(TIMELINE_MAX_INTERVALS-1));
+    if (open_ended) {
+      timeline_->AddBeat(beat);
+      if (on_publish)
+        on_publish(beat);
+    }
+    else {
+      interval_beats.push_back(beat);
+    }
+  };
+
+  auto read_hop = [&stream](float* out, size_t n) { return stream.ReadMono(out, n); };
+  if (!AnalyzeHops(samplerate, 0, -1, read_hop, on_beat))
+    spdlog::get(LOGGER)->error("Audio::AnalyzePcmStream: Could not analyse stream.");
+  else if (!open_ended)
+    publish_interval();
+  spdlog::get(LOGGER)->info("Audio::AnalyzePcmStream: analysed {} frames, {} beats.", stream.frames_read(), 
+      timeline_->size());
+  PublishData();
+  timeline_->Finish();
+}
+
+void Audio::QueueNext(std::string source_path) {
+  if (next_thread_.joinable())
+    next_thread_.join();
+  next_ready_ = false;
+  next_ = std::make_unique<Audio>(base_path_, store_);
+  next_->set_analysis_threads(analysis_threads_);
+  next_->set_pcm_cache(pcm_cache_);
+  next_->set_analysis_backend(backend_);
+  next_->set_analysis_profile(profile_);
+  next_->set_source_path(source_path);
+  // Decode in format of current song (and playback device).
+  if (pcm_) {
+    next_->output_channels_ = pcm_->channels();
+    next_->output_samplerate_ = pcm_->samplerate();
+  }
+  next_queued_ = true;
+  next_thread_ = std::thread([this, next=next_.get()]() {
+    try {
+      next->Analyze();
+    } catch (const char* e) {
+      spdlog::get(LOGGER)->error("Audio::QueueNext: could not analyse {}: {}", next->source_path_, e);
+      next_queued_ = false;
+      return;
+    }
+    if (!next->pcm_ || next->analysed_data()->data_per_beat_.size() == 0) {
+      spdlog::get(LOGGER)->error("Audio::QueueNext: no beats found in {}", next->source_path_);
+      next_queued_ = false;
+      return;
+    }
+    next_ready_ = true;
+  });
+}
+
+bool Audio::SpliceNext() {
+  // Stream crossfades into one queued song at a time: wait until it switched to the song queued before.
+  // Both analyses are finished once flags are set (threads only return
+  // afterwards), so the render thread calling this never joins them.
+  if (!next_ready_ || analysing_ || (stream_ && stream_->queued()))
+    return false;
+  next_ready_ = false;
+
+  // Crossfade into queued song at end of current song.
+  auto current = analysed_data();
+  auto next = next_->analysed_data();
+  double start = song_start_ + std::max(0.0, current->duration_-PLAYBACK_CROSSFADE);
+  if (stream_) {
+    try {
+      size_t frame = stream_->Queue(next_->pcm_, PLAYBACK_CROSSFADE*stream_->samplerate()/1000);
+      start = frame*1000.0/stream_->samplerate();
+    } catch (const char* e) {
+      spdlog::get(LOGGER)->error("Audio::SpliceNext: could not queue {}: {}", next_->source_path_, e);
+      next_.reset();
+      next_queued_ = false;
+      return false;
+    }
+  }
+
+  // Intervals of queued song follow intervals of current song (ids keep
+  // counting up across all songs spliced on).
+  auto spliced = std::make_shared<BeatTimeline>();
+  spliced->Reset(start + next->duration_, false, song_first_interval_);
+  PublishShifted(*spliced, *current, song_start_, start, song_first_interval_);
+  size_t next_first_interval = spliced->num_intervals();
+  PublishShifted(*spliced, *next, start, start + next->duration_, next_first_interval);
+  spliced->Finish();
+  spdlog::get(LOGGER)->info("Audio::SpliceNext: spliced on {} at {} ms ({} beats).", next_->source_path_, 
+      start, spliced->size());
+
+  // Queued song becomes current song.
+  {
+    std::unique_lock ul(data_mutex_);
+    source_path_ = next_->source_path_;
+    pcm_ = next_->pcm_;
+    pcm_source_path_ = source_path_;
+    published_data_ = next;
+    lead_data_ = next;
+    song_start_ = start;
+    song_first_interval_ = next_first_interval;
+    timeline_ = spliced;
+  }
+  timelines_.Swap(spliced);
+  next_.reset();
+  next_queued_ = false;
+  return true;
+}
+
+void Audio::WaitForAnalysis() {
+  if (analysis_thread_.joinable())
+    analysis_thread_.join();
+}
+
+void Audio::StopAnalysis() {
+  stop_analysis_ = true;
+  WaitForAnalysis();
+}
+
+void Audio::LoadPcm() {
+  if (pcm_ && pcm_source_path_ == source_path_)
+    return;
+  pcm_ = nullptr;
+  std::string pcm_path = (pcm_cache_) ? store_->GetPcmPath(store_->GetKey(source_path_)) : "";
+  if (pcm_path != "" && store_->Touch(pcm_path)) {
+    try {
+      pcm_ = PcmBuffer::Open(pcm_path);
+    } catch (const char* e) {
+      spdlog::get(LOGGER)->warn("Audio::LoadPcm: could not load {}: {}", pcm_path, e);
+      store_->Remove(pcm_path);
+    }
   }
-  // Update samplerate.
-  samplerate = aubio_source_get_samplerate(source);
+  // Cached in other format: decode in requested format (keeping cache file).
+  if (pcm_ && ((output_channels_ > 0 && pcm_->channels() != output_channels_) 
+        || (output_samplerate_ > 0 && pcm_->samplerate() != output_samplerate_))) {
+    pcm_ = nullptr;
+    pcm_path = "";
+  }
+  if (!pcm_) {
+    if (pcm_path != "")
+      std::filesystem::create_directories(std::filesystem::path(pcm_path).parent_path());
+    pcm_ = PcmBuffer::Decode(source_path_, pcm_path, output_channels_, output_samplerate_);
+    // Cache file is written once decoding is complete, but counts towards budget at once.
+    if (pcm_path != "")
+      store_->Add(pcm_path, PcmBuffer::FileSize(pcm_->num_frames(), pcm_->channels()));
+  }
+  pcm_source_path_ = source_path_;
+}
+
+void Audio::NewTimeline(double duration, bool paging) {
+  timeline_ = std::make_shared<BeatTimeline>();
+  timeline_->Reset(duration, paging);
+  timelines_.Swap(timeline_);
+}
+
+void Audio::AnalyzeFile(std::shared_ptr<PcmBuffer> pcm, std::string out_path, 
+    std::shared_ptr<BeatTimeline> refined) {
+  spdlog::get(LOGGER)->debug("Audio::AnalyzeFile: starting analyses of {}", source_path_); 
+
+  // Coarse pass publishes (and finishes) the current timeline alongside the
+  // complete analysis, which is swapped in later.
+  bool progressive = refined != timeline_;
+  std::thread coarse;
+  if (progressive)
+    coarse = std::thread([this, pcm, timeline=timeline_]() { AnalyzeCoarse(*pcm, *timeline); });
+
+  // Publish all beats of an interval, once the interval is complete.
+  std::vector<AudioDataTimePoint> interval_beats;
+  size_t cur_interval = 0;
+  auto on_beat = [&](const AudioDataTimePoint& data_at_beat) {
+    analysed_data_.data_per_beat_.push_back(data_at_beat);
+    for (; static_cast<size_t>(data_at_beat.interval_) > cur_interval; cur_interval++) {
+      PublishInterval(*refined, cur_interval, interval_beats);
+      interval_beats.clear();
+    }
+    interval_beats.push_back(data_at_beat);
+  };
+
+  // Long songs are split into segments analysed in parallel.
+  size_t num_segments = std::min(static_cast<size_t>(analysis_threads_), 
+      static_cast<size_t>(analysed_data_.duration_/segment_min_length_));
+  num_segments_ = std::max(num_segments, static_cast<size_t>(1));
+  bool success = true;
+  if (num_segments > 1)
+    AnalyzeSegmented(*pcm, num_segments, on_beat);
+  else 
+    success = AnalyzeSegment(*pcm, 0, -1, on_beat);
+  if (coarse.joinable())
+    coarse.join();
+  if (!success) {
+    spdlog::get(LOGGER)->error("Audio::AnalyzeFile: Could not analyse source.");
+    refined->Finish();
+    timeline_->Finish();
+    return;
+  }
+
+  // Publish remaining intervals.
+  for (; cur_interval < ANALYSIS_INTERVALS; cur_interval++) {
+    PublishInterval(*refined, cur_interval, interval_beats);
+    interval_beats.clear();
+  }
+
+  spdlog::get(LOGGER)->debug("Audio::AnalyzeFile: got all data. Analyzing extracted data.");
+  if (analysed_data_.data_per_beat_.size() > 0) {
+    float average_bpm = 0.0f;
+    float average_level = 0.0f;
+    for (const auto& it : analysed_data_.data_per_beat_) {
+      average_bpm += it.bpm_;
+      average_level += it.level_;
+    }
+    analysed_data_.average_bpm_ = average_bpm / analysed_data_.data_per_beat_.size();
+    analysed_data_.average_level_ = average_level / analysed_data_.data_per_beat_.size();
+  }
+  CalcMaxPeak();
+  refined->Finish();
+  // Swap in refined timeline (a new timeline, as the coarse one is being read).
+  if (progressive && !stop_analysis_) {
+    timelines_.Swap(refined);
+    spdlog::get(LOGGER)->info("Audio::AnalyzeFile: swapped in refined timeline of {} beats (coarse: {}).", 
+        refined->size(), timeline_->size());
+  }
+  auto published = PublishData();
+  // Only safe complete analysis.
+  if (!stop_analysis_)
+    Safe(*published, out_path);
+  store_->SafeIndex();
+  timeline_->Finish();
+}
+
+bool Audio::AnalyzeCoarse(const PcmBuffer& pcm, BeatTimeline& timeline) {
+  // Intervals are not kept in analysed data (written by complete analysis at the same time).
+  std::vector<AudioDataTimePoint> interval_beats;
+  size_t cur_interval = 0;
+  auto publish_interval = [&]() {
+    timeline.AddInterval(CalcLevel(cur_interval, interval_beats));
+    for (const auto& it : interval_beats)
+      timeline.AddBeat(it);
+    interval_beats.clear();
+  };
+  auto on_beat = [&](const AudioDataTimePoint& data_at_beat) {
+    for (; static_cast<size_t>(data_at_beat.interval_) > cur_interval; cur_interval++)
+      publish_interval();
+    interval_beats.push_back(data_at_beat);
+  };
+  auto start = std::chrono::steady_clock::now();
+  bool success = AnalyzeSegment(pcm, 0, -1, on_beat, true);
+  for (; success && cur_interval < ANALYSIS_INTERVALS; cur_interval++)
+    publish_interval();
+  timeline.Finish();
+  if (!success)
+    spdlog::get(LOGGER)->error("Audio::AnalyzeCoarse: Could not analyse source.");
+  spdlog::get(LOGGER)->info("Audio::AnalyzeCoarse: published {} beats after {}ms.", timeline.size(), 
+      utils::GetElapsed(start, std::chrono::steady_clock::now()));
+  return success;
+}
+
+bool Audio::AnalyzeSegment(const PcmBuffer& pcm, double from, double to, 
+    const std::function<void(const AudioDataTimePoint&)>& on_beat, bool coarse) {
+  size_t frame = from*pcm.samplerate()/1000;
+  auto read_hop = [&pcm, &frame](float* out, size_t n) {
+    size_t read = pcm.ReadMono(frame, out, n);
+    frame += read;
+    return read;
+  };
+  return AnalyzeHops(pcm.samplerate(), from, to, read_hop, on_beat, coarse);
+}
+
+bool Audio::AnalyzeHops(uint_t samplerate, double from, double to, 
+    const std::function<size_t(float*, size_t)>& read_hop,
+    const std::function<void(const AudioDataTimePoint&)>& on_beat, bool coarse) {
+  // Downsample according to profile, scaling window and hop size (same length in time).
+  AnalysisProfile profile = (coarse) ? ANALYSIS_COARSE_PROFILE : profile_;
+  Decimator decimator(Decimator::Factor(samplerate, ProfileSamplerate(profile)));
+  samplerate /= decimator.factor();
+  uint_t win_size = ANALYSIS_WIN_SIZE/decimator.factor(); // window size
+  uint_t hop_size = ANALYSIS_HOP_SIZE*((coarse) ? ANALYSIS_COARSE_HOP_FACTOR : 1)/decimator.factor();
+  uint_t n_frames = 0, read = 0;
+  std::vector<float> native(ANALYSIS_HOP_SIZE);
+  std::vector<float> decimated;  // downsampled frames not analysed yet.
+  auto read_decimated = [&](float* out, size_t n) {
+    while (decimated.size() < n) {
+      size_t read_native = read_hop(native.data(), native.size());
+      decimator.Process(native.data(), read_native, decimated);
+      if (read_native < native.size())
+        break;
+    }
+    size_t len = std::min(n, decimated.size());
+    std::copy(decimated.begin(), decimated.begin()+len, out);
+    decimated.erase(decimated.begin(), decimated.begin()+len);
+    return len;
+  };
 
   // create some vectors
   fvec_t * in = new_fvec (hop_size); // input audio buffer
   fvec_t * out = new_fvec (1); // output position
   fvec_t * out_notes = new_fvec (1); // output position
   
-  // create tempo- and notes-object
-  aubio_tempo_t * bpm_obj = new_aubio_tempo("default", win_size, hop_size, samplerate);
-  aubio_notes_t * notes_obj = new_aubio_notes ("default", win_size, hop_size, samplerate);
-  if (!bpm_obj && !notes_obj) { 
-    del_fvec(in);
-    del_fvec(out);
-    del_aubio_source(source);
-    throw "Could not create notes or bpm object.";
-  }
-
-  float average_bpm = 0.0f;
-  float average_level = 0.0f;
+  // create tempo- and notes-object (or fused feature extractor)
+  std::unique_ptr<FeatureExtractor> extractor;
+  aubio_tempo_t * bpm_obj = nullptr;
+  aubio_notes_t * notes_obj = nullptr;
+  if (backend_ == BACKEND_FUSED) {
+    extractor = std::make_unique<FeatureExtractor>(samplerate, win_size, hop_size);
+  }
+  else {
+    bpm_obj = new_aubio_tempo("default", win_size, hop_size, samplerate);
+    notes_obj = new_aubio_notes ("default", win_size, hop_size, samplerate);
+    if (!bpm_obj || !notes_obj) { 
+      if (bpm_obj) del_aubio_tempo(bpm_obj);
+      if (notes_obj) del_aubio_notes(notes_obj);
+      del_fvec(in);
+      del_fvec(out);
+      del_fvec(out_notes);
+      return false;
+    }
+  }
+
   std::vector<Note> last_notes;
-  std::vector<int> last_levels;
+  LevelMeter level_meter;
   do {
-    // Put some fresh data in input vector
-    aubio_source_do(source, in, &read);
+    // Put some fresh data in input vector (padded with silence at the end).
+    read = (decimator.factor() > 1) ? read_decimated(in->data, hop_size) : read_hop(in->data, hop_size);
+    std::fill(in->data+read, in->data+hop_size, 0);
     // execute tempo and notes, add notes to last notes.
-    aubio_tempo_do(bpm_obj,in,out);
-    aubio_notes_do(notes_obj, in, out_notes);
-    if (out_notes->data[0] != 0)
-      last_notes.push_back(ConvertMidiToNote(out_notes->data[0]));
-    last_levels.push_back(100-(-1*aubio_level_detection(in, -90.)));
+    bool beat = false;
+    if (extractor) {
+      beat = extractor->Do(in->data);
+    }
+    else {
+      aubio_tempo_do(bpm_obj,in,out);
+      aubio_notes_do(notes_obj, in, out_notes);
+      if (out_notes->data[0] != 0)
+        last_notes.push_back(ConvertMidiToNote(out_notes->data[0]));
+      beat = out->data[0] != 0;
+    }
+    level_meter.AddHop(in->data, in->length);
 
     // do something with the beats
-    if (out->data[0] != 0) {
-      // Get current level and bpm
-      int level = std::accumulate(last_levels.begin(), last_levels.end(), 0.0)/last_levels.size();
-      last_levels.clear();
-      int bpm = aubio_tempo_get_bpm(bpm_obj);
-      average_bpm += bpm;
-      average_level += level;
+    if (beat) {
+      // Get current level, bpm and time (relative to seeked position) and chroma.
+      int level = level_meter.TakeAverage();
+      int bpm = 0;
+      double time = from;
+      Chroma chroma = {};
+      if (extractor) {
+        extractor->TakeBeat(chroma, last_notes);
+        bpm = extractor->bpm();
+        time += extractor->last_beat_ms();
+      }
+      else {
+        bpm = aubio_tempo_get_bpm(bpm_obj);
+        time += aubio_tempo_get_last_ms(bpm_obj);
+      }
       // Add data-point and clear last notes.
-      data_per_beat.push_back(AudioDataTimePoint({aubio_tempo_get_last_ms(bpm_obj), bpm, level, last_notes}));
+      on_beat({time, bpm, level, last_notes, GetIntervalForTime(time, analysed_data_.duration_), chroma});
       last_notes.clear();
     }
     n_frames += read;
-  } while ( read == hop_size );
+  } while (read == hop_size && !stop_analysis_ && (to < 0 || from+n_frames*1000.0/samplerate < to));
 
-  // clean up memory
-  del_aubio_tempo(bpm_obj);
+  // clean up memory (global aubio-cleanup is left to the caller, as several
+  // files might be analyzed in parallel).
+  if (bpm_obj) del_aubio_tempo(bpm_obj);
+  if (notes_obj) del_aubio_notes(notes_obj);
   del_fvec(in);
   del_fvec(out);
-  del_aubio_source(source);
-  aubio_cleanup();
+  del_fvec(out_notes);
+  return true;
+}
+
+void Audio::AnalyzeSegmented(const PcmBuffer& pcm, size_t num_segments, 
+    const std::function<void(const AudioDataTimePoint&)>& on_beat) {
+  double segment_length = analysed_data_.duration_/num_segments;
+  spdlog::get(LOGGER)->info("Audio::AnalyzeSegmented: analysing {} segments of {}ms", num_segments, 
+      segment_length);
+
+  // Analyse each segment (incl. overlap on both sides), all reading the same decoded audio.
+  std::vector<std::vector<AudioDataTimePoint>> segments(num_segments);
+  std::vector<int> success(num_segments, false);  // no vector<bool>: written concurrently.
+  std::vector<std::thread> workers;
+  for (size_t i=0; i<num_segments; i++) {
+    workers.push_back(std::thread([this, i, &pcm, segment_length, &segments, &success]() {
+      double from = std::max(0.0, i*segment_length - ANALYSIS_SEGMENT_OVERLAP);
+      double to = (i+1)*segment_length + ANALYSIS_SEGMENT_OVERLAP;
+      success[i] = AnalyzeSegment(pcm, from, to, 
+          [&segment=segments[i]](const AudioDataTimePoint& beat) { segment.push_back(beat); });
+    }));
+  }
+
+  // Stitch segments in order, handing on beats as soon as segment is stitched.
+  std::vector<AudioDataTimePoint> beats;
+  for (size_t i=0; i<num_segments; i++) {
+    workers[i].join();
+    if (!success[i])
+      spdlog::get(LOGGER)->error("Audio::AnalyzeSegmented: failed analysing segment {}", i);
+    size_t stitched = beats.size();
+    double end = (i+1 == num_segments) ? std::numeric_limits<double>::max() : (i+1)*segment_length;
+    StitchSegment(beats, segments[i], i*segment_length, end);
+    for (size_t j=stitched; j<beats.size(); j++)
+      on_beat(beats[j]);
+  }
+}
+
+void Audio::StitchSegment(std::vector<AudioDataTimePoint>& beats, 
+    const std::vector<AudioDataTimePoint>& segment, double start, double end) {
+  int last_bpm = (beats.size() > 0) ? beats.back().bpm_ : 0;
+  bool first = true;
+  for (const auto& it : segment) {
+    if (it.time_ < start || it.time_ >= end)
+      continue;
+    AudioDataTimePoint beat = it;
+    // Reconcile bpm, if tracker of this segment has not (yet) locked to same tempo.
+    if (last_bpm > 0 && beat.time_ < start + ANALYSIS_SEGMENT_OVERLAP) {
+      for (double factor : {2.0, 0.5}) {
+        if (std::abs(beat.bpm_ - last_bpm*factor) <= last_bpm*factor*ANALYSIS_BPM_OCTAVE_TOLERANCE)
+          beat.bpm_ = last_bpm;
+      }
+    }
+    // Skip duplicate of last beat of preceding segment.
+    if (first && beats.size() > 0 && beat.bpm_ > 0 && beat.time_ - beats.back().time_ < 30000.0/beat.bpm_)
+      continue;
+    beats.push_back(beat);
+    first = false;
+  }
+}
+
+void Audio::PublishAnalysedData(BeatTimeline& timeline) {
+  CalcMaxPeak();
+  std::vector<AudioDataTimePoint> interval_beats;
+  size_t cur_interval = 0;
+  for (const auto& it : analysed_data_.data_per_beat_) {
+    for (; static_cast<size_t>(it.interval_) > cur_interval; cur_interval++) {
+      PublishInterval(timeline, cur_interval, interval_beats);
+      interval_beats.clear();
+    }
+    interval_beats.push_back(it);
+  }
+  for (; cur_interval < ANALYSIS_INTERVALS; cur_interval++) {
+    PublishInterval(timeline, cur_interval, interval_beats);
+    interval_beats.clear();
+  }
+}
+
+void Audio::SetLeadData(std::shared_ptr<const AudioData> lead_data) {
+  std::unique_lock ul(data_mutex_);
+  lead_data_ = lead_data;
+}
+
+std::shared_ptr<const AudioData> Audio::PublishData() {
+  auto published = std::make_shared<const AudioData>(std::move(analysed_data_));
+  analysed_data_ = AudioData();
+  std::unique_lock ul(data_mutex_);
+  published_data_ = published;
+  return published;
+}
+
+void Audio::PublishInterval(BeatTimeline& timeline, size_t interval, 
+    const std::vector<AudioDataTimePoint>& beats) {
+  analysed_data_.intervals_[interval] = CalcLevel(interval, beats);
+  timeline.AddInterval(analysed_data_.intervals_[interval]);
+  for (const auto& it : beats)
+    timeline.AddBeat(it);
+}
+
+void Audio::PublishShifted(BeatTimeline& timeline, const AudioData& audio_data, double offset, double end,
+    size_t first_interval) {
+  for (const auto& it : audio_data.intervals_) {
+    Interval interval = it.second;
+    interval.id_ += first_interval;
+    timeline.AddInterval(interval);
+  }
+  for (auto beat : audio_data.data_per_beat_) {
+    beat.time_ += offset;
+    if (beat.time_ >= end)
+      break;
+    beat.interval_ += first_interval;
+    timeline.AddBeat(beat);
+  }
+}
+
+void Audio::CalcMaxPeak() {
+  spdlog::get(LOGGER)->info("Analyzing max peak");
+  int max = 0;
+  for (const auto& it : analysed_data_.data_per_beat_) {
+    int new_max = it.level_- analysed_data_.average_level_;
+    if (new_max > max)
+      max = new_max;
+  }
+  analysed_data_.max_peak_ = max;
+}
+
+int Audio::GetIntervalForTime(double time, double duration) {
+  // Fall back to fixed length intervals, if duration is unknown.
+  int interval = (duration > 0) ? time*ANALYSIS_INTERVALS/duration : time/ANALYSIS_STREAM_INTERVAL;
+  return std::max(0, std::min(interval, ANALYSIS_INTERVALS-1));
+}
 
-  spdlog::get(LOGGER)->debug("Audio::Analyze: got all data. Analyzing extracted data.");
+void Audio::Safe(const AudioData& analysed_data, std::string out_path) {
+  if (out_path == "") {
+    spdlog::get(LOGGER)->error("Audio::Safe: no key for {}, not safing analysis.", source_path_);
+    return;
+  }
+  std::filesystem::create_directories(std::filesystem::path(out_path).parent_path());
+  AnalysisFile::Write(out_path, analysed_data);
+  store_->Add(out_path, AnalysisFile::FileSize(analysed_data.data_per_beat_.size(), 
+        analysed_data.data_per_beat_.note_pool().size()));
+}
+
+AudioData Audio::Load(std::string path) {
+  AnalysisFile file(path);
+  AudioData audio_data;
+  audio_data.average_bpm_ = file.header().average_bpm_;
+  audio_data.average_level_ = file.header().average_level_;
+  audio_data.duration_ = file.header().duration_;
+  audio_data.profile_ = static_cast<AnalysisProfile>(file.header().profile_);
+  audio_data.samplerate_ = file.header().samplerate_;
+  // Loading copies: beat data owns it's columns (intervals are updated and
+  // beats are published to the timeline), so the mapping is only used to
+  // avoid parsing. Columns have the same layout as in memory, so each column
+  // is copied in bulk.
+  audio_data.data_per_beat_.reserve(file.num_beats(), file.header().num_notes_);
+  audio_data.data_per_beat_.Append(file.num_beats(), file.times(), file.bpms(), file.levels(), 
+      file.intervals(), file.note_offsets(), file.note_pool(), file.chromas());
+  return audio_data;
+}
 
-  average_bpm /= data_per_beat.size();
-  average_level /= data_per_beat.size();
-  auto analysed_data = AudioData({data_per_beat, average_bpm, average_level});
-  Safe(analysed_data, source_path);
-  return analysed_data;
+AudioData Audio::LoadLead(std::string path, size_t lead_intervals) {
+  AudioData lead = Load(path);
+  // Intervals and max peak are not stored: computed as by BeatTimeline::Snapshot.
+  const auto& beats = lead.data_per_beat_;
+  std::vector<std::vector<AudioDataTimePoint>> interval_beats(lead_intervals);
+  for (const auto& it : beats) {
+    if (static_cast<size_t>(it.interval_) < lead_intervals)
+      interval_beats[it.interval_].push_back(it);
+  }
+  for (size_t i=0; i<lead_intervals; i++)
+    lead.intervals_[i] = CalcLevel(i, interval_beats[i]);
+  lead.max_peak_ = 0;
+  for (const auto& level : beats.levels())
+    lead.max_peak_ = std::max(lead.max_peak_, static_cast<int>(level - lead.average_level_));
+  return lead;
 }
 
-void Audio::Safe(AudioData analysed_data, std::string source_path) {
+void Audio::SafeJson(const AudioData& analysed_data, std::string path) {
   nlohmann::json data = {{"average_bpm", analysed_data.average_bpm_}, {"average_level", analysed_data.average_level_}};
   data["time_points"] = nlohmann::json::array();
   for (const auto& it : analysed_data.data_per_beat_) {
@@ -152,230 +831,247 @@ void Audio::Safe(AudioData analysed_data, std::string source_path) {
       midis.push_back(note.midi_note_);
     data["time_points"].push_back({{"time", it.time_}, {"bpm", it.bpm_}, {"level", it.level_}, {"notes", midis}});
   }
-  utils::WriteJsonFromDisc(GetOutPath(source_path), data);
+  utils::WriteJsonFromDisc(path, data);
 }
 
-AudioData Audio::Load(std::string source_path) {
+AudioData Audio::LoadJson(std::string path) {
   AudioData audio_data;
-  nlohmann::json data = utils::LoadJsonFromDisc(source_path);
+  nlohmann::json data = utils::LoadJsonFromDisc(path);
   audio_data.average_bpm_ = data["average_bpm"];
   audio_data.average_level_ = data["average_level"];
-  std::list<AudioDataTimePoint> data_per_beat;
   for (const auto& it : data["time_points"]) {
     std::vector<int> midis = it["notes"];
     std::vector<Note> notes;
     for (const auto& midi_note : midis) 
       notes.push_back(ConvertMidiToNote(midi_note));
-    data_per_beat.push_back({it["time"], it["bpm"], it["level"], notes});
+    audio_data.data_per_beat_.push_back({it["time"], it["bpm"], it["level"], notes, 0});
   }
-  audio_data.data_per_beat_ = data_per_beat;
   return audio_data;
 }
 
-void Audio::play() {
+bool Audio::play() {
   spdlog::get(LOGGER)->debug("Audio::play");
-  ma_result result;
   ma_device_config deviceConfig;
 
-  result = ma_decoder_init_file(source_path_.c_str(), NULL, &decoder_);
-  if (result != MA_SUCCESS) {
+  // Play already decoded audio (shared with analysis).
+  try {
+    LoadPcm();
+  } catch (const char* e) {
     spdlog::get(LOGGER)->debug("Audio::play: Failed to load audio");
-    return;
+    return false;
   }
+  // Start filling ring buffer, while device is set up.
+  stream_ = std::make_unique<PlaybackStream>(pcm_);
+  stream_->Start();
 
   deviceConfig = ma_device_config_init(ma_device_type_playback);
-  deviceConfig.playback.format   = decoder_.outputFormat;
-  deviceConfig.playback.channels = decoder_.outputChannels;
-  deviceConfig.sampleRate        = decoder_.outputSampleRate;
+  deviceConfig.playback.format   = ma_format_f32;
+  deviceConfig.playback.channels = stream_->channels();
+  deviceConfig.sampleRate        = stream_->samplerate();
   deviceConfig.dataCallback      = data_callback;
-  deviceConfig.pUserData         = &decoder_;
+  deviceConfig.pUserData         = this;
 
   if (ma_device_init(NULL, &deviceConfig, &device_) != MA_SUCCESS) {
     spdlog::get(LOGGER)->debug("Audio::play: Failed to open playback device.");
-    ma_decoder_uninit(&decoder_);
-    return;
+    return false;
   }
+  // Frames rendered, but still buffered by device (converted to samplerate of stream).
+  size_t latency = static_cast<size_t>(device_.playback.internalPeriodSizeInFrames)*device_.playback.internalPeriods;
+  if (device_.playback.internalSampleRate > 0)
+    latency = latency*stream_->samplerate()/device_.playback.internalSampleRate;
+  stream_->set_latency(latency);
+  spdlog::get(LOGGER)->info("Audio::play: device latency {} frames", latency);
 
   if (ma_device_start(&device_) != MA_SUCCESS) {
     spdlog::get(LOGGER)->debug("Audio::play: Failed to start playback device.");
     ma_device_uninit(&device_);
-    ma_decoder_uninit(&decoder_);
-    return;
+    return false;
   }
-  return;
+  return true;
 }
 
 void Audio::Pause() {
-  pause_audio = true;
+  if (stream_)
+    stream_->Pause();
 }
 
 void Audio::Unpause() {
-  pause_audio = false;
+  if (stream_)
+    stream_->Unpause();
 }
 
 void Audio::Stop() {
   ma_device_uninit(&device_);
-  ma_decoder_uninit(&decoder_);
+  if (stream_) {
+    stream_->Stop();
+    spdlog::get(LOGGER)->info("Audio::Stop: played {} frames, {} underruns, {} overruns", 
+        stream_->played_frames(), stream_->underruns(), stream_->overruns());
+  }
 }
 
 void Audio::data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount) {
-  ma_decoder* pDecoder = (ma_decoder*)pDevice->pUserData;
-  if (pDecoder == NULL)
+  Audio* audio = (Audio*)pDevice->pUserData;
+  if (audio == NULL || !audio->stream_)
     return;
-  if (!pause_audio) {
-    ma_decoder_read_pcm_frames(pDecoder, pOutput, frameCount);
-    (void)pInput;
-  }
+  // Wait-free copy from ring buffer (pausing fades out at ring head).
+  audio->stream_->Render((float*)pOutput, frameCount);
+  (void)pInput;
 }
 
 Note Audio::ConvertMidiToNote(int midi_note) {
-  Note note = Note();
-  note.midi_note_ = midi_note;
-  note.note_ = (midi_note-24)%12;
-  note.note_name_ = note_names_[note.note_];
-  note.ocatve_ = (midi_note-12)/12;
-  return note;
+  return Note::FromMidi(midi_note);
+}
+
+std::string Audio::AnalysisVersion(AnalysisBackend backend, AnalysisProfile profile) {
+  return "v" + std::to_string(ANALYSIS_VERSION) + "." + std::to_string(ANALYSIS_FILE_VERSION) + "-" 
+    + std::to_string(ANALYSIS_WIN_SIZE) + "-" + std::to_string(ANALYSIS_HOP_SIZE) + "-" + ProfileName(profile)
+    + ((backend == BACKEND_FUSED) ? "-fused" : "");
+}
+
+std::string Audio::ProfileName(AnalysisProfile profile) {
+  if (profile == PROFILE_FAST)
+    return "fast";
+  if (profile == PROFILE_ACCURATE)
+    return "accurate";
+  return "default";
+}
+
+unsigned int Audio::ProfileSamplerate(AnalysisProfile profile) {
+  if (profile == PROFILE_FAST)
+    return 11025;
+  if (profile == PROFILE_DEFAULT)
+    return 22050;
+  return 0;
 }
 
 void Audio::Initialize() {
   spdlog::get(LOGGER)->debug("Audio::CreateKeys");
-  std::map<std::string, std::vector<std::string>> keys;
-  for (size_t i=0; i<note_names_.size(); i++) {
+  for (size_t i=0; i<12; i++) {
+    key_masks_[i][0] = 0;
+    key_masks_[i][1] = 0;
     // Construct minor keys:
-    std::vector<std::string> notes_minor;
     for (const auto& step : {0, 2, 4, 5, 7, 9, 11})
-      notes_minor.push_back(note_names_[(i+step)%12]);
-    keys[note_names_[i] + "Minor"] = notes_minor;
+      key_masks_[i][0] |= 1 << (i+step)%12;
     // Construct major keys:
-    std::vector<std::string> notes_major;
     for (const auto& step : {0, 2, 3, 5, 7, 8, 10})
-      notes_major.push_back(note_names_[(i+step)%12]);
-    keys[note_names_[i] + "Major"] = notes_major;
+      key_masks_[i][1] |= 1 << (i+step)%12;
   }
-  keys_ = keys;
 }
 
-void Audio::CreateLevels(int intervals) {
-  spdlog::get(LOGGER)->debug("Audio::CreateLevels");
-  // 1. Sort notes by frequency:
-  std::map<std::string, int> notes_by_frequency;
-  long unsigned int counter = 0;
-  size_t cur_interval = 0;
+uint16_t Audio::KeyMask(size_t key_note, bool major) {
+  return key_masks_[key_note%12][major];
+}
+
+Interval Audio::CalcLevel(size_t interval, const std::vector<AudioDataTimePoint>& beats) {
+  spdlog::get(LOGGER)->debug("Audio::CalcLevel");
+  // 1. Weight pitch classes by chroma (each note counts as full chroma, if
+  // beat has no chroma):
+  std::array<size_t, 12> notes_by_frequency = {};
+  uint16_t present = 0;
   size_t darkness = 0;
   size_t total = 0;
-  for (auto& it : analysed_data_.data_per_beat_) {
+  for (const auto& it : beats) {
+    bool has_chroma = std::any_of(it.chroma_.begin(), it.chroma_.end(), [](uint8_t c) { return c > 0; });
     for (const auto& note : it.notes_) {
-      notes_by_frequency[note.note_name_]++;
+      if (!has_chroma) {
+        notes_by_frequency[note.note_] += 255;
+        present |= 1 << note.note_;
+      }
       darkness += note.ocatve_*note.ocatve_;
       total+=note.ocatve_;
     }
-    // If next intervals was reached, calc key and increase current level.
-    if (++counter > analysed_data_.data_per_beat_.size()/intervals*(cur_interval+1)) {
-      it.interval_ = cur_interval;
-      darkness /= total;
-      CalcLevel(cur_interval++, notes_by_frequency, darkness);
-      notes_by_frequency.clear();
-      darkness = 0;
-      total = 0;
+    for (size_t i=0; i<12 && has_chroma; i++) {
+      notes_by_frequency[i] += it.chroma_[i];
+      if (it.chroma_[i] >= 128)
+        present |= 1 << i;
     }
   }
-}
+  if (total > 0)
+    darkness /= total;
 
-void Audio::CalcLevel(size_t interval, std::map<std::string, int> notes_by_frequency, size_t darkness) {
-  spdlog::get(LOGGER)->debug("Audio::CalcLevel");
-  std::list<std::pair<int, std::string>> sorted_notes_by_frequency;
-  // Transfor to ordered list
-  for (const auto& it : notes_by_frequency)
-    sorted_notes_by_frequency.push_back({it.second, it.first});
-  sorted_notes_by_frequency.sort();
-  sorted_notes_by_frequency.reverse();
-
-  // Get note with highest frequency.
-  std::string key = sorted_notes_by_frequency.front().second; 
-  auto it = std::find(note_names_.begin(), note_names_.end(), key);
-  size_t key_note = it - note_names_.begin();
+  // Get note with highest frequency (C if interval contains no notes). Ties
+  // are broken by descending note name.
+  size_t key_note = 0;
+  bool first = true;
+  for (size_t i=0; i<12; i++) {
+    if (notes_by_frequency[i] == 0)
+      continue;
+    if (first || notes_by_frequency[i] > notes_by_frequency[key_note] 
+        || (notes_by_frequency[i] == notes_by_frequency[key_note] && Note::names()[i] > Note::names()[key_note]))
+      key_note = i;
+    first = false;
+  }
 
   // Check minor/ major
   size_t notes_in_minor = 0;
   size_t notes_in_major = 0;
-  std::vector<std::string> notes = keys_.at(key + "Major");
-  for (const auto& it : sorted_notes_by_frequency)
-    if (std::find(notes.begin(), notes.end(), it.second) != notes.end())
-      notes_in_major += it.first;
-  notes = keys_.at(key + "Minor");
-  for (const auto& it : sorted_notes_by_frequency)
-    if (std::find(notes.begin(), notes.end(), it.second) != notes.end())
-      notes_in_minor += it.first;
-  key += (notes_in_minor > notes_in_major) ? "Minor" : "Major";
-
-  // Calculate number of notes inside and outside of key.
-  size_t notes_in_key = 0;
-  notes = keys_.at(key);
-  for (const auto& it : sorted_notes_by_frequency)
-     if (std::find(notes.begin(), notes.end(), it.second) != notes.end())
-      notes_in_key++;
-
-  // Add new interval information.
-  analysed_data_.intervals_[interval] = Interval({interval, key, key_note, 
-      Signitue::UNSIGNED, key.find("Major") != std::string::npos, notes_in_key, 
-      sorted_notes_by_frequency.size()-notes_in_key, darkness}
-    );
-  spdlog::get(LOGGER)->debug("Created level with darkness: {}, now: {}", darkness, 
-      analysed_data_.intervals_[interval].darkness_);
+  for (size_t i=0; i<12; i++) {
+    if (KeyMask(key_note, true) & (1 << i))
+      notes_in_major += notes_by_frequency[i];
+    if (KeyMask(key_note, false) & (1 << i))
+      notes_in_minor += notes_by_frequency[i];
+  }
+  bool major = notes_in_minor <= notes_in_major;
+  std::string key = Note::names()[key_note] + ((major) ? "Major" : "Minor");
+
+  // Calculate number of (distinct) notes inside and outside of key.
+  uint16_t key_mask = KeyMask(key_note, major);
+  size_t notes_in_key = __builtin_popcount(present & key_mask);
+  size_t notes_out_key = __builtin_popcount(present & ~key_mask);
+
+  // Create new interval information.
+  Interval new_interval = Interval({interval, key, key_note, Signitue::UNSIGNED, major, notes_in_key, 
+      notes_out_key, darkness, key_mask});
+  spdlog::get(LOGGER)->debug("Created level with darkness: {}", darkness);
   if (key.find("#") != std::string::npos)
-    analysed_data_.intervals_[interval].signature_ = Signitue::SHARP;
+    new_interval.signature_ = Signitue::SHARP;
   else if (key.find("b") != std::string::npos)
-    analysed_data_.intervals_[interval].signature_ = Signitue::FLAT;
+    new_interval.signature_ = Signitue::FLAT;
+  return new_interval;
 }
 
 bool Audio::MoreOffNotes(const AudioDataTimePoint &data_at_beat, bool off) const {
-  spdlog::get(LOGGER)->debug("Audio::MoreOffNotes");
-  if (analysed_data_.intervals_.count(data_at_beat.interval_) == 0) {
+  auto timeline = timelines_.Get();
+  if (static_cast<size_t>(data_at_beat.interval_) < timeline->first_interval() 
+      || static_cast<size_t>(data_at_beat.interval_) >= timeline->num_intervals()) {
     spdlog::get(LOGGER)->error("Audio::MoreOffNotes: interval not in intervals! {}", data_at_beat.interval_);
     return false;
   }
-  std::string cur_key = analysed_data_.intervals_.at(data_at_beat.interval_).key_;
-  if (keys_.count(cur_key) == 0) {
-    spdlog::get(LOGGER)->error("Audio::MoreOffNotes: key not in keys! {}", cur_key);
-    return false;
-  }
-  auto notes_in_cur_key = keys_.at(cur_key);
-  size_t off_notes_counter = 0;
-  for (const auto& note : data_at_beat.notes_) {
-    if (off) {
-      if (std::find(notes_in_cur_key.begin(), notes_in_cur_key.end(), note.note_name_) == notes_in_cur_key.end())
-        off_notes_counter++;
-    }
-    else {
-      if (std::find(notes_in_cur_key.begin(), notes_in_cur_key.end(), note.note_name_) != notes_in_cur_key.end())
-        off_notes_counter++;
-    }
-  }
-  spdlog::get(LOGGER)->info("Audio::MoreOffNotes: done");
-  return off_notes_counter == data_at_beat.notes_.size() && off_notes_counter > 0;
+  uint16_t key_mask = timeline->interval(data_at_beat.interval_).key_mask_;
+  uint16_t note_mask = Note::Mask(data_at_beat.notes_);
+  return note_mask != 0 && (note_mask & ((off) ? key_mask : ~key_mask)) == 0;
+}
+
+bool Audio::MoreOffNotes(size_t beat, bool off) const {
+  return timelines_.Get()->MoreOffNotes(beat, off);
 }
 
 size_t Audio::NextOfNotesIn(double cur_time) const {
-  spdlog::get(LOGGER)->debug("Audio::NextOfNotesIn");
-  size_t counter = 1;
-  for (const auto& it : analysed_data_.data_per_beat_) {
-    if (it.time_ <= cur_time) 
-      continue;
-    if (MoreOffNotes(it))
-      break;
-    counter++;
-  }
-  spdlog::get(LOGGER)->info("Audio::NextOfNotesIn: done");
-  return counter;
+  auto timeline = timelines_.Get();
+  size_t next_beat = timeline->Seek(cur_time);
+  return timeline->NextOffNotes(next_beat) - next_beat + 1;
 }
 
-std::string Audio::GetOutPath(std::filesystem::path source_path) {
+std::string Audio::GetOutPath(std::string source_path) {
+  std::string key = store_->GetKey(source_path, AnalysisVersion(backend_, profile_));
+  if (key == "")
+    return "";
+  std::string out_path = store_->GetPath(key);
+  spdlog::get(LOGGER)->info("Audio::GetOutPath: got out_path: {}", out_path);
+  return out_path;
+}
+
+std::string Audio::GetLeadPath(std::string source_path, size_t lead_intervals) {
+  std::string key = store_->GetKey(source_path, AnalysisVersion(backend_, profile_) + "-lead" 
+      + std::to_string(lead_intervals));
+  return (key == "") ? "" : store_->GetPath(key);
+}
+
+std::string Audio::GetLegacyOutPath(std::filesystem::path source_path) {
   source_path.replace_extension(".json");
   std::hash<std::string> hasher;
   size_t hash = hasher(source_path);
-  std::string out_path = base_path_ + "/data/analysis/" + std::to_string(hash) + source_path.filename().string();
-  spdlog::get(LOGGER)->info("Audio::GetOutPath: got out_path: {}", out_path);
-  return out_path;
+  return base_path_ + "/data/analysis/" + std::to_string(hash) + source_path.filename().string();
 }
 
 std::map<unsigned short, std::vector<Note>> Audio::GetNotesInSimilarOctave(std::vector<Note> notes) {
@@ -6,99 +6,553 @@
 #include <aubio/notes/notes.h>
 #include <aubio/pitch/pitch.h>
 #include <aubio/tempo/tempo.h>
+#include <atomic>
 #include <cstddef>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
-#define MINIAUDIO_IMPLEMENTATION
-#include "miniaudio.h"
-
-struct Note {
-  size_t midi_note_;
-  std::string note_name_;
-  size_t note_;
-  size_t ocatve_;
-};
+#include "audio/analysis_file.h"
+#include "audio/analysis_store.h"
+#include "audio/audio_data.h"
+#include "audio/beat_timeline.h"
+#include "audio/decimator.h"
+#include "audio/feature_extractor.h"
+#include "audio/level_meter.h"
+#include "audio/pcm_buffer.h"
+#include "audio/pcm_stream.h"
+#include "audio/playback_stream.h"
+#include "audio/versioned_timeline.h"
 
-struct AudioDataTimePoint {
-  double time_;
-  int bpm_;
-  int level_;
-  std::vector<Note> notes_;
-  int interval_;
-};
+#define ANALYSIS_VERSION 2  ///< increase whenever the analysis algorithm changes.
+#define ANALYSIS_WIN_SIZE 1024  ///< at native samplerate (scaled down with samplerate, see AnalysisProfile).
+#define ANALYSIS_HOP_SIZE 256  ///< at native samplerate (scaled down with samplerate, see AnalysisProfile).
+#define ANALYSIS_INTERVALS 8  ///< number of intervals (each with it's own key) per song.
+#define ANALYSIS_SEGMENT_MIN_LENGTH 120000  ///< min length (ms) of segments analysed in parallel.
+#define ANALYSIS_SEGMENT_OVERLAP 10000  ///< overlap (ms) analysed on both sides of segment.
+#define ANALYSIS_BPM_OCTAVE_TOLERANCE 0.08  ///< relative tolerance to detect bpm doubling/halving.
+#define ANALYSIS_STREAM_INTERVAL 30000  ///< length (ms) of intervals, if duration is unknown (streams).
+#define ANALYSIS_COARSE_PROFILE PROFILE_FAST  ///< profile of coarse pass (see `StartAnalysis`).
+#define ANALYSIS_COARSE_HOP_FACTOR 2  ///< hop size of coarse pass (relative to ANALYSIS_HOP_SIZE).
 
-struct Interval {
-  size_t id_;
-  std::string key_;
-  size_t key_note_;
-  size_t signature_;  ///< 0=unsigned, 1=sharp, 2=flat
-  bool major_;  ///< 0=unsigned, 1=sharp, 2=flat
-  size_t notes_in_key_;
-  size_t notes_out_key_;
-  size_t darkness_;
+enum AnalysisBackend {
+  BACKEND_AUBIO = 0,  ///< aubio's tempo- and notes-detection.
+  BACKEND_FUSED = 1,  ///< in-house single-fft feature extraction (see FeatureExtractor).
 };
 
-struct AudioData {
-  std::list<AudioDataTimePoint> data_per_beat_;
-  float average_bpm_;
-  float average_level_;
-  std::string key_;
-  std::map<int, Interval> intervals_;
-  int max_peak_;
-};
+#define MINIAUDIO_IMPLEMENTATION
+#include "miniaudio.h"
 
 class Audio {
   public:
-    Audio(std::string base_path);
+    /**
+     * Constructor.
+     * @param[in] base_path path to dissonance files.
+     * @param[in] store analysis store to share with other audio objects (if
+     * not set, a new store is created).
+     */
+    Audio(std::string base_path, std::shared_ptr<AnalysisStore> store=nullptr);
+
+    /**
+     * Destructor stopping running analysis.
+     */
+    ~Audio();
     
     // getter
-    AudioData& analysed_data();
-    static std::map<std::string, std::vector<std::string>> keys();
+    /**
+     * Gets analysed data (immutable, shared by all readers). Published once
+     * analysis is finished (see `WaitForAnalysis`), empty before. Use
+     * `timeline()` while analysis is running.
+     */
+    std::shared_ptr<const AudioData> analysed_data() const;
+
+    /**
+     * Gets audio data of the lead (immutable, shared by all readers),
+     * available when `StartAnalysis` returns. Once a queued song is spliced
+     * on, gets the complete data of that song (averages and peak of the song
+     * playing).
+     */
+    std::shared_ptr<const AudioData> lead_data() const;
+
+    /**
+     * Gets snapshot of current timeline (all beats published so far).
+     */
+    std::shared_ptr<const BeatTimeline> timeline() const;
+
+    /**
+     * Gets versioned current timeline, swapped whenever a new analysis is
+     * started or a refined analysis replaces the coarse one.
+     */
+    const VersionedTimeline& timelines() const;
+
+    /**
+     * Gets number of playback underruns (device callback not served completely).
+     */
+    size_t underruns() const;
+
+    /**
+     * Gets number of playback overruns (device period larger than ring buffer).
+     */
+    size_t overruns() const;
+
+    /**
+     * Checks whether a song is queued (see `QueueNext`), but not spliced on yet.
+     */
+    bool next_queued() const;
+
+    /**
+     * Gets time (ms, from start of playback) current song started at.
+     */
+    double song_start() const;
+
+    /**
+     * Gets playback position derived from the frames consumed by the device,
+     * compensated for device latency (see PlaybackStream::position).
+     * Monotonic, stops while paused.
+     * @return position in milliseconds (0 if not playing).
+     */
+    double position() const;
+
+    /**
+     * Gets number of segments the last complete analysis was split into
+     * (1: sequential analysis, 0: no analysis run).
+     */
+    size_t num_segments() const;
 
     
     // setter 
     void set_source_path(std::string source_path);
+
+    /**
+     * Sets number of threads to analyse a single song with. Songs longer than
+     * twice the min. segment length are split into overlapping segments
+     * analysed in parallel (see `StitchSegment`).
+     * @param[in] analysis_threads (1: sequential analysis)
+     */
+    void set_analysis_threads(unsigned int analysis_threads);
+
+    /**
+     * Sets min. length of segments analysed in parallel (see
+     * `set_analysis_threads`).
+     * @param[in] segment_min_length in milliseconds (default: ANALYSIS_SEGMENT_MIN_LENGTH).
+     */
+    void set_segment_min_length(double segment_min_length);
+
+    /**
+     * Sets whether decoded audio is kept on disc (next to the analysis), so
+     * replays start without decoding (see PcmBuffer).
+     * @param[in] pcm_cache
+     */
+    void set_pcm_cache(bool pcm_cache);
+
+    /**
+     * Sets backend used for analysis. Analyses of different backends are cached
+     * separately (see `AnalysisVersion`).
+     * @param[in] backend
+     */
+    void set_analysis_backend(AnalysisBackend backend);
+
+    /**
+     * Sets analysis profile. Audio is downsampled to the samplerate of the
+     * profile, window and hop size are scaled accordingly (same length in
+     * time). Analyses of different profiles are cached separately (see
+     * `AnalysisVersion`).
+     * @param[in] profile
+     */
+    void set_analysis_profile(AnalysisProfile profile);
     
     // methods:
+    /**
+     * Checks whether analysis of current source-path already exists on disc.
+     * @return whether analysis of current source-path is cached.
+     */
+    bool IsCached();
+
+    /**
+     * Loads or analyses current source and waits until analysis is finished
+     * (no coarse pass, as only the complete analysis is used).
+     */
     void Analyze();
-    void play();
-    
+
+    /**
+     * Loads or starts analysis of current source. Analysis runs in background
+     * publishing beats to the timeline interval by interval. Returns once the
+     * lead (the given number of intervals) is available.
+     * If progressive, uncached songs are first analysed in a coarse pass
+     * (ANALYSIS_COARSE_PROFILE, hop enlarged by ANALYSIS_COARSE_HOP_FACTOR),
+     * so the whole timeline is available quickly. Once the analysis of the
+     * selected profile is complete, it's timeline is swapped in (see
+     * `timelines()`), consumers continuing with the first refined beat not
+     * yet played. The lead is taken from the coarse pass, so the game starts
+     * quickly. It is stored next to the analysis and loaded on later plays,
+     * so the lead (and the map built from it) does not depend on whether the
+     * song was cached. Songs analysed without coarse pass (f.e. by the library
+     * analysis) take the lead from the complete analysis on every play.
+     * @param[in] lead_intervals number of intervals to wait for (min. 1).
+     * @param[in] progressive
+     */
+    void StartAnalysis(size_t lead_intervals=1, bool progressive=true);
+
+    /**
+     * Starts analysis of raw pcm stream (see `AnalyzeStream`) in background.
+     * Returns once the lead (the given number of intervals) is available.
+     * Throws if stream cannot be opened.
+     * @param[in] stream_path path of FIFO or file, "-" for stdin.
+     * @param[in] format
+     * @param[in] lead_intervals number of intervals to wait for (min. 1).
+     */
+    void StartStreamAnalysis(std::string stream_path, PcmStreamFormat format, size_t lead_intervals=1);
+
+    /**
+     * Analyses raw pcm stream until writer closes it, feeding the detectors
+     * hop by hop (no audio is kept). Beats are published to the timeline in
+     * intervals of ANALYSIS_STREAM_INTERVAL. The last interval the timeline
+     * can hold is published as soon as it is complete, all further beats are
+     * published immediately (in this interval), so arbitrarily long streams
+     * can be analysed. Stream analyses are not cached.
+     * Throws if stream cannot be opened.
+     * @param[in] stream_path path of FIFO or file, "-" for stdin.
+     * @param[in] format
+     * @param[in] on_publish called for each beat, once published.
+     */
+    void AnalyzeStream(std::string stream_path, PcmStreamFormat format, 
+        std::function<void(const AudioDataTimePoint&)> on_publish=nullptr);
+
+    /**
+     * Queues song to play after the current song. The song is decoded (in the
+     * format of the current song, so it can be crossfaded) and loaded or
+     * analysed completely in background (see `SpliceNext`). Replaces a song
+     * queued before, once it's analysis is finished.
+     * @param[in] source_path
+     */
+    void QueueNext(std::string source_path);
+
+    /**
+     * Splices queued song on to current song, once both are analysed and
+     * playback has switched to the song spliced on before: the queued song is
+     * crossfaded into at the end of playback (PLAYBACK_CROSSFADE) and a
+     * timeline with the beats of the current song up to the crossfade and all
+     * beats of the queued song (shifted to it's start) is swapped in.
+     * The queued song becomes the current song (see `lead_data()`). Never
+     * blocks, so it may be called from the render thread.
+     * @return false if no song is queued, analysis is not finished yet or
+     * playback has not switched to the song spliced on before.
+     */
+    bool SpliceNext();
+
+    /**
+     * Blocks until running analysis is finished.
+     */
+    void WaitForAnalysis();
+
+    /**
+     * Starts playback of current source.
+     * @return false if audio could not be loaded or device could not be started.
+     */
+    bool play();
+
+    /**
+     * Fades out playback and pauses.
+     */
     void Pause();
+
+    /**
+     * Fades in playback where paused.
+     */
     void Unpause();
     void Stop();
 
+    /**
+     * Checks whether all notes of beat are off-key (or in key) of beat's interval.
+     * @param[in] data_at_beat
+     * @param[in] off if false, checks whether all notes are in key.
+     * @return true if beat has notes and all are off-key (in key).
+     */
     bool MoreOffNotes(const AudioDataTimePoint& data_at_beat, bool off=true) const;
+
+    /**
+     * Checks whether all notes of published beat are off-key (or in key),
+     * using status precomputed when the beat was published.
+     * @param[in] beat index of beat in timeline.
+     * @param[in] off if false, checks whether all notes are in key.
+     * @return true if beat has notes and all are off-key (in key).
+     */
+    bool MoreOffNotes(size_t beat, bool off=true) const;
+
+    /**
+     * Gets number of beats until next beat with only off-key notes.
+     * @param[in] cur_time current playback time in milliseconds.
+     * @return number of beats (incl. off-note beat) or number of remaining
+     * beats + 1, if there is no further off-note beat (yet).
+     */
     size_t NextOfNotesIn(double cur_time) const;
 
     static std::vector<unsigned short> GetInterval(std::vector<Note> notes);
 
+    /**
+     * Appends beats of a segment to beats of all preceding segments. Only
+     * beats inside [start, end) are taken, beats in the overlap serve as
+     * warm-up for the beat tracker. A first beat closer than half a beat to
+     * the last beat of the preceding segment is a duplicate and dropped.
+     * Bpm doubled or halved (compared to preceding segment) within the first
+     * overlap is reconciled to the bpm of the preceding segment.
+     * @param[in, out] beats beats of preceding segments.
+     * @param[in] segment beats of segment (incl. overlap).
+     * @param[in] start start of segment (ms).
+     * @param[in] end end of segment (ms).
+     */
+    static void StitchSegment(std::vector<AudioDataTimePoint>& beats, 
+        const std::vector<AudioDataTimePoint>& segment, double start, double end);
+
+    /**
+     * Initializes pitch-class masks of all keys.
+     */
     static void Initialize();
 
+    /**
+     * Gets pitch-class mask of key.
+     * @param[in] key_note pitch class of key note.
+     * @param[in] major
+     * @return pitch-class mask (bit i set: pitch class i in key).
+     */
+    static uint16_t KeyMask(size_t key_note, bool major);
+
+    /**
+     * Gets analysis version, changing whenever the algorithm or it's parameters
+     * change.
+     * @param[in] backend
+     * @param[in] profile
+     * @return analysis version.
+     */
+    static std::string AnalysisVersion(AnalysisBackend backend=BACKEND_AUBIO, 
+        AnalysisProfile profile=PROFILE_DEFAULT);
+
+    /**
+     * Gets name of analysis profile.
+     * @param[in] profile
+     * @return "fast", "default" or "accurate".
+     */
+    static std::string ProfileName(AnalysisProfile profile);
+
+    /**
+     * Gets samplerate audio is downsampled to with given profile.
+     * @param[in] profile
+     * @return samplerate (0: native samplerate).
+     */
+    static unsigned int ProfileSamplerate(AnalysisProfile profile);
+
+    /**
+     * Calculates key and darkness of an interval. Pitch classes are weighted
+     * by the chroma of each beat (if analysed, see FeatureExtractor),
+     * otherwise each note counts as full chroma.
+     * @param[in] interval id of interval.
+     * @param[in] beats all beats in interval.
+     * @return interval information.
+     */
+    static Interval CalcLevel(size_t interval, const std::vector<AudioDataTimePoint>& beats);
+
+    /**
+     * Loads analysis from binary analysis file (see AnalysisFile). The file is
+     * mapped, but the columns are copied into the returned beat data.
+     * @param[in] path
+     * @return analysed data.
+     */
+    static AudioData Load(std::string path);
+
+    /**
+     * Loads analysis from json (import).
+     * @param[in] path
+     * @return analysed data.
+     */
+    static AudioData LoadJson(std::string path);
+
+    /**
+     * Loads lead stored by `StartAnalysis` (binary analysis file of the lead
+     * intervals only), computing intervals and max peak of the lead.
+     * @param[in] path
+     * @param[in] lead_intervals number of intervals of lead.
+     * @return lead data.
+     */
+    static AudioData LoadLead(std::string path, size_t lead_intervals);
+
+    /**
+     * Safes analysis as json (export).
+     * @param[in] analysed_data
+     * @param[in] path
+     */
+    static void SafeJson(const AudioData& analysed_data, std::string path);
+
 
   private:
     // members:
     std::string source_path_;
     const std::string base_path_;
-    AudioData analysed_data_;
+    std::shared_ptr<AnalysisStore> store_;
+    AudioData analysed_data_;  ///< built by running analysis (not shared before publication).
+    std::shared_ptr<const AudioData> published_data_;  ///< analysed data once analysis is finished.
+    mutable std::mutex data_mutex_;  ///< locks published data, lead data and current song while splicing.
+    std::shared_ptr<const AudioData> lead_data_;  ///< lead or complete data of song spliced on last.
+    std::shared_ptr<BeatTimeline> timeline_;  ///< published to by running analysis.
+    VersionedTimeline timelines_;  ///< current timeline (coarse or refined) read by consumers.
+    std::thread analysis_thread_;
+    std::atomic<bool> stop_analysis_;
+    std::atomic<bool> analysing_;  ///< analysis thread is running.
+    unsigned int analysis_threads_;
+    double segment_min_length_;  ///< min. length (ms) of segments analysed in parallel.
+    std::atomic<size_t> num_segments_;  ///< segments of last complete analysis.
+    bool pcm_cache_;
+    AnalysisBackend backend_;
+    AnalysisProfile profile_;
+    std::shared_ptr<PcmBuffer> pcm_;  ///< decoded audio, shared by analysis and playback.
+    std::string pcm_source_path_;  ///< source of decoded audio.
+    unsigned int output_channels_;  ///< channels songs are decoded to (0: source's).
+    unsigned int output_samplerate_;  ///< samplerate songs are decoded to (0: source's).
+    std::unique_ptr<PlaybackStream> stream_;  ///< feeds decoded audio to device.
+    double song_start_;  ///< time (ms, from start of playback) current song started at.
+    size_t song_first_interval_;  ///< id of first interval of current song.
+    std::unique_ptr<Audio> next_;  ///< queued song (see `QueueNext`).
+    std::thread next_thread_;  ///< analyses queued song.
+    std::atomic<bool> next_queued_;
+    std::atomic<bool> next_ready_;  ///< queued song is analysed.
     ma_device device_;
-    ma_decoder decoder_;
-    static std::map<std::string, std::vector<std::string>> keys_;
-    static const std::vector<std::string> note_names_;
+    static uint16_t key_masks_[12][2];  ///< pitch-class mask per key note and minor(0)/major(1).
 
     // methods:
     static void data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount);
     static Note ConvertMidiToNote(int midi_note);
 
-    void CreateLevels(int intervals);
-    void CalcLevel(size_t quater, std::map<std::string, int> notes_by_frequency, size_t darkness);
+    void CalcMaxPeak();
+    static int GetIntervalForTime(double time, double duration);
+
+    /**
+     * Loads decoded audio of current source (from pcm cache or by starting to
+     * decode), unless already loaded. Throws if source cannot be decoded.
+     */
+    void LoadPcm();
+
+    /**
+     * Creates new (empty) timeline to publish to and swaps it in.
+     * @param[in] duration (expected) duration of audio in milliseconds.
+     * @param[in] paging if set, timeline pages beats to disc (streams, see
+     * BeatTimeline). Analyses of song files are kept in memory completely
+     * anyway, so their timelines are not paged.
+     */
+    void NewTimeline(double duration, bool paging=false);
+
+    /**
+     * Analyses decoded audio (runs as thread), publishing each interval to the
+     * given timeline once complete. If this is not the current timeline
+     * (progressive), a coarse pass publishing to the current timeline runs
+     * alongside and the given timeline is swapped in once complete.
+     * @param[in] pcm decoded audio (possibly still decoding).
+     * @param[in] out_path path to safe analysis at.
+     * @param[in] refined timeline to publish complete analysis to.
+     */
+    void AnalyzeFile(std::shared_ptr<PcmBuffer> pcm, std::string out_path, std::shared_ptr<BeatTimeline> refined);
+
+    /**
+     * Analyses decoded audio in a coarse pass, publishing each interval once
+     * complete and finishing the timeline. Beats are not kept, so it may run
+     * alongside the complete analysis.
+     * @param[in] pcm decoded audio (possibly still decoding).
+     * @param[in] timeline to publish to.
+     * @return false if tempo- or notes-object could not be created.
+     */
+    bool AnalyzeCoarse(const PcmBuffer& pcm, BeatTimeline& timeline);
+
+    /**
+     * Analyses part of decoded audio (downmixed to mono).
+     * @param[in] pcm decoded audio (possibly still decoding).
+     * @param[in] from time (ms) to start analysis at.
+     * @param[in] to time (ms) to stop analysis at (negative: end of audio).
+     * @param[in] on_beat called for each beat (with absolute time).
+     * @param[in] coarse if set, analyses with coarse profile and hop size.
+     * @return false if tempo- or notes-object could not be created.
+     */
+    bool AnalyzeSegment(const PcmBuffer& pcm, double from, double to, 
+        const std::function<void(const AudioDataTimePoint&)>& on_beat, bool coarse=false);
+
+    /**
+     * Feeds mono audio hop by hop into tempo- and notes-detection (of
+     * selected backend) and level meter, downsampled according to profile.
+     * @param[in] samplerate native samplerate.
+     * @param[in] from time (ms) of first hop.
+     * @param[in] to time (ms) to stop analysis at (negative: end of audio).
+     * @param[in] read_hop reads next frames (mono, native samplerate), returns
+     * number of frames read (less than requested only at end of audio).
+     * @param[in] on_beat called for each beat (with absolute time).
+     * @param[in] coarse if set, analyses with coarse profile and hop size.
+     * @return false if tempo- or notes-object could not be created.
+     */
+    bool AnalyzeHops(uint_t samplerate, double from, double to, 
+        const std::function<size_t(float*, size_t)>& read_hop,
+        const std::function<void(const AudioDataTimePoint&)>& on_beat, bool coarse=false);
+
+    /**
+     * Analyses opened stream, publishing beats (see `AnalyzeStream`).
+     * @param[in] stream
+     * @param[in] on_publish called for each beat, once published (may be empty).
+     */
+    void AnalyzePcmStream(PcmStream& stream, const std::function<void(const AudioDataTimePoint&)>& on_publish);
+
+    /**
+     * Splits decoded audio into overlapping segments, analysed in parallel.
+     * Segments are stitched in order, each beat handed to on_beat.
+     * @param[in] pcm decoded audio (possibly still decoding).
+     * @param[in] num_segments
+     * @param[in] on_beat called for each stitched beat.
+     */
+    void AnalyzeSegmented(const PcmBuffer& pcm, size_t num_segments, 
+        const std::function<void(const AudioDataTimePoint&)>& on_beat);
+    void StopAnalysis();
+
+    /**
+     * Publishes already analysed data (loaded from disc or analysed
+     * completely) to timeline.
+     * @param[in] timeline
+     */
+    void PublishAnalysedData(BeatTimeline& timeline);
+
+    /**
+     * Ends builder phase: moves analysed data into an immutable snapshot,
+     * shared by all readers (see `analysed_data()`).
+     * @return published snapshot.
+     */
+    std::shared_ptr<const AudioData> PublishData();
+
+    /**
+     * Replaces lead data (see `lead_data()`).
+     * @param[in] lead_data
+     */
+    void SetLeadData(std::shared_ptr<const AudioData> lead_data);
+    void PublishInterval(BeatTimeline& timeline, size_t interval, const std::vector<AudioDataTimePoint>& beats);
+
+    /**
+     * Publishes beats of complete analysis shifted in time and intervals.
+     * @param[in] timeline
+     * @param[in] audio_data
+     * @param[in] offset time (ms) added to each beat.
+     * @param[in] end time (ms, after shifting) of first beat not published.
+     * @param[in] first_interval id of first interval in timeline.
+     */
+    static void PublishShifted(BeatTimeline& timeline, const AudioData& audio_data, double offset, double end,
+        size_t first_interval);
+    void Safe(const AudioData& audio_data, std::string out_path);
+    std::string GetOutPath(std::string source_path);
+    std::string GetLegacyOutPath(std::filesystem::path source_path);
 
-    AudioData AnalyzeFile(std::string source_path);
-    AudioData Load(std::string source_path);
-    void Safe(AudioData audio_data, std::string source_path);
-    std::string GetOutPath(std::filesystem::path source_path);
+    /**
+     * Gets path of stored lead (see `StartAnalysis`) of given number of intervals.
+     * @param[in] source_path
+     * @param[in] lead_intervals
+     * @return path or empty string if source could not be read.
+     */
+    std::string GetLeadPath(std::string source_path, size_t lead_intervals);
 
     static std::map<unsigned short, std::vector<Note>> GetNotesInSimilarOctave(std::vector<Note> notes);
 
@@ -0,0 +1,159 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "audio/audio_data.h"
+
+const std::string& Note::note_name() const {
+  return names()[note_];
+}
+
+Note Note::FromMidi(int midi_note) {
+  Note note = Note();
+  note.midi_note_ = midi_note;
+  note.note_ = midi_note%12;
+  note.ocatve_ = (midi_note < 12) ? 0 : (midi_note-12)/12;
+  return note;
+}
+
+const std::vector<std::string>& Note::names() {
+  static const std::vector<std::string> names = {
+    "C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B"
+  };
+  return names;
+}
+
+uint16_t Note::Mask(const std::vector<Note>& notes) {
+  uint16_t mask = 0;
+  for (const auto& it : notes)
+    mask |= 1 << it.note_;
+  return mask;
+}
+
+BeatData::BeatData() : note_offsets_({0}) {}
+
+// getter
+size_t BeatData::size() const {
+  return times_.size();
+}
+
+bool BeatData::empty() const {
+  return times_.empty();
+}
+
+const std::vector<double>& BeatData::times() const {
+  return times_;
+}
+
+const std::vector<int32_t>& BeatData::bpms() const {
+  return bpms_;
+}
+
+const std::vector<int32_t>& BeatData::levels() const {
+  return levels_;
+}
+
+const std::vector<int32_t>& BeatData::intervals() const {
+  return intervals_;
+}
+
+const std::vector<uint32_t>& BeatData::note_offsets() const {
+  return note_offsets_;
+}
+
+const std::vector<uint8_t>& BeatData::note_pool() const {
+  return note_pool_;
+}
+
+const std::vector<Chroma>& BeatData::chromas() const {
+  return chromas_;
+}
+
+AudioDataTimePoint BeatData::at(size_t i) const {
+  std::vector<Note> notes;
+  notes.reserve(num_notes(i));
+  for (uint32_t j=note_offsets_[i]; j<note_offsets_[i+1]; j++)
+    notes.push_back(Note::FromMidi(note_pool_[j]));
+  return {times_[i], bpms_[i], levels_[i], notes, intervals_[i], chromas_[i]};
+}
+
+AudioDataTimePoint BeatData::front() const {
+  return at(0);
+}
+
+AudioDataTimePoint BeatData::back() const {
+  return at(size()-1);
+}
+
+BeatData::const_iterator BeatData::begin() const {
+  return const_iterator(this, 0);
+}
+
+BeatData::const_iterator BeatData::end() const {
+  return const_iterator(this, size());
+}
+
+size_t BeatData::num_notes(size_t i) const {
+  return note_offsets_[i+1]-note_offsets_[i];
+}
+
+// setter
+void BeatData::set_interval(size_t i, int interval) {
+  intervals_[i] = interval;
+}
+
+// methods
+void BeatData::push_back(const AudioDataTimePoint& beat) {
+  times_.push_back(beat.time_);
+  bpms_.push_back(beat.bpm_);
+  levels_.push_back(beat.level_);
+  intervals_.push_back(beat.interval_);
+  chromas_.push_back(beat.chroma_);
+  for (const auto& note : beat.notes_)
+    note_pool_.push_back(note.midi_note_);
+  note_offsets_.push_back(note_pool_.size());
+}
+
+void BeatData::Append(size_t num_beats, const double* times, const int32_t* bpms, const int32_t* levels,
+    const int32_t* intervals, const uint32_t* note_offsets, const uint8_t* note_pool, const uint8_t* chromas) {
+  times_.insert(times_.end(), times, times+num_beats);
+  bpms_.insert(bpms_.end(), bpms, bpms+num_beats);
+  levels_.insert(levels_.end(), levels, levels+num_beats);
+  intervals_.insert(intervals_.end(), intervals, intervals+num_beats);
+  uint32_t base = note_pool_.size();
+  for (size_t i=1; i<=num_beats; i++)
+    note_offsets_.push_back(base + note_offsets[i]-note_offsets[0]);
+  note_pool_.insert(note_pool_.end(), note_pool+note_offsets[0], note_pool+note_offsets[num_beats]);
+  size_t first = chromas_.size();
+  chromas_.resize(first+num_beats);
+  if (num_beats > 0)
+    std::memcpy(chromas_[first].data(), chromas, num_beats*sizeof(Chroma));
+}
+
+void BeatData::reserve(size_t num_beats, size_t num_notes) {
+  times_.reserve(num_beats);
+  bpms_.reserve(num_beats);
+  levels_.reserve(num_beats);
+  intervals_.reserve(num_beats);
+  note_offsets_.reserve(num_beats+1);
+  note_pool_.reserve(num_notes);
+  chromas_.reserve(num_beats);
+}
+
+void BeatData::clear() {
+  times_.clear();
+  bpms_.clear();
+  levels_.clear();
+  intervals_.clear();
+  note_offsets_ = {0};
+  note_pool_.clear();
+  chromas_.clear();
+}
+
+size_t BeatData::MemoryUsage() const {
+  return times_.capacity()*sizeof(double) + (bpms_.capacity() + levels_.capacity()
+      + intervals_.capacity())*sizeof(int32_t) + note_offsets_.capacity()*sizeof(uint32_t)
+    + note_pool_.capacity() + chromas_.capacity()*sizeof(Chroma);
+}
@@ -0,0 +1,198 @@
+#ifndef SRC_AUDIO_AUDIO_DATA_H_
+#define SRC_AUDIO_AUDIO_DATA_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+struct Note {
+  uint8_t midi_note_;
+  uint8_t note_;  ///< pitch class (0=C, 11=B)
+  uint8_t ocatve_;
+
+  /**
+   * Gets name of note (derived from pitch class).
+   * @return note name f.e. "C#"
+   */
+  const std::string& note_name() const;
+
+  /**
+   * Creates note from midi note.
+   * @param[in] midi_note
+   * @return note.
+   */
+  static Note FromMidi(int midi_note);
+
+  /**
+   * Gets names of all twelve pitch classes, starting at "C".
+   */
+  static const std::vector<std::string>& names();
+
+  /**
+   * Gets pitch classes of notes as 12-bit mask (bit i set: pitch class i present).
+   * @param[in] notes
+   * @return pitch-class mask.
+   */
+  static uint16_t Mask(const std::vector<Note>& notes);
+};
+
+/**
+ * Energy per pitch class (0=C, 11=B), normalized to 255 for the strongest
+ * pitch class. All zero if unknown (only the fused analysis backend computes
+ * chroma).
+ */
+typedef std::array<uint8_t, 12> Chroma;
+
+struct AudioDataTimePoint {
+  double time_;
+  int bpm_;
+  int level_;
+  std::vector<Note> notes_;
+  int interval_;
+  Chroma chroma_ = {};
+};
+
+struct Interval {
+  size_t id_;
+  std::string key_;
+  size_t key_note_;
+  size_t signature_;  ///< 0=unsigned, 1=sharp, 2=flat
+  bool major_;  ///< 0=unsigned, 1=sharp, 2=flat
+  size_t notes_in_key_;
+  size_t notes_out_key_;
+  size_t darkness_;
+  uint16_t key_mask_;  ///< pitch classes in key (bit i set: pitch class i in key)
+};
+
+/**
+ * Beats stored column-wise (structure of arrays). The notes of all beats are
+ * stored as midi notes in one pool, indexed CSR-style: notes of beat i are
+ * `note_pool()[note_offsets()[i]]` to `note_pool()[note_offsets()[i+1]]` (excl.).
+ * Columns use the same types as the binary analysis file (see AnalysisFile).
+ * Offers the list-like interface of the former `std::list<AudioDataTimePoint>`,
+ * beats are assembled on access (returned by value).
+ */
+class BeatData {
+  public:
+    class const_iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = AudioDataTimePoint;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = AudioDataTimePoint;
+
+        /** Holds assembled beat, so `it->time_` works as with a list. */
+        struct ArrowProxy {
+          AudioDataTimePoint beat_;
+          const AudioDataTimePoint* operator->() const { return &beat_; }
+        };
+
+        const_iterator(const BeatData* beats, size_t i) : beats_(beats), i_(i) {}
+        AudioDataTimePoint operator*() const { return beats_->at(i_); }
+        ArrowProxy operator->() const { return {beats_->at(i_)}; }
+        const_iterator& operator++() { i_++; return *this; }
+        const_iterator operator++(int) { const_iterator tmp = *this; i_++; return tmp; }
+        bool operator==(const const_iterator& other) const { return i_ == other.i_; }
+        bool operator!=(const const_iterator& other) const { return i_ != other.i_; }
+
+      private:
+        const BeatData* beats_;
+        size_t i_;
+    };
+
+    BeatData();
+
+    // getter
+    size_t size() const;
+    bool empty() const;
+    const std::vector<double>& times() const;
+    const std::vector<int32_t>& bpms() const;
+    const std::vector<int32_t>& levels() const;
+    const std::vector<int32_t>& intervals() const;
+    const std::vector<uint32_t>& note_offsets() const;
+    const std::vector<uint8_t>& note_pool() const;
+    const std::vector<Chroma>& chromas() const;
+
+    /**
+     * Gets beat at given index (notes are created from note pool).
+     * @param[in] i index, must be smaller than `size()`.
+     * @return beat.
+     */
+    AudioDataTimePoint at(size_t i) const;
+    AudioDataTimePoint front() const;
+    AudioDataTimePoint back() const;
+    const_iterator begin() const;
+    const_iterator end() const;
+
+    /**
+     * Gets number of notes of beat.
+     * @param[in] i index of beat.
+     */
+    size_t num_notes(size_t i) const;
+
+    // setter
+    void set_interval(size_t i, int interval);
+
+    // methods
+    void push_back(const AudioDataTimePoint& beat);
+
+    /**
+     * Appends beats from raw columns (f.e. a mapped analysis file).
+     * @param[in] num_beats
+     * @param[in] times
+     * @param[in] bpms
+     * @param[in] levels
+     * @param[in] intervals
+     * @param[in] note_offsets (num_beats+1 entries, relative to note_pool)
+     * @param[in] note_pool
+     * @param[in] chromas (12 entries per beat)
+     */
+    void Append(size_t num_beats, const double* times, const int32_t* bpms, const int32_t* levels,
+        const int32_t* intervals, const uint32_t* note_offsets, const uint8_t* note_pool, const uint8_t* chromas);
+    void reserve(size_t num_beats, size_t num_notes=0);
+    void clear();
+
+    /**
+     * Gets memory used by all columns (incl. reserved capacity).
+     * @return memory usage in bytes.
+     */
+    size_t MemoryUsage() const;
+
+  private:
+    std::vector<double> times_;
+    std::vector<int32_t> bpms_;
+    std::vector<int32_t> levels_;
+    std::vector<int32_t> intervals_;
+    std::vector<uint32_t> note_offsets_;  ///< always one more entry than beats.
+    std::vector<uint8_t> note_pool_;
+    std::vector<Chroma> chromas_;
+};
+
+/**
+ * Trade-off between analysis speed and accuracy. Faster profiles analyse
+ * audio downsampled to a lower samplerate (see Decimator).
+ */
+enum AnalysisProfile {
+  PROFILE_FAST = 0,  ///< 11.025 kHz
+  PROFILE_DEFAULT = 1,  ///< 22.05 kHz
+  PROFILE_ACCURATE = 2,  ///< native samplerate
+};
+
+struct AudioData {
+  BeatData data_per_beat_;
+  float average_bpm_;
+  float average_level_;
+  std::string key_;
+  std::map<int, Interval> intervals_;
+  int max_peak_;
+  double duration_;  ///< duration of audio in milliseconds.
+  AnalysisProfile profile_ = PROFILE_DEFAULT;
+  unsigned int samplerate_ = 0;  ///< samplerate audio was analysed at.
+};
+
+#endif
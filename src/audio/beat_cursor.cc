@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "audio/beat_cursor.h"
+#include "utils/utils.h"
+
+BeatCursor::BeatCursor(const VersionedTimeline& timelines) : timelines_(timelines), 
+  start_time_(std::chrono::steady_clock::now()), pause_start_time_(start_time_), offset_(0), paused_(false) {}
+
+// getter
+std::shared_ptr<const BeatTimeline> BeatCursor::timeline() const {
+  return timelines_.Get();
+}
+
+double BeatCursor::elapsed() const {
+  std::unique_lock ul(mutex_);
+  if (clock_)
+    return clock_() - offset_;
+  auto end = (paused_) ? pause_start_time_ : std::chrono::steady_clock::now();
+  return utils::GetElapsed(start_time_, end) - offset_;
+}
+
+size_t BeatCursor::position() const {
+  return position(*timelines_.Get());
+}
+
+size_t BeatCursor::position(const BeatTimeline& timeline) const {
+  return timeline.Seek(elapsed());
+}
+
+bool BeatCursor::finished() const {
+  auto timeline = timelines_.Get();
+  return timeline->finished() && position(*timeline) >= timeline->size();
+}
+
+// setter
+void BeatCursor::set_clock(std::function<double()> clock) {
+  std::unique_lock ul(mutex_);
+  clock_ = clock;
+}
+
+// methods
+void BeatCursor::Start(double time) {
+  std::unique_lock ul(mutex_);
+  start_time_ = std::chrono::steady_clock::now();
+  offset_ = -time;
+  paused_ = false;
+}
+
+void BeatCursor::Pause() {
+  std::unique_lock ul(mutex_);
+  if (paused_ || clock_)
+    return;
+  pause_start_time_ = std::chrono::steady_clock::now();
+  paused_ = true;
+}
+
+void BeatCursor::Unpause() {
+  std::unique_lock ul(mutex_);
+  if (!paused_ || clock_)
+    return;
+  offset_ += utils::GetElapsed(pause_start_time_, std::chrono::steady_clock::now());
+  paused_ = false;
+}
+
+bool BeatCursor::Refresh(std::shared_ptr<const BeatTimeline>& timeline, size_t& version, 
+    size_t& next_beat) const {
+  if (timeline && version == timelines_.version())
+    return false;
+  // Beats of new timeline are handled from the time of the last beat handled.
+  double last_time = (timeline && next_beat > 0) ? timeline->time(next_beat-1) : -1;
+  timeline = timelines_.Get(version);
+  next_beat = timeline->Seek(last_time);
+  return true;
+}
@@ -0,0 +1,107 @@
+#ifndef SRC_AUDIO_BEAT_CURSOR_H_
+#define SRC_AUDIO_BEAT_CURSOR_H_
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "audio/beat_timeline.h"
+#include "audio/versioned_timeline.h"
+
+/**
+ * Playback position on a beat timeline, shared by all game threads. The
+ * cursor keeps the playback clock (excluding pauses), so threads only keep
+ * the index of the last beat they handled and compare it to `position()`.
+ * The clock is either the steady clock or an external clock (f.e. the frames
+ * played by the audio device, see `set_clock`).
+ * The timeline may be swapped while playing (see VersionedTimeline): threads
+ * hold a snapshot and call `Refresh` before reading it.
+ */
+class BeatCursor {
+  public:
+    /**
+     * Constructor.
+     * @param[in] timelines versioned timeline to view (must outlive cursor).
+     */
+    BeatCursor(const VersionedTimeline& timelines);
+
+    // getter
+    /**
+     * Gets snapshot of current timeline.
+     */
+    std::shared_ptr<const BeatTimeline> timeline() const;
+
+    /**
+     * Gets playback time (excluding pauses).
+     * @return playback time in milliseconds.
+     */
+    double elapsed() const;
+
+    /**
+     * Gets number of published beats played by now (O(log n)).
+     * @return index of next beat to play.
+     */
+    size_t position() const;
+
+    /**
+     * Gets number of beats of given timeline snapshot played by now.
+     * @param[in] timeline
+     * @return index of next beat to play.
+     */
+    size_t position(const BeatTimeline& timeline) const;
+
+    /**
+     * Indicates whether all beats of a finished timeline have been played.
+     */
+    bool finished() const;
+
+    // setter
+    /**
+     * Sets external playback clock replacing the steady clock. The external
+     * clock is expected to be monotonic and to stop while playback is paused
+     * (`Pause` and `Unpause` have no effect).
+     * @param[in] clock gets playback time in milliseconds.
+     */
+    void set_clock(std::function<double()> clock);
+
+    // methods
+    /**
+     * Starts playback at given time (external clock: adds time to clock).
+     * @param[in] time in milliseconds (f.e. to resume a song).
+     */
+    void Start(double time=0);
+
+    /**
+     * Pauses playback clock (no effect if already paused).
+     */
+    void Pause();
+
+    /**
+     * Resumes playback clock (no effect if not paused).
+     */
+    void Unpause();
+
+    /**
+     * Re-acquires snapshot, if a new timeline was swapped in. The index of the
+     * next beat to handle is moved to the first beat of the new timeline
+     * after the last beat handled, so no beat is handled twice.
+     * @param[in, out] timeline snapshot held by caller (acquired if empty).
+     * @param[in, out] version version of held snapshot.
+     * @param[in, out] next_beat index of next beat to handle.
+     * @return whether snapshot was re-acquired.
+     */
+    bool Refresh(std::shared_ptr<const BeatTimeline>& timeline, size_t& version, size_t& next_beat) const;
+
+  private:
+    const VersionedTimeline& timelines_;
+    std::chrono::time_point<std::chrono::steady_clock> start_time_;
+    std::chrono::time_point<std::chrono::steady_clock> pause_start_time_;
+    double offset_;  ///< time at start plus time in pause (subtracted).
+    bool paused_;
+    std::function<double()> clock_;  ///< external clock (empty: steady clock).
+    mutable std::mutex mutex_;
+};
+
+#endif
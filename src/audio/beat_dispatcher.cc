@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "audio/beat_dispatcher.h"
+#include "spdlog/spdlog.h"
+
+#define LOGGER "logger"
+
+BeatQueue::BeatQueue(size_t capacity) : ring_(capacity) {}
+
+// getter
+size_t BeatQueue::size() const {
+  return ring_.size();
+}
+
+// methods
+bool BeatQueue::Push(const BeatEvent& event) {
+  if (ring_.Push(&event, 1) == 0)
+    return false;
+  // Lock, so a subscriber about to wait does not miss the notification.
+  { std::unique_lock ul(mutex_); }
+  cv_.notify_one();
+  return true;
+}
+
+bool BeatQueue::TryPop(BeatEvent& event) {
+  return ring_.Pop(&event, 1) == 1;
+}
+
+bool BeatQueue::Pop(BeatEvent& event, double timeout) {
+  if (TryPop(event))
+    return true;
+  std::unique_lock ul(mutex_);
+  cv_.wait_for(ul, std::chrono::duration<double, std::milli>(timeout), [this]() { return ring_.size() > 0; });
+  ul.unlock();
+  return TryPop(event);
+}
+
+BeatDispatcher::BeatDispatcher(const BeatCursor& cursor) : cursor_(cursor), stop_(false), next_beat_(0),
+  finished_(false) {}
+
+BeatDispatcher::~BeatDispatcher() {
+  Stop();
+}
+
+// getter
+size_t BeatDispatcher::next_beat() const {
+  return next_beat_;
+}
+
+bool BeatDispatcher::finished() const {
+  return finished_;
+}
+
+// methods
+std::shared_ptr<BeatQueue> BeatDispatcher::Subscribe(size_t capacity) {
+  subscribers_.push_back(std::make_shared<BeatQueue>(capacity));
+  return subscribers_.back();
+}
+
+void BeatDispatcher::Start() {
+  if (dispatcher_.joinable())
+    return;
+  stop_ = false;
+  dispatcher_ = std::thread([this]() { Dispatch(); });
+}
+
+void BeatDispatcher::Stop() {
+  {
+    std::unique_lock ul(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (dispatcher_.joinable())
+    dispatcher_.join();
+}
+
+void BeatDispatcher::Dispatch() {
+  std::shared_ptr<const BeatTimeline> timeline;  // snapshot, re-acquired when a new timeline is swapped in.
+  size_t version = 0;
+  size_t next_beat = next_beat_;
+  while (!stop_) {
+    cursor_.Refresh(timeline, version, next_beat);
+    size_t position = cursor_.position(*timeline);
+    for (; next_beat < position && !stop_; next_beat++) {
+      BeatEvent event = {timeline->at(next_beat), timeline->MoreOffNotes(next_beat)};
+      // Wait for slow subscribers, rather than dropping beats.
+      for (const auto& it : subscribers_) {
+        while (!it->Push(event) && !stop_)
+          std::this_thread::sleep_for(std::chrono::milliseconds(BEAT_DISPATCH_FULL_SLEEP));
+      }
+      next_beat_ = next_beat+1;
+    }
+    next_beat_ = next_beat;
+    finished_ = timeline->finished() && next_beat >= timeline->size();
+
+    // Sleep until next beat is due (the clock may stop, timelines may be swapped).
+    double sleep = BEAT_DISPATCH_MAX_SLEEP;
+    if (next_beat < timeline->size())
+      sleep = std::max(0.0, std::min(sleep, timeline->time(next_beat)-cursor_.elapsed()));
+    std::unique_lock ul(mutex_);
+    cv_.wait_for(ul, std::chrono::duration<double, std::milli>(sleep), [this]() { return stop_.load(); });
+  }
+  spdlog::get(LOGGER)->debug("BeatDispatcher::Dispatch: stopped at beat {}", next_beat);
+}
@@ -0,0 +1,141 @@
+#ifndef SRC_AUDIO_BEAT_DISPATCHER_H_
+#define SRC_AUDIO_BEAT_DISPATCHER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "audio/audio_data.h"
+#include "audio/beat_cursor.h"
+#include "audio/ring_buffer.h"
+
+#define BEAT_QUEUE_CAPACITY 1024  ///< beats a subscriber can fall behind.
+#define BEAT_DISPATCH_MAX_SLEEP 10  ///< max. ms dispatcher sleeps (to notice swapped timelines and stops).
+#define BEAT_DISPATCH_FULL_SLEEP 1  ///< ms dispatcher waits for a subscriber with a full queue.
+
+/**
+ * Beat played, as published to subscribers.
+ */
+struct BeatEvent {
+  AudioDataTimePoint data_at_beat_;
+  bool off_notes_;  ///< all notes of beat off-key (see BeatTimeline::MoreOffNotes).
+};
+
+/**
+ * Queue of played beats of one subscriber (lock-free single-producer/
+ * single-consumer). Only the subscriber may pop.
+ */
+class BeatQueue {
+  public:
+    /**
+     * Constructor.
+     * @param[in] capacity min. number of beats (rounded up to a power of two).
+     */
+    BeatQueue(size_t capacity);
+
+    // getter
+    /**
+     * Gets number of beats waiting (exact only for subscriber).
+     */
+    size_t size() const;
+
+    // methods
+    /**
+     * Pushes beat (dispatcher only) and wakes subscriber.
+     * @param[in] event
+     * @return false if queue is full.
+     */
+    bool Push(const BeatEvent& event);
+
+    /**
+     * Pops next beat without waiting.
+     * @param[out] event
+     * @return false if no beat is waiting.
+     */
+    bool TryPop(BeatEvent& event);
+
+    /**
+     * Pops next beat, waiting for it at most the given time.
+     * @param[out] event
+     * @param[in] timeout in milliseconds.
+     * @return false if no beat was dispatched in time.
+     */
+    bool Pop(BeatEvent& event, double timeout);
+
+  private:
+    RingBuffer<BeatEvent> ring_;
+    std::mutex mutex_;  ///< only locked to wait for and notify of beats.
+    std::condition_variable cv_;
+};
+
+/**
+ * Publishes each played beat exactly once to all subscribers. A single
+ * thread follows the playback position of the cursor (re-acquiring swapped
+ * timelines, see BeatCursor::Refresh), sleeps until the next beat is due and
+ * pushes it to the queue of every subscriber, so subscribers block on their
+ * queue instead of polling the timeline. Beats are never dropped: the
+ * dispatcher waits for subscribers with a full queue.
+ */
+class BeatDispatcher {
+  public:
+    /**
+     * Constructor.
+     * @param[in] cursor playback position and clock (must outlive dispatcher).
+     */
+    BeatDispatcher(const BeatCursor& cursor);
+
+    /**
+     * Destructor stopping dispatcher.
+     */
+    ~BeatDispatcher();
+
+    // getter
+    /**
+     * Gets number of beats of current timeline dispatched.
+     */
+    size_t next_beat() const;
+
+    /**
+     * Indicates whether all beats of a finished timeline have been dispatched.
+     */
+    bool finished() const;
+
+    // methods
+    /**
+     * Adds subscriber (only before `Start`).
+     * @param[in] capacity number of beats subscriber can fall behind.
+     * @return queue of subscriber.
+     */
+    std::shared_ptr<BeatQueue> Subscribe(size_t capacity=BEAT_QUEUE_CAPACITY);
+
+    /**
+     * Starts dispatcher thread.
+     */
+    void Start();
+
+    /**
+     * Stops dispatcher thread.
+     */
+    void Stop();
+
+  private:
+    const BeatCursor& cursor_;
+    std::vector<std::shared_ptr<BeatQueue>> subscribers_;
+    std::thread dispatcher_;
+    std::atomic<bool> stop_;
+    std::atomic<size_t> next_beat_;
+    std::atomic<bool> finished_;
+    std::mutex mutex_;  ///< only locked to sleep (woken by `Stop`).
+    std::condition_variable cv_;
+
+    /**
+     * Dispatches beats until stopped (runs as thread).
+     */
+    void Dispatch();
+};
+
+#endif
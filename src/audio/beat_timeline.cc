@@ -0,0 +1,377 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+
+#include "audio/beat_timeline.h"
+#include "spdlog/spdlog.h"
+
+#define LOGGER "logger"
+
+BeatTimeline::BeatTimeline() : size_(0), num_intervals_(0), finished_(false), duration_(0), first_interval_(0), paging_(true), paged_{}, 
+  page_file_(nullptr), last_chunk_(0), prefetch_chunk_(TIMELINE_MAX_CHUNKS), stop_prefetcher_(false), 
+  num_reading_(0) {}
+
+BeatTimeline::~BeatTimeline() {
+  {
+    std::unique_lock ul(page_mutex_);
+    stop_prefetcher_ = true;
+  }
+  page_cv_.notify_all();
+  if (prefetcher_.joinable())
+    prefetcher_.join();
+  if (page_file_)
+    std::fclose(page_file_);
+}
+
+// getter
+size_t BeatTimeline::size() const {
+  return size_.load(std::memory_order_acquire);
+}
+
+size_t BeatTimeline::first_interval() const {
+  return first_interval_;
+}
+
+size_t BeatTimeline::num_intervals() const {
+  return first_interval_ + num_intervals_.load(std::memory_order_acquire);
+}
+
+bool BeatTimeline::finished() const {
+  return finished_.load(std::memory_order_acquire);
+}
+
+double BeatTimeline::duration() const {
+  return duration_;
+}
+
+size_t BeatTimeline::resident_chunks() const {
+  std::unique_lock ul(page_mutex_);
+  return std::count_if(std::begin(resident_), std::end(resident_), [](const auto& it) { return it != nullptr; });
+}
+
+AudioDataTimePoint BeatTimeline::at(size_t i) const {
+  auto chunk = Page(i/TIMELINE_CHUNK_SIZE);
+  if (!chunk)
+    return {first_times_[i/TIMELINE_CHUNK_SIZE], 0, 0, {}, 0};
+  size_t j = i%TIMELINE_CHUNK_SIZE;
+  const uint8_t* notes = chunk->notes_ + chunk->note_offsets_[j];
+  AudioDataTimePoint beat = {chunk->times_[j], chunk->bpms_[j], chunk->levels_[j], {}, chunk->intervals_[j], 
+    chunk->chromas_[j]};
+  beat.notes_.reserve(chunk->num_notes_[j]);
+  for (size_t k=0; k<chunk->num_notes_[j]; k++)
+    beat.notes_.push_back(Note::FromMidi(notes[k]));
+  if (chunk->key_flags_[j] & TIMELINE_SPILLED_NOTES) {
+    std::unique_lock ul(page_mutex_);
+    for (const auto& it : spilled_notes_.at(i))
+      beat.notes_.push_back(Note::FromMidi(it));
+  }
+  return beat;
+}
+
+double BeatTimeline::time(size_t i) const {
+  auto chunk = Page(i/TIMELINE_CHUNK_SIZE);
+  return (chunk) ? chunk->times_[i%TIMELINE_CHUNK_SIZE] : first_times_[i/TIMELINE_CHUNK_SIZE];
+}
+
+bool BeatTimeline::MoreOffNotes(size_t i, bool off) const {
+  auto chunk = Page(i/TIMELINE_CHUNK_SIZE);
+  return chunk && (chunk->key_flags_[i%TIMELINE_CHUNK_SIZE] & ((off) ? TIMELINE_OFF_NOTES : TIMELINE_KEY_NOTES));
+}
+
+size_t BeatTimeline::NextOffNotes(size_t i) const {
+  size_t published = size();
+  if (i >= published)
+    return published;
+  // Rest of beat's chunk is searched, following chunks only by their first off-note beat.
+  size_t k = i/TIMELINE_CHUNK_SIZE;
+  auto chunk = Page(k);
+  for (; chunk && i < std::min(published, (k+1)*TIMELINE_CHUNK_SIZE); i++) {
+    if (chunk->key_flags_[i%TIMELINE_CHUNK_SIZE] & TIMELINE_OFF_NOTES)
+      return i;
+  }
+  for (k++; k*TIMELINE_CHUNK_SIZE < published; k++) {
+    size_t first = k*TIMELINE_CHUNK_SIZE + first_off_notes_[k].load(std::memory_order_relaxed);
+    if (first < std::min(published, (k+1)*TIMELINE_CHUNK_SIZE))
+      return first;
+  }
+  return published;
+}
+
+const Interval& BeatTimeline::interval(size_t i) const {
+  return intervals_[i - first_interval_];
+}
+
+// producer
+void BeatTimeline::Reset(double duration, bool paging, size_t first_interval) {
+  {
+    std::unique_lock ul(page_mutex_);
+    // Page file is closed: wait for reads in progress.
+    page_cv_.wait(ul, [this]() { return num_reading_ == 0; });
+    for (auto& it : resident_)
+      it.reset();
+    window_.clear();
+    std::fill(std::begin(paged_), std::end(paged_), false);
+    spilled_notes_.clear();
+    paging_ = paging;
+    last_chunk_ = 0;
+    prefetch_chunk_ = TIMELINE_MAX_CHUNKS;
+    if (page_file_)
+      std::fclose(page_file_);
+    page_file_ = nullptr;
+  }
+  head_.reset();
+  size_ = 0;
+  num_intervals_ = 0;
+  first_interval_ = first_interval;
+  finished_ = false;
+  duration_ = duration;
+}
+
+void BeatTimeline::AddInterval(const Interval& interval) {
+  size_t n = num_intervals_.load(std::memory_order_relaxed);
+  if (n == TIMELINE_MAX_INTERVALS) {
+    spdlog::get(LOGGER)->error("BeatTimeline::AddInterval: max intervals reached.");
+    return;
+  }
+  intervals_[n] = interval;
+  std::unique_lock ul(mutex_);
+  num_intervals_.store(n+1, std::memory_order_release);
+  cv_.notify_all();
+}
+
+void BeatTimeline::AddBeat(const AudioDataTimePoint& beat) {
+  size_t n = size_.load(std::memory_order_relaxed);
+  if (n == TIMELINE_CHUNK_SIZE*TIMELINE_MAX_CHUNKS) {
+    spdlog::get(LOGGER)->error("BeatTimeline::AddBeat: max beats reached.");
+    return;
+  }
+  // Start new chunk, once previous chunk is complete (and can be paged out).
+  size_t k = n/TIMELINE_CHUNK_SIZE;
+  size_t j = n%TIMELINE_CHUNK_SIZE;
+  if (j == 0) {
+    if (k > 0 && paging_)
+      PageOut(k-1);
+    head_.reset(new Chunk());
+    head_->num_chunk_notes_ = 0;
+    first_times_[k] = beat.time_;
+    first_off_notes_[k].store(TIMELINE_CHUNK_SIZE, std::memory_order_relaxed);
+    std::unique_lock ul(page_mutex_);
+    resident_[k] = head_;
+  }
+  Chunk& chunk = *head_;
+
+  // Notes exceeding the notes of a chunk are spilled.
+  size_t num_notes = std::min({beat.notes_.size(), static_cast<size_t>(UINT16_MAX), 
+      static_cast<size_t>(TIMELINE_CHUNK_NOTES - chunk.num_chunk_notes_)});
+  if (num_notes < beat.notes_.size()) {
+    std::vector<uint8_t> spilled;
+    for (size_t l=num_notes; l<beat.notes_.size(); l++)
+      spilled.push_back(beat.notes_[l].midi_note_);
+    std::unique_lock ul(page_mutex_);
+    if (spilled_notes_.empty())
+      spdlog::get(LOGGER)->warn("BeatTimeline::AddBeat: notes of chunk {} exceed chunk, spilling notes.", k);
+    spilled_notes_[n] = std::move(spilled);
+  }
+  for (size_t l=0; l<num_notes; l++)
+    chunk.notes_[chunk.num_chunk_notes_+l] = beat.notes_[l].midi_note_;
+  chunk.times_[j] = beat.time_;
+  chunk.bpms_[j] = beat.bpm_;
+  chunk.levels_[j] = beat.level_;
+  chunk.intervals_[j] = beat.interval_;
+  chunk.chromas_[j] = beat.chroma_;
+  chunk.note_offsets_[j] = chunk.num_chunk_notes_;
+  chunk.num_notes_[j] = num_notes;
+  // Key of beat's interval is already published.
+  chunk.key_flags_[j] = (num_notes < beat.notes_.size()) ? TIMELINE_SPILLED_NOTES : 0;
+  uint16_t note_mask = Note::Mask(beat.notes_);
+  size_t interval = beat.interval_ - first_interval_;
+  if (note_mask != 0 && static_cast<size_t>(beat.interval_) >= first_interval_ 
+      && interval < num_intervals_.load(std::memory_order_relaxed)) {
+    uint16_t key_mask = intervals_[interval].key_mask_;
+    if ((note_mask & key_mask) == 0)
+      chunk.key_flags_[j] |= TIMELINE_OFF_NOTES;
+    if ((note_mask & ~key_mask) == 0)
+      chunk.key_flags_[j] |= TIMELINE_KEY_NOTES;
+  }
+  if ((chunk.key_flags_[j] & TIMELINE_OFF_NOTES) 
+      && first_off_notes_[k].load(std::memory_order_relaxed) == TIMELINE_CHUNK_SIZE)
+    first_off_notes_[k].store(j, std::memory_order_relaxed);
+  chunk.num_chunk_notes_ += num_notes;
+  size_.store(n+1, std::memory_order_release);
+  // Only wake consumers waiting for the first beat.
+  if (n == 0) {
+    std::unique_lock ul(mutex_);
+    cv_.notify_all();
+  }
+}
+
+void BeatTimeline::Finish() {
+  std::unique_lock ul(mutex_);
+  finished_.store(true, std::memory_order_release);
+  cv_.notify_all();
+}
+
+// consumer
+void BeatTimeline::WaitFor(size_t num_intervals) const {
+  std::unique_lock ul(mutex_);
+  cv_.wait(ul, [&]() { 
+    // Intervals are complete, once the following interval was published.
+    return finished() || (this->num_intervals() > num_intervals && size() > 0); 
+  });
+}
+
+size_t BeatTimeline::ExpectedSize() const {
+  if (finished())
+    return size();
+  size_t published = size();
+  if (published == 0 || duration_ <= 0 || time(published-1) <= 0)
+    return published;
+  return std::max(published, static_cast<size_t>(published*duration_/time(published-1)));
+}
+
+size_t BeatTimeline::Seek(double time) const {
+  size_t published = size();
+  if (published == 0)
+    return 0;
+  // Find chunk by time of first beat, then beat inside chunk.
+  size_t first = 0;
+  size_t last = (published-1)/TIMELINE_CHUNK_SIZE + 1;
+  while (first < last) {
+    size_t mid = first + (last-first)/2;
+    if (first_times_[mid] <= time)
+      first = mid+1;
+    else 
+      last = mid;
+  }
+  if (first == 0)
+    return 0;
+  size_t k = first-1;
+  auto chunk = Page(k);
+  if (!chunk)
+    return k*TIMELINE_CHUNK_SIZE;
+  first = 0;
+  last = std::min(published - k*TIMELINE_CHUNK_SIZE, static_cast<size_t>(TIMELINE_CHUNK_SIZE));
+  while (first < last) {
+    size_t mid = first + (last-first)/2;
+    if (chunk->times_[mid] <= time)
+      first = mid+1;
+    else 
+      last = mid;
+  }
+  return k*TIMELINE_CHUNK_SIZE + first;
+}
+
+AudioData BeatTimeline::Snapshot(size_t num_intervals) const {
+  AudioData audio_data = AudioData();
+  audio_data.duration_ = duration_;
+  size_t available_intervals = std::min(num_intervals, this->num_intervals());
+  for (size_t i=first_interval_; i<available_intervals; i++)
+    audio_data.intervals_[i] = interval(i);
+  size_t published = size();
+  auto& beats = audio_data.data_per_beat_;
+  for (size_t i=0; i<published; i++) {
+    AudioDataTimePoint beat = at(i);
+    if (static_cast<size_t>(beat.interval_) >= available_intervals)
+      break;
+    beats.push_back(beat);
+  }
+  if (beats.size() == 0)
+    return audio_data;
+
+  // Calculate averages and max peak of snapshot.
+  for (size_t i=0; i<beats.size(); i++) {
+    audio_data.average_bpm_ += beats.bpms()[i];
+    audio_data.average_level_ += beats.levels()[i];
+  }
+  audio_data.average_bpm_ /= beats.size();
+  audio_data.average_level_ /= beats.size();
+  for (const auto& level : beats.levels())
+    audio_data.max_peak_ = std::max(audio_data.max_peak_, static_cast<int>(level - audio_data.average_level_));
+  return audio_data;
+}
+
+std::shared_ptr<const BeatTimeline::Chunk> BeatTimeline::Page(size_t k) const {
+  std::unique_lock ul(page_mutex_);
+  last_chunk_ = k;
+  std::shared_ptr<const Chunk> chunk = resident_[k];
+  if (!chunk)
+    chunk = PageIn(k, ul);
+  // Prefetch next chunk, so reading on does not wait for the page file.
+  if (k+1 < TIMELINE_MAX_CHUNKS && paged_[k+1] && !resident_[k+1]) {
+    prefetch_chunk_ = k+1;
+    if (!prefetcher_.joinable())
+      prefetcher_ = std::thread([this]() { Prefetch(); });
+    page_cv_.notify_one();
+  }
+  return chunk;
+}
+
+std::shared_ptr<BeatTimeline::Chunk> BeatTimeline::PageIn(size_t k, std::unique_lock<std::mutex>& ul) const {
+  // Read without holding the lock, so readers of resident chunks do not wait for the page file.
+  std::FILE* file = page_file_;
+  num_reading_++;
+  ul.unlock();
+  std::shared_ptr<Chunk> chunk(new Chunk());
+  bool read = file && pread(fileno(file), chunk.get(), sizeof(Chunk), k*sizeof(Chunk)) == sizeof(Chunk);
+  ul.lock();
+  num_reading_--;
+  page_cv_.notify_all();
+  if (!read) {
+    spdlog::get(LOGGER)->error("BeatTimeline::PageIn: could not read chunk {} from page file.", k);
+    return nullptr;
+  }
+  // Chunk may have been paged in by another reader meanwhile.
+  if (resident_[k])
+    return resident_[k];
+  resident_[k] = chunk;
+  window_.push_back(k);
+  Evict();
+  return chunk;
+}
+
+void BeatTimeline::Evict() const {
+  auto distance = [this](size_t k) { return (k > last_chunk_) ? k-last_chunk_ : last_chunk_-k; };
+  while (window_.size() > TIMELINE_WINDOW_CHUNKS) {
+    auto farthest = std::max_element(window_.begin(), window_.end(), 
+        [&distance](size_t a, size_t b) { return distance(a) < distance(b); });
+    resident_[*farthest].reset();  // readers still holding the chunk keep it alive.
+    window_.erase(farthest);
+  }
+}
+
+void BeatTimeline::PageOut(size_t k) {
+  std::FILE* file = nullptr;
+  {
+    std::unique_lock ul(page_mutex_);
+    if (!page_file_)
+      page_file_ = std::tmpfile();
+    file = page_file_;
+  }
+  // Chunk is complete, so it is written without holding the lock.
+  bool written = file && pwrite(fileno(file), head_.get(), sizeof(Chunk), k*sizeof(Chunk)) == sizeof(Chunk);
+  if (!written) {
+    spdlog::get(LOGGER)->warn("BeatTimeline::PageOut: could not write chunk {}, keeping it in memory.", k);
+    return;
+  }
+  std::unique_lock ul(page_mutex_);
+  paged_[k] = true;
+  window_.push_back(k);
+  Evict();
+}
+
+void BeatTimeline::Prefetch() const {
+  std::unique_lock ul(page_mutex_);
+  while (true) {
+    page_cv_.wait(ul, [this]() { return stop_prefetcher_ || prefetch_chunk_ < TIMELINE_MAX_CHUNKS; });
+    if (stop_prefetcher_)
+      return;
+    size_t k = prefetch_chunk_;
+    prefetch_chunk_ = TIMELINE_MAX_CHUNKS;
+    if (paged_[k] && !resident_[k])
+      PageIn(k, ul);
+  }
+}
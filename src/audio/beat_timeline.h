@@ -0,0 +1,255 @@
+#ifndef SRC_AUDIO_BEAT_TIMELINE_H_
+#define SRC_AUDIO_BEAT_TIMELINE_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "audio/audio_data.h"
+
+#define TIMELINE_CHUNK_SIZE 1024
+#define TIMELINE_MAX_CHUNKS 4096  ///< ~4 million beats
+#define TIMELINE_MAX_INTERVALS 64
+#define TIMELINE_CHUNK_NOTES 16384  ///< notes per chunk (16 per beat on average, surplus notes are spilled).
+#define TIMELINE_WINDOW_CHUNKS 4  ///< max. chunks paged in (besides chunk currently filled by producer).
+#define TIMELINE_OFF_NOTES 1  ///< all notes of beat off-key.
+#define TIMELINE_KEY_NOTES 2  ///< all notes of beat in key.
+#define TIMELINE_SPILLED_NOTES 4  ///< notes of beat exceeding chunk are spilled.
+
+/**
+ * Append-only timeline of analysed beats, filled by one producer (the
+ * analysis) while consumers (game threads) read it concurrently.
+ * Beats are stored column-wise in fixed-size chunks, each with the notes (as
+ * midi notes) of it's beats, so published beats never change.
+ * If paging is enabled (streams, see `Reset`), memory is bounded regardless
+ * of the number of beats: complete chunks are written to a page file (an
+ * unlinked temporary file) and only a window of TIMELINE_WINDOW_CHUNKS chunks
+ * around the chunks read last is kept in memory. Chunks outside the window
+ * are paged in on access, the chunk after the one read last is prefetched in
+ * background. Without paging (song files, whose analysis is kept in memory
+ * anyway) all chunks stay resident. Readers pin a chunk while
+ * reading it, so paging never invalidates a beat being read. Time of the
+ * first beat and first off-note beat of each chunk are kept for all chunks,
+ * so seeking and finding the next off-note beat page in at most one chunk.
+ * If a chunk cannot be read back, it's beats are read as beats without notes
+ * at the time of the chunk's first beat (read is retried on next access).
+ * Notes not fitting into a chunk (more than TIMELINE_CHUNK_NOTES) are spilled
+ * to a map kept in memory, so no notes are lost.
+ * The key of each interval is published before the first beat of that
+ * interval, so whether a beat's notes are off-key is computed once, when the
+ * beat is published.
+ */
+class BeatTimeline {
+  public:
+    BeatTimeline();
+
+    /**
+     * Destructor stopping prefetching and removing page file.
+     */
+    ~BeatTimeline();
+
+    BeatTimeline(const BeatTimeline&) = delete;
+    BeatTimeline& operator=(const BeatTimeline&) = delete;
+
+    // getter
+    /**
+     * Gets number of published beats.
+     */
+    size_t size() const;
+
+    /**
+     * Gets id of first interval of timeline (see `Reset`).
+     */
+    size_t first_interval() const;
+
+    /**
+     * Gets number of published intervals, incl. intervals before the first
+     * interval (ids of intervals published last are smaller).
+     */
+    size_t num_intervals() const;
+
+    /**
+     * Indicates whether all beats have been published.
+     */
+    bool finished() const;
+
+    /**
+     * Gets duration of audio in milliseconds (0 if unknown).
+     */
+    double duration() const;
+
+    /**
+     * Gets number of chunks currently kept in memory.
+     */
+    size_t resident_chunks() const;
+
+    /**
+     * Gets published beat (notes are created from note pool).
+     * @param[in] i index, must be smaller than `size()`.
+     * @return beat.
+     */
+    AudioDataTimePoint at(size_t i) const;
+
+    /**
+     * Gets time of published beat, without assembling the beat (pages in chunk
+     * of beat, prefer `Seek` to search by time).
+     * @param[in] i index, must be smaller than `size()`.
+     * @return time in milliseconds.
+     */
+    double time(size_t i) const;
+
+    /**
+     * Checks whether all notes of published beat are off-key (or in key).
+     * @param[in] i index, must be smaller than `size()`.
+     * @param[in] off if false, checks whether all notes are in key.
+     * @return true if beat has notes and all are off-key (in key).
+     */
+    bool MoreOffNotes(size_t i, bool off=true) const;
+
+    /**
+     * Gets next beat with only off-key notes (see `MoreOffNotes`).
+     * @param[in] i index of first beat to consider.
+     * @return index of next beat with off-key notes (>= i) or `size()` if no
+     * such beat is published (yet).
+     */
+    size_t NextOffNotes(size_t i) const;
+
+    /**
+     * Gets published interval.
+     * @param[in] i id, must not be smaller than `first_interval()` and be
+     * smaller than `num_intervals()`.
+     * @return interval.
+     */
+    const Interval& interval(size_t i) const;
+
+    // producer
+    /**
+     * Clears timeline (incl. page file). Must not be called while consumers
+     * are reading.
+     * @param[in] duration (expected) duration of audio in milliseconds.
+     * @param[in] paging if set, complete chunks are paged to a page file.
+     * @param[in] first_interval id of first interval published (f.e. intervals
+     * of songs spliced on before are not published again).
+     */
+    void Reset(double duration, bool paging=true, size_t first_interval=0);
+    void AddInterval(const Interval& interval);
+    void AddBeat(const AudioDataTimePoint& beat);
+    void Finish();
+
+    // consumer
+    /**
+     * Blocks until all beats of the given number of intervals (and at least
+     * one beat) are published or timeline is finished.
+     * @param[in] num_intervals
+     */
+    void WaitFor(size_t num_intervals) const;
+
+    /**
+     * Estimates total number of beats, extrapolating from published beats and
+     * duration, while timeline is not finished.
+     * @return (estimated) total number of beats.
+     */
+    size_t ExpectedSize() const;
+
+    /**
+     * Gets number of published beats played at given time (binary search).
+     * @param[in] time in milliseconds.
+     * @return index of first beat after given time.
+     */
+    size_t Seek(double time) const;
+
+    /**
+     * Creates audio data of all beats in the first `num_intervals` intervals,
+     * with averages and peak calculated only from these beats.
+     * @param[in] num_intervals
+     * @return audio data of first intervals.
+     */
+    AudioData Snapshot(size_t num_intervals) const;
+
+  private:
+    /** Plain data, written to and read from page file as is. */
+    struct Chunk {
+      double times_[TIMELINE_CHUNK_SIZE];
+      int32_t bpms_[TIMELINE_CHUNK_SIZE];
+      int32_t levels_[TIMELINE_CHUNK_SIZE];
+      int32_t intervals_[TIMELINE_CHUNK_SIZE];
+      uint32_t note_offsets_[TIMELINE_CHUNK_SIZE];  ///< offset into notes of chunk.
+      uint16_t num_notes_[TIMELINE_CHUNK_SIZE];
+      uint8_t key_flags_[TIMELINE_CHUNK_SIZE];  ///< TIMELINE_OFF_NOTES/ TIMELINE_KEY_NOTES
+      Chroma chromas_[TIMELINE_CHUNK_SIZE];
+      uint8_t notes_[TIMELINE_CHUNK_NOTES];
+      uint32_t num_chunk_notes_;  ///< only accessed by producer.
+    };
+
+    std::shared_ptr<Chunk> head_;  ///< chunk filled by producer (always resident).
+    double first_times_[TIMELINE_MAX_CHUNKS];  ///< time of first beat of each chunk.
+    std::atomic<uint32_t> first_off_notes_[TIMELINE_MAX_CHUNKS];  ///< TIMELINE_CHUNK_SIZE if none.
+    Interval intervals_[TIMELINE_MAX_INTERVALS];
+    std::atomic<size_t> size_;
+    std::atomic<size_t> num_intervals_;
+    std::atomic<bool> finished_;
+    double duration_;
+    size_t first_interval_;  ///< id of first interval.
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cv_;
+
+    // paging (all guarded by `page_mutex_`)
+    mutable std::shared_ptr<Chunk> resident_[TIMELINE_MAX_CHUNKS];
+    mutable std::vector<size_t> window_;  ///< indices of resident chunks (excl. head).
+    bool paging_;
+    bool paged_[TIMELINE_MAX_CHUNKS];  ///< chunk is written to page file.
+    std::unordered_map<size_t, std::vector<uint8_t>> spilled_notes_;  ///< beat -> notes exceeding chunk.
+    std::FILE* page_file_;
+    mutable size_t last_chunk_;  ///< chunk read last.
+    mutable size_t prefetch_chunk_;  ///< chunk to prefetch (TIMELINE_MAX_CHUNKS: none).
+    mutable std::thread prefetcher_;
+    mutable bool stop_prefetcher_;
+    mutable size_t num_reading_;  ///< reads from page file in progress (without lock).
+    mutable std::mutex page_mutex_;
+    mutable std::condition_variable page_cv_;
+
+    /**
+     * Gets chunk (pinned while reference is held), paging it in if needed and
+     * requesting the following chunk to be prefetched.
+     * @param[in] k index of chunk, must contain a published beat.
+     * @return chunk (nullptr if it could not be read from page file).
+     */
+    std::shared_ptr<const Chunk> Page(size_t k) const;
+
+    /**
+     * Reads chunk from page file into window, evicting the chunk farthest from
+     * the chunk read last, if window is full. The page mutex is released
+     * while reading.
+     * @param[in] k index of chunk (must be written to page file).
+     * @param[in] ul lock of page mutex (locked).
+     * @return chunk (nullptr if read failed).
+     */
+    std::shared_ptr<Chunk> PageIn(size_t k, std::unique_lock<std::mutex>& ul) const;
+
+    /**
+     * Evicts chunks farthest from the chunk read last, until window is not
+     * larger than TIMELINE_WINDOW_CHUNKS. Page mutex must be held.
+     */
+    void Evict() const;
+
+    /**
+     * Writes complete chunk to page file, so it may be evicted.
+     * @param[in] k index of chunk.
+     */
+    void PageOut(size_t k);
+
+    /**
+     * Prefetches requested chunks (runs as thread).
+     */
+    void Prefetch() const;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "audio/decimator.h"
+#include "audio/simd.h"
+
+typedef float (*dot_product_t)(const float*, const float*, size_t);
+
+#if defined(SIMD_X86)
+__attribute__((target("avx2,fma")))
+float DotProductAvx2(const float* a, const float* b, size_t n) {
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i+8 <= n; i+=8)
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(a+i), _mm256_loadu_ps(b+i), sum);
+  float res = simd::Sum(sum);
+  for (; i<n; i++)
+    res += a[i]*b[i];
+  return res;
+}
+
+__attribute__((target("sse")))
+float DotProductSse(const float* a, const float* b, size_t n) {
+  __m128 sum = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i+4 <= n; i+=4)
+    sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(a+i), _mm_loadu_ps(b+i)));
+  float res = simd::Sum(sum);
+  for (; i<n; i++)
+    res += a[i]*b[i];
+  return res;
+}
+#elif defined(SIMD_NEON)
+float DotProductNeon(const float* a, const float* b, size_t n) {
+  float32x4_t sum = vdupq_n_f32(0);
+  size_t i = 0;
+  for (; i+4 <= n; i+=4)
+    sum = vmlaq_f32(sum, vld1q_f32(a+i), vld1q_f32(b+i));
+  float res = simd::Sum(sum);
+  for (; i<n; i++)
+    res += a[i]*b[i];
+  return res;
+}
+#endif
+
+static const simd::Kernel<dot_product_t> kernel = simd::Select<dot_product_t>({
+#if defined(SIMD_X86)
+  {"avx2", &DotProductAvx2, __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")},
+  {"sse", &DotProductSse, __builtin_cpu_supports("sse") != 0},
+#elif defined(SIMD_NEON)
+  {"neon", &DotProductNeon, true},
+#endif
+  {"scalar", &Decimator::DotProductScalar, true},
+});
+
+Decimator::Decimator(unsigned int factor) : factor_(std::max(1u, factor)) {
+  if (factor_ == 1)
+    return;
+  // Windowed-sinc (blackman) low-pass, normalized to unity gain.
+  size_t num_taps = factor_*DECIMATOR_TAPS_PER_FACTOR + 1;
+  double cutoff = 0.9*0.5/factor_;  // cycles per input sample.
+  double center = (num_taps-1)/2.0;
+  double sum = 0;
+  taps_.resize(num_taps);
+  for (size_t i=0; i<num_taps; i++) {
+    double x = i - center;
+    double sinc = (x == 0) ? 2*cutoff : std::sin(2*M_PI*cutoff*x)/(M_PI*x);
+    double window = 0.42 - 0.5*std::cos(2*M_PI*i/(num_taps-1)) + 0.08*std::cos(4*M_PI*i/(num_taps-1));
+    taps_[i] = sinc*window;
+    sum += taps_[i];
+  }
+  for (auto& it : taps_)
+    it /= sum;
+  // Half the filter reaches before the first sample: pad with silence.
+  history_.assign(num_taps/2, 0.0f);
+}
+
+// getter
+unsigned int Decimator::factor() const {
+  return factor_;
+}
+
+const std::vector<float>& Decimator::taps() const {
+  return taps_;
+}
+
+// methods
+void Decimator::Process(const float* in, size_t n, std::vector<float>& out, bool scalar) {
+  if (factor_ == 1) {
+    out.insert(out.end(), in, in+n);
+    return;
+  }
+  // Filter is symmetric, so each output is a plain dot product with the input window.
+  history_.insert(history_.end(), in, in+n);
+  size_t pos = 0;
+  for (; pos+taps_.size() <= history_.size(); pos+=factor_) {
+    out.push_back((scalar) ? DotProductScalar(taps_.data(), &history_[pos], taps_.size())
+        : kernel.fn_(taps_.data(), &history_[pos], taps_.size()));
+  }
+  history_.erase(history_.begin(), history_.begin()+pos);
+}
+
+unsigned int Decimator::Factor(unsigned int samplerate, unsigned int target_samplerate) {
+  unsigned int factor = 1;
+  while (target_samplerate > 0 && factor < DECIMATOR_MAX_FACTOR && samplerate/(2*factor) >= target_samplerate)
+    factor *= 2;
+  return factor;
+}
+
+float Decimator::DotProduct(const float* a, const float* b, size_t n) {
+  return kernel.fn_(a, b, n);
+}
+
+float Decimator::DotProductScalar(const float* a, const float* b, size_t n) {
+  float res = 0;
+  for (size_t i=0; i<n; i++)
+    res += a[i]*b[i];
+  return res;
+}
+
+std::string Decimator::Kernel() {
+  return kernel.name_;
+}
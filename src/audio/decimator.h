@@ -0,0 +1,82 @@
+#ifndef SRC_AUDIO_DECIMATOR_H_
+#define SRC_AUDIO_DECIMATOR_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#define DECIMATOR_MAX_FACTOR 4
+#define DECIMATOR_TAPS_PER_FACTOR 16  ///< filter length per decimation step (taps = factor*16+1).
+
+/**
+ * Downsamples mono audio by an integer factor. A windowed-sinc low-pass
+ * (cutoff at 90% of the new nyquist frequency) is only evaluated at the
+ * samples kept (polyphase form), each output being the dot product of the
+ * filter and the input around it. The dot product is computed by a SIMD
+ * kernel (AVX2 or SSE on x86, NEON on ARM) selected at runtime, with a
+ * scalar fallback.
+ * Output sample i is centered at input sample i*factor (no delay).
+ */
+class Decimator {
+  public:
+    /**
+     * Constructor.
+     * @param[in] factor (1: samples are passed through).
+     */
+    Decimator(unsigned int factor);
+
+    // getter
+    unsigned int factor() const;
+    const std::vector<float>& taps() const;
+
+    // methods
+    /**
+     * Downsamples next input samples. The last samples are kept until the
+     * filter can be applied to them, so outputs may lag behind by half the
+     * filter length.
+     * @param[in] in (mono)
+     * @param[in] n number of input samples.
+     * @param[out] out output samples are appended.
+     * @param[in] scalar if set, always uses scalar kernel.
+     */
+    void Process(const float* in, size_t n, std::vector<float>& out, bool scalar=false);
+
+    /**
+     * Gets largest decimation factor (power of two, max.
+     * DECIMATOR_MAX_FACTOR), which keeps samplerate above target samplerate.
+     * @param[in] samplerate
+     * @param[in] target_samplerate (0: native samplerate).
+     * @return decimation factor.
+     */
+    static unsigned int Factor(unsigned int samplerate, unsigned int target_samplerate);
+
+    /**
+     * Computes dot product with the fastest available kernel.
+     * @param[in] a
+     * @param[in] b
+     * @param[in] n number of samples.
+     * @return dot product.
+     */
+    static float DotProduct(const float* a, const float* b, size_t n);
+
+    /**
+     * Computes dot product in order.
+     * @param[in] a
+     * @param[in] b
+     * @param[in] n number of samples.
+     * @return dot product.
+     */
+    static float DotProductScalar(const float* a, const float* b, size_t n);
+
+    /**
+     * Gets name of kernel used by `DotProduct` ("avx2", "sse", "neon" or "scalar").
+     */
+    static std::string Kernel();
+
+  private:
+    const unsigned int factor_;
+    std::vector<float> taps_;
+    std::vector<float> history_;  ///< input samples not yet completely filtered.
+};
+
+#endif
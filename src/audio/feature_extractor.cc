@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <vector>
+
+#include "audio/feature_extractor.h"
+
+FeatureExtractor::FeatureExtractor(unsigned int samplerate, size_t win_size, size_t hop_size)
+  : samplerate_(samplerate), win_size_(win_size), hop_size_(hop_size),
+  fps_(static_cast<double>(samplerate)/hop_size), window_(win_size), frame_(win_size, 0.0f),
+  spectrum_(win_size), log_magnitudes_(win_size/2+1, 0.0f), bin_midi_(win_size/2+1, -1), hops_(0),
+  onsets_(std::max(static_cast<size_t>(FEATURE_TEMPO_WINDOW*fps_/1000), static_cast<size_t>(1)), 0.0f),
+  onset_(0), period_(0), last_beat_(-1), next_beat_(0), hop_chroma_({}), beat_chroma_({}), peak_energy_({}),
+  peak_midi_({}) {
+  for (size_t i=0; i<win_size_; i++)
+    window_[i] = 0.5 - 0.5*std::cos(2*M_PI*i/win_size_);
+  for (size_t k=1; k<bin_midi_.size(); k++) {
+    double freq = static_cast<double>(k)*samplerate_/win_size_;
+    if (freq >= FEATURE_MIN_FREQ && freq <= FEATURE_MAX_FREQ)
+      bin_midi_[k] = std::lround(69 + 12*std::log2(freq/440.0));
+  }
+}
+
+// getter
+double FeatureExtractor::bpm() const {
+  return (period_ > 0) ? 60.0*fps_/period_ : 0;
+}
+
+float FeatureExtractor::onset() const {
+  return onset_;
+}
+
+double FeatureExtractor::beat_phase() const {
+  if (last_beat_ < 0 || period_ <= 0)
+    return 0;
+  return std::min(1.0, (hops_-1-last_beat_)/period_);
+}
+
+double FeatureExtractor::last_beat_ms() const {
+  return (last_beat_ < 0) ? 0 : last_beat_*1000.0/fps_;
+}
+
+const std::array<float, 12>& FeatureExtractor::hop_chroma() const {
+  return hop_chroma_;
+}
+
+// methods
+bool FeatureExtractor::Do(const float* hop) {
+  // Shift hop into frame and transform windowed frame.
+  std::copy(frame_.begin()+hop_size_, frame_.end(), frame_.begin());
+  std::copy(hop, hop+hop_size_, frame_.end()-hop_size_);
+  for (size_t i=0; i<win_size_; i++)
+    spectrum_[i] = std::complex<float>(frame_[i]*window_[i], 0.0f);
+  Fft(spectrum_);
+
+  // Onset strength and chroma from the same spectrum.
+  float flux = 0;
+  hop_chroma_.fill(0);
+  for (size_t k=0; k<log_magnitudes_.size(); k++) {
+    float energy = std::norm(spectrum_[k]);
+    float log_magnitude = std::log1p(std::sqrt(energy));
+    flux += std::max(0.0f, log_magnitude - log_magnitudes_[k]);
+    log_magnitudes_[k] = log_magnitude;
+    if (bin_midi_[k] < 0)
+      continue;
+    size_t pitch_class = bin_midi_[k]%12;
+    hop_chroma_[pitch_class] += energy;
+    if (energy > peak_energy_[pitch_class]) {
+      peak_energy_[pitch_class] = energy;
+      peak_midi_[pitch_class] = bin_midi_[k];
+    }
+  }
+  for (size_t i=0; i<12; i++)
+    beat_chroma_[i] += hop_chroma_[i];
+  onset_ = flux;
+  onsets_[hops_%onsets_.size()] = flux;
+  hops_++;
+
+  size_t update = std::max(static_cast<size_t>(FEATURE_TEMPO_UPDATE*fps_/1000), static_cast<size_t>(1));
+  if (hops_ >= onsets_.size()/2 && hops_%update == 0)
+    EstimateTempo();
+  return TrackBeat();
+}
+
+void FeatureExtractor::TakeBeat(Chroma& chroma, std::vector<Note>& notes) {
+  chroma.fill(0);
+  notes.clear();
+  float max = *std::max_element(beat_chroma_.begin(), beat_chroma_.end());
+  if (max > 0) {
+    for (size_t i=0; i<12; i++)
+      chroma[i] = std::lround(255*beat_chroma_[i]/max);
+    std::vector<size_t> pitch_classes;
+    for (size_t i=0; i<12; i++) {
+      if (chroma[i] >= 255*FEATURE_NOTE_THRESHOLD)
+        pitch_classes.push_back(i);
+    }
+    std::stable_sort(pitch_classes.begin(), pitch_classes.end(),
+        [&chroma](size_t a, size_t b) { return chroma[a] > chroma[b]; });
+    for (const auto& it : pitch_classes)
+      notes.push_back(Note::FromMidi(peak_midi_[it]));
+  }
+  beat_chroma_.fill(0);
+  peak_energy_.fill(0);
+}
+
+void FeatureExtractor::EstimateTempo() {
+  size_t len = std::min(hops_, onsets_.size());
+  std::vector<float> history(len);
+  float mean = 0;
+  for (size_t i=0; i<len; i++) {
+    history[i] = onsets_[(hops_-len+i)%onsets_.size()];
+    mean += history[i];
+  }
+  mean /= len;
+  for (auto& it : history)
+    it -= mean;
+
+  // Autocorrelation of onset strength, weighted by a log-gaussian around prior tempo.
+  size_t min_lag = std::max(static_cast<size_t>(60*fps_/FEATURE_MAX_BPM), static_cast<size_t>(1));
+  size_t max_lag = std::min(static_cast<size_t>(60*fps_/FEATURE_MIN_BPM), len/2);
+  std::vector<double> scores(max_lag+2, 0);
+  size_t best = 0;
+  for (size_t lag=min_lag; lag<=max_lag+1 && lag<len; lag++) {
+    double r = 0;
+    for (size_t i=lag; i<len; i++)
+      r += history[i]*history[i-lag];
+    double octaves = std::log2(60*fps_/lag/FEATURE_PRIOR_BPM);
+    scores[lag] = std::max(0.0, r/(len-lag)) * std::exp(-0.5*octaves*octaves);
+    if (lag <= max_lag && (best == 0 || scores[lag] > scores[best]))
+      best = lag;
+  }
+  if (best == 0 || scores[best] <= 0)
+    return;
+  // Refine period between lags (parabolic interpolation).
+  double period = best;
+  if (best > min_lag && best+1 < scores.size()) {
+    double a = scores[best-1], b = scores[best], c = scores[best+1];
+    double denominator = a - 2*b + c;
+    if (denominator < 0)
+      period += 0.5*(a-c)/denominator;
+  }
+  period_ = period;
+}
+
+bool FeatureExtractor::TrackBeat() {
+  if (period_ <= 0)
+    return false;
+  long now = hops_-1;
+  long tolerance = std::max(1L, std::lround(period_*FEATURE_BEAT_TOLERANCE));
+
+  // First beat: strongest onset within last period.
+  if (last_beat_ < 0) {
+    long first = std::max(0L, now - std::lround(period_) + 1);
+    long best = first;
+    for (long i=first; i<=now; i++) {
+      if (onsets_[i%onsets_.size()] > onsets_[best%onsets_.size()])
+        best = i;
+    }
+    last_beat_ = best;
+    next_beat_ = best + period_;
+    return true;
+  }
+
+  // Place beat at strongest onset near expected beat, once all hops near it are known.
+  if (now < std::lround(next_beat_) + tolerance)
+    return false;
+  long first = std::max(last_beat_ + std::lround(period_/2), std::lround(next_beat_) - tolerance);
+  long best = std::lround(next_beat_);
+  float max = 0;
+  for (long i=first; i<=now; i++) {
+    if (onsets_[i%onsets_.size()] > max) {
+      max = onsets_[i%onsets_.size()];
+      best = i;
+    }
+  }
+  last_beat_ = best;
+  next_beat_ = best + period_;
+  return true;
+}
+
+void FeatureExtractor::Fft(std::vector<std::complex<float>>& data) {
+  size_t n = data.size();
+  // Bit-reversal permutation.
+  for (size_t i=1, j=0; i<n; i++) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+      std::swap(data[i], data[j]);
+  }
+  // Butterflies.
+  for (size_t len=2; len<=n; len<<=1) {
+    std::complex<float> step = std::polar(1.0f, static_cast<float>(-2*M_PI/len));
+    for (size_t i=0; i<n; i+=len) {
+      std::complex<float> w(1.0f, 0.0f);
+      for (size_t j=0; j<len/2; j++) {
+        std::complex<float> u = data[i+j];
+        std::complex<float> v = data[i+j+len/2]*w;
+        data[i+j] = u+v;
+        data[i+j+len/2] = u-v;
+        w *= step;
+      }
+    }
+  }
+}
@@ -0,0 +1,123 @@
+#ifndef SRC_AUDIO_FEATURE_EXTRACTOR_H_
+#define SRC_AUDIO_FEATURE_EXTRACTOR_H_
+
+#include <array>
+#include <complex>
+#include <cstddef>
+#include <vector>
+#include "audio/audio_data.h"
+
+#define FEATURE_MIN_FREQ 100.0  ///< lowest frequency (Hz) considered for chroma.
+#define FEATURE_MAX_FREQ 5000.0  ///< highest frequency (Hz) considered for chroma.
+#define FEATURE_NOTE_THRESHOLD 0.5  ///< min. chroma (relative to strongest pitch class) to count as note.
+#define FEATURE_TEMPO_WINDOW 8000  ///< length (ms) of onset history used to estimate tempo.
+#define FEATURE_TEMPO_UPDATE 250  ///< ms between tempo estimates.
+#define FEATURE_MIN_BPM 60
+#define FEATURE_MAX_BPM 200
+#define FEATURE_PRIOR_BPM 120  ///< tempo preferred when resolving bpm doubling/halving.
+#define FEATURE_BEAT_TOLERANCE 0.15  ///< max. deviation (relative to period) of beat from expected beat.
+
+/**
+ * In-house analysis computing one windowed FFT per hop and deriving all
+ * features from it in a single pass:
+ * - onset strength (spectral flux of log-magnitudes),
+ * - tempo (autocorrelation of onset strength, weighted towards
+ *   FEATURE_PRIOR_BPM) and beat phase (beats are placed at the strongest
+ *   onset near the expected beat, so each beat is reported with a latency of
+ *   FEATURE_BEAT_TOLERANCE of a period),
+ * - chroma (spectral energy per pitch class), accumulated per beat.
+ * Alternative to aubio's tempo- and notes-detection, which each run their
+ * own spectral analysis.
+ */
+class FeatureExtractor {
+  public:
+    /**
+     * Constructor.
+     * @param[in] samplerate
+     * @param[in] win_size fft size (power of two).
+     * @param[in] hop_size
+     */
+    FeatureExtractor(unsigned int samplerate, size_t win_size, size_t hop_size);
+
+    // getter
+    /**
+     * Gets current tempo (0 until first estimate).
+     */
+    double bpm() const;
+
+    /**
+     * Gets onset strength of last hop.
+     */
+    float onset() const;
+
+    /**
+     * Gets position in current beat period (0: at last beat, 1: at expected beat).
+     */
+    double beat_phase() const;
+
+    /**
+     * Gets time (ms) of last beat, relative to first hop.
+     */
+    double last_beat_ms() const;
+
+    /**
+     * Gets energy per pitch class of last hop.
+     */
+    const std::array<float, 12>& hop_chroma() const;
+
+    // methods
+    /**
+     * Processes next hop.
+     * @param[in] hop hop_size samples (mono).
+     * @return true if a beat was detected (see `last_beat_ms`).
+     */
+    bool Do(const float* hop);
+
+    /**
+     * Takes chroma and notes accumulated since last call.
+     * @param[out] chroma normalized chroma (all zero if silent).
+     * @param[out] notes one note per pitch class with chroma above
+     * FEATURE_NOTE_THRESHOLD (strongest first), each at the octave of it's
+     * strongest frequency.
+     */
+    void TakeBeat(Chroma& chroma, std::vector<Note>& notes);
+
+    /**
+     * In-place radix-2 fft.
+     * @param[in, out] data (size: power of two).
+     */
+    static void Fft(std::vector<std::complex<float>>& data);
+
+  private:
+    const unsigned int samplerate_;
+    const size_t win_size_;
+    const size_t hop_size_;
+    const double fps_;  ///< hops per second.
+    std::vector<float> window_;
+    std::vector<float> frame_;  ///< last win_size samples.
+    std::vector<std::complex<float>> spectrum_;
+    std::vector<float> log_magnitudes_;  ///< of previous hop.
+    std::vector<int> bin_midi_;  ///< midi note of each bin (-1: outside chroma range).
+
+    size_t hops_;
+    std::vector<float> onsets_;  ///< onset history (ring, indexed by hop).
+    float onset_;
+    double period_;  ///< beat period in hops (0 until first estimate).
+    long last_beat_;  ///< hop of last beat (-1: none yet).
+    double next_beat_;  ///< expected hop of next beat.
+
+    std::array<float, 12> hop_chroma_;
+    std::array<float, 12> beat_chroma_;
+    std::array<float, 12> peak_energy_;  ///< strongest bin per pitch class since last beat.
+    std::array<int, 12> peak_midi_;
+
+    void EstimateTempo();
+
+    /**
+     * Places beat, once all hops near the expected beat are known.
+     * @return true if beat was placed.
+     */
+    bool TrackBeat();
+};
+
+#endif
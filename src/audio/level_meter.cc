@@ -0,0 +1,106 @@
+#include <cmath>
+#include <cstddef>
+#include <string>
+
+#include "audio/level_meter.h"
+#include "audio/simd.h"
+
+typedef float (*sum_of_squares_t)(const float*, size_t);
+
+#if defined(SIMD_X86)
+__attribute__((target("avx2"))) 
+float SumOfSquaresAvx2(const float* samples, size_t n) {
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i+8 <= n; i+=8) {
+    __m256 x = _mm256_loadu_ps(samples+i);
+    sum = _mm256_add_ps(sum, _mm256_mul_ps(x, x));
+  }
+  float res = simd::Sum(sum);
+  for (; i<n; i++)
+    res += samples[i]*samples[i];
+  return res;
+}
+
+__attribute__((target("sse"))) 
+float SumOfSquaresSse(const float* samples, size_t n) {
+  __m128 sum = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i+4 <= n; i+=4) {
+    __m128 x = _mm_loadu_ps(samples+i);
+    sum = _mm_add_ps(sum, _mm_mul_ps(x, x));
+  }
+  float res = simd::Sum(sum);
+  for (; i<n; i++)
+    res += samples[i]*samples[i];
+  return res;
+}
+#elif defined(SIMD_NEON)
+float SumOfSquaresNeon(const float* samples, size_t n) {
+  float32x4_t sum = vdupq_n_f32(0);
+  size_t i = 0;
+  for (; i+4 <= n; i+=4) {
+    float32x4_t x = vld1q_f32(samples+i);
+    sum = vaddq_f32(sum, vmulq_f32(x, x));
+  }
+  float res = simd::Sum(sum);
+  for (; i<n; i++)
+    res += samples[i]*samples[i];
+  return res;
+}
+#endif
+
+static const simd::Kernel<sum_of_squares_t> kernel = simd::Select<sum_of_squares_t>({
+#if defined(SIMD_X86)
+  {"avx2", &SumOfSquaresAvx2, __builtin_cpu_supports("avx2") != 0},
+  {"sse", &SumOfSquaresSse, __builtin_cpu_supports("sse") != 0},
+#elif defined(SIMD_NEON)
+  {"neon", &SumOfSquaresNeon, true},
+#endif
+  {"scalar", &LevelMeter::SumOfSquaresScalar, true},
+});
+
+LevelMeter::LevelMeter() : sum_(0), num_hops_(0) {}
+
+// getter
+size_t LevelMeter::num_hops() const {
+  return num_hops_;
+}
+
+// methods
+void LevelMeter::AddHop(const float* samples, size_t n) {
+  sum_ += HopLevel(samples, n);
+  num_hops_++;
+}
+
+int LevelMeter::TakeAverage() {
+  int average = (num_hops_ > 0) ? sum_/num_hops_ : 0;
+  sum_ = 0;
+  num_hops_ = 0;
+  return average;
+}
+
+int LevelMeter::HopLevel(const float* samples, size_t n, bool scalar) {
+  if (n == 0)
+    return 101;
+  float energy = ((scalar) ? SumOfSquaresScalar(samples, n) : SumOfSquares(samples, n)) / n;
+  float db_spl = 10.0 * std::log10(energy);
+  if (db_spl < LEVEL_SILENCE_THRESHOLD)
+    db_spl = 1;
+  return 100 - (-1 * db_spl);
+}
+
+float LevelMeter::SumOfSquares(const float* samples, size_t n) {
+  return kernel.fn_(samples, n);
+}
+
+float LevelMeter::SumOfSquaresScalar(const float* samples, size_t n) {
+  float res = 0;
+  for (size_t i=0; i<n; i++)
+    res += samples[i]*samples[i];
+  return res;
+}
+
+std::string LevelMeter::Kernel() {
+  return kernel.name_;
+}
@@ -0,0 +1,74 @@
+#ifndef SRC_AUDIO_LEVEL_METER_H_
+#define SRC_AUDIO_LEVEL_METER_H_
+
+#include <cstddef>
+#include <string>
+
+#define LEVEL_SILENCE_THRESHOLD -90.0  ///< dB SPL, quieter hops count as silent.
+
+/**
+ * Computes the level of each analysis hop and averages it until the next
+ * beat, without storing the levels of single hops. A hop's level is
+ * `100 + dB SPL` (101 if below LEVEL_SILENCE_THRESHOLD), the same as
+ * `100 - (-1 * aubio_level_detection(hop, LEVEL_SILENCE_THRESHOLD))`
+ * truncated to int.
+ * The energy of a hop is computed by a SIMD kernel (AVX2 or SSE on x86, NEON
+ * on ARM) selected at runtime, with a scalar fallback.
+ */
+class LevelMeter {
+  public:
+    LevelMeter();
+
+    // getter
+    size_t num_hops() const;
+
+    // methods
+    /**
+     * Adds level of hop to current average.
+     * @param[in] samples (mono)
+     * @param[in] n number of samples.
+     */
+    void AddHop(const float* samples, size_t n);
+
+    /**
+     * Gets average level of all hops added since last call and resets average.
+     * @return average level (0 if no hop was added).
+     */
+    int TakeAverage();
+
+    /**
+     * Gets level of a single hop.
+     * @param[in] samples (mono)
+     * @param[in] n number of samples.
+     * @param[in] scalar if set, always uses scalar kernel.
+     * @return level (100 + dB SPL, or 101 if silent).
+     */
+    static int HopLevel(const float* samples, size_t n, bool scalar=false);
+
+    /**
+     * Computes sum of squares of samples with the fastest available kernel.
+     * @param[in] samples
+     * @param[in] n number of samples.
+     * @return sum of squares.
+     */
+    static float SumOfSquares(const float* samples, size_t n);
+
+    /**
+     * Computes sum of squares of samples in order (same as aubio).
+     * @param[in] samples
+     * @param[in] n number of samples.
+     * @return sum of squares.
+     */
+    static float SumOfSquaresScalar(const float* samples, size_t n);
+
+    /**
+     * Gets name of kernel used by `SumOfSquares` ("avx2", "sse", "neon" or "scalar").
+     */
+    static std::string Kernel();
+
+  private:
+    double sum_;
+    size_t num_hops_;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "audio/audio.h"
+#include "audio/library_analyzer.h"
+#include "spdlog/spdlog.h"
+#include "utils/utils.h"
+
+#define LOGGER "logger"
+
+bool IsAudioFile(const std::filesystem::path& path) {
+  return path.extension() == ".mp3" || path.extension() == ".wav";
+}
+
+LibraryAnalyzer::LibraryAnalyzer(std::string base_path, unsigned int num_threads, AnalysisBackend backend,
+    AnalysisProfile profile, uintmax_t cache_budget) 
+  : base_path_(base_path), num_threads_(num_threads), backend_(backend), profile_(profile), 
+  store_(std::make_shared<AnalysisStore>(base_path, cache_budget)) {
+  if (num_threads_ == 0)
+    num_threads_ = std::max(1u, std::thread::hardware_concurrency());
+}
+
+// getter 
+unsigned int LibraryAnalyzer::num_threads() const {
+  return num_threads_;
+}
+
+std::vector<std::string> LibraryAnalyzer::GetAudioFiles() const {
+  std::vector<std::string> roots;
+  std::vector<std::string> music_paths = utils::LoadJsonFromDisc(base_path_ + "/settings/music_paths.json");
+  for (const auto& it : music_paths)
+    roots.push_back(utils::ResolvePath(it, base_path_));
+  std::vector<std::string> recently_played = utils::LoadJsonFromDisc(base_path_ + "/settings/recently_played.json");
+  roots.insert(roots.end(), recently_played.begin(), recently_played.end());
+
+  // Walk all roots, collecting audio files (set removes duplicates and sorts).
+  std::set<std::string> audio_files;
+  for (const auto& root : roots) {
+    std::error_code ec;
+    if (std::filesystem::is_regular_file(root, ec)) {
+      if (IsAudioFile(root))
+        audio_files.insert(root);
+      continue;
+    }
+    if (!std::filesystem::is_directory(root, ec)) {
+      spdlog::get(LOGGER)->warn("LibraryAnalyzer::GetAudioFiles: skipping invalid path {}", root);
+      continue;
+    }
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::recursive_directory_iterator(root, options, ec); 
+        it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+      if (ec) {
+        spdlog::get(LOGGER)->warn("LibraryAnalyzer::GetAudioFiles: {}", ec.message());
+        break;
+      }
+      if (it->is_regular_file(ec) && IsAudioFile(it->path()))
+        audio_files.insert(it->path().string());
+    }
+  }
+  return std::vector<std::string>(audio_files.begin(), audio_files.end());
+}
+
+std::vector<std::string> LibraryAnalyzer::GetUncachedAudioFiles() const {
+  return GetUncachedAudioFiles(GetAudioFiles());
+}
+
+std::vector<std::string> LibraryAnalyzer::GetUncachedAudioFiles(const std::vector<std::string>& audio_files) const {
+  // Each worker checks (and if not in side index, hashes) the next unchecked file.
+  std::vector<char> cached(audio_files.size(), true);  // not bool: written by several threads.
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    Audio audio(base_path_, store_);
+    audio.set_analysis_backend(backend_);
+    audio.set_analysis_profile(profile_);
+    for (size_t i = next++; i < audio_files.size(); i = next++) {
+      audio.set_source_path(audio_files[i]);
+      if (!audio.IsCached())
+        cached[i] = false;
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned int i=0; i<std::min<size_t>(num_threads_, audio_files.size()); i++)
+    workers.push_back(std::thread(worker));
+  for (auto& it : workers)
+    it.join();
+  std::vector<std::string> uncached;
+  for (size_t i=0; i<audio_files.size(); i++) {
+    if (!cached[i])
+      uncached.push_back(audio_files[i]);
+  }
+  return uncached;
+}
+
+size_t LibraryAnalyzer::Run(bool verbose) {
+  std::filesystem::create_directories(base_path_ + "/data/analysis");
+  std::vector<std::string> audio_files = GetAudioFiles();
+  spdlog::get(LOGGER)->info("LibraryAnalyzer::Run: checking {} files on {} threads", audio_files.size(),
+      num_threads_);
+  if (verbose)
+    std::cout << "Checking " << audio_files.size() << " files on " << num_threads_ << " threads." << std::endl;
+  // Check files in parallel (hashed files are added to side index, so
+  // analysing them does not hash them again).
+  audio_files = GetUncachedAudioFiles(audio_files);
+  // If there are less uncached files than threads, split threads among files
+  // (long files are then analysed in segments).
+  unsigned int threads_per_file = std::max<size_t>(1, num_threads_/std::max<size_t>(1, audio_files.size()));
+  if (verbose)
+    std::cout << "Analysing " << audio_files.size() << " files." << std::endl;
+
+  // Each worker takes the next unprocessed file until all files are taken.
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> analyzed(0);
+  std::mutex mutex_print;
+  auto worker = [&]() {
+    Audio audio(base_path_, store_);
+    audio.set_analysis_threads(threads_per_file);
+    audio.set_analysis_backend(backend_);
+    audio.set_analysis_profile(profile_);
+    for (size_t i = next++; i < audio_files.size(); i = next++) {
+      audio.set_source_path(audio_files[i]);
+      bool success = true;
+      try {
+        audio.Analyze();
+        analyzed++;
+      } catch (const char* e) {
+        success = false;
+        spdlog::get(LOGGER)->error("LibraryAnalyzer::Run: failed analyzing {}: {}", audio_files[i], e);
+      }
+      if (verbose) {
+        std::unique_lock ul(mutex_print);
+        std::cout << "[" << i+1 << "/" << audio_files.size() << "] " << ((success) ? "" : "FAILED: ") 
+          << audio_files[i] << std::endl;
+      }
+    }
+  };
+  std::vector<std::thread> workers;
+  for (unsigned int i=0; i<std::min<size_t>(num_threads_/threads_per_file, audio_files.size()); i++)
+    workers.push_back(std::thread(worker));
+  for (auto& it : workers)
+    it.join();
+  store_->PrunePaths();
+  store_->SafeIndex();
+  aubio_cleanup();
+  spdlog::get(LOGGER)->info("LibraryAnalyzer::Run: analyzed {} files", analyzed.load());
+  return analyzed;
+}
@@ -0,0 +1,71 @@
+#ifndef SRC_AUDIO_LIBRARY_ANALYZER_H_
+#define SRC_AUDIO_LIBRARY_ANALYZER_H_
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "audio/analysis_store.h"
+#include "audio/audio.h"
+
+/**
+ * Analyzes all audio-files of the music library (all paths in
+ * `settings/music_paths.json` and `settings/recently_played.json`) in
+ * parallel, so that no song needs to be analyzed when starting a game.
+ */
+class LibraryAnalyzer {
+  public:
+    /**
+     * Constructor.
+     * @param[in] base_path path to dissonance files (settings, data).
+     * @param[in] num_threads number of worker threads (0: number of cores).
+     * @param[in] backend analysis backend (see Audio::set_analysis_backend).
+     * @param[in] profile analysis profile (see Audio::set_analysis_profile).
+     * @param[in] cache_budget max. size (bytes) of analysis store (see AnalysisStore).
+     */
+    LibraryAnalyzer(std::string base_path, unsigned int num_threads=0, AnalysisBackend backend=BACKEND_AUBIO,
+        AnalysisProfile profile=PROFILE_DEFAULT, uintmax_t cache_budget=ANALYSIS_STORE_BUDGET);
+
+    // getter
+    unsigned int num_threads() const;
+
+    /**
+     * Gets all audio-files (mp3 and wav) in music library, which have not been
+     * analyzed yet.
+     * @return paths to all audio-files not analyzed yet.
+     */
+    std::vector<std::string> GetUncachedAudioFiles() const;
+
+    /**
+     * Analyzes all uncached audio-files. First all files are checked in
+     * parallel (hashing files not in the side index), then each worker runs
+     * it's own audio pipeline on the next uncached file, writing the analysis
+     * to `data/analysis`.
+     * @param[in] verbose if set, prints progress to stdout.
+     * @return number of successfully analyzed files.
+     */
+    size_t Run(bool verbose=false);
+
+  private:
+    const std::string base_path_;
+    unsigned int num_threads_;
+    const AnalysisBackend backend_;
+    const AnalysisProfile profile_;
+    std::shared_ptr<AnalysisStore> store_;  ///< shared by all workers.
+
+    /**
+     * Gets all audio-files (mp3 and wav) in music library.
+     * @return (unique) paths to all audio-files in music library.
+     */
+    std::vector<std::string> GetAudioFiles() const;
+
+    /**
+     * Checks given audio-files in parallel, hashing files not in side index.
+     * @param[in] audio_files
+     * @return paths of given audio-files not analyzed yet (in given order).
+     */
+    std::vector<std::string> GetUncachedAudioFiles(const std::vector<std::string>& audio_files) const;
+};
+
+#endif
@@ -0,0 +1,214 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "audio/pcm_buffer.h"
+#include "spdlog/spdlog.h"
+
+#define LOGGER "logger"
+
+PcmBuffer::PcmBuffer() : channels_(0), samplerate_(0), num_frames_(0), decoded_frames_(0), finished_(false),
+  stop_(false), data_(nullptr), mapping_(nullptr), mapping_size_(0) {}
+
+PcmBuffer::~PcmBuffer() {
+  stop_ = true;
+  if (decode_thread_.joinable())
+    decode_thread_.join();
+  if (mapping_)
+    munmap(mapping_, mapping_size_);
+}
+
+std::shared_ptr<PcmBuffer> PcmBuffer::Decode(std::string source_path, std::string cache_path,
+    unsigned int channels, unsigned int samplerate) {
+  // Always decode to float, keeping channels and samplerate of source unless given.
+  ma_decoder_config config = ma_decoder_config_init(ma_format_f32, channels, samplerate);
+  ma_decoder* decoder = new ma_decoder;
+  if (ma_decoder_init_file(source_path.c_str(), &config, decoder) != MA_SUCCESS) {
+    delete decoder;
+    throw "Could not load audio-source";
+  }
+  std::shared_ptr<PcmBuffer> pcm(new PcmBuffer());
+  pcm->channels_ = decoder->outputChannels;
+  pcm->samplerate_ = decoder->outputSampleRate;
+  pcm->num_frames_ = ma_decoder_get_length_in_pcm_frames(decoder);
+
+  // Length known: preallocate and decode in background.
+  if (pcm->num_frames_ > 0) {
+    pcm->samples_.resize(pcm->num_frames_*pcm->channels_);
+    pcm->data_ = pcm->samples_.data();
+    pcm->decode_thread_ = std::thread([pcm=pcm.get(), decoder, cache_path]() {
+      pcm->DecodeAll(decoder, cache_path);
+    });
+  }
+  // Otherwise decode at once.
+  else {
+    spdlog::get(LOGGER)->info("PcmBuffer::Decode: unknown length of {}, decoding at once.", source_path);
+    pcm->DecodeAll(decoder, cache_path);
+  }
+  return pcm;
+}
+
+std::shared_ptr<PcmBuffer> PcmBuffer::Open(std::string path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1)
+    throw "PcmBuffer: could not open file.";
+  struct stat st;
+  if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(PcmFileHeader)) {
+    close(fd);
+    throw "PcmBuffer: file truncated.";
+  }
+  std::shared_ptr<PcmBuffer> pcm(new PcmBuffer());
+  pcm->mapping_size_ = st.st_size;
+  void* mapping = mmap(nullptr, pcm->mapping_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // mapping stays valid after closing descriptor.
+  if (mapping == MAP_FAILED)
+    throw "PcmBuffer: could not map file.";
+  pcm->mapping_ = mapping;  // unmapped by destructor from here on.
+
+  const PcmFileHeader* header = static_cast<const PcmFileHeader*>(mapping);
+  if (header->magic_ != PCM_FILE_MAGIC)
+    throw "PcmBuffer: not a pcm file.";
+  if (header->version_ != PCM_FILE_VERSION)
+    throw "PcmBuffer: outdated version.";
+  if (header->channels_ == 0 || FileSize(header->num_frames_, header->channels_) != pcm->mapping_size_)
+    throw "PcmBuffer: file truncated.";
+  pcm->channels_ = header->channels_;
+  pcm->samplerate_ = header->samplerate_;
+  pcm->num_frames_ = header->num_frames_;
+  pcm->data_ = reinterpret_cast<const float*>(header+1);
+  pcm->Publish(header->num_frames_, true);
+  return pcm;
+}
+
+// getter
+unsigned int PcmBuffer::channels() const {
+  return channels_;
+}
+
+unsigned int PcmBuffer::samplerate() const {
+  return samplerate_;
+}
+
+size_t PcmBuffer::num_frames() const {
+  return num_frames_;
+}
+
+size_t PcmBuffer::decoded_frames() const {
+  return decoded_frames_.load(std::memory_order_acquire);
+}
+
+bool PcmBuffer::complete() const {
+  return finished_;
+}
+
+double PcmBuffer::duration() const {
+  return (samplerate_ > 0) ? num_frames_*1000.0/samplerate_ : 0;
+}
+
+// methods
+size_t PcmBuffer::WaitFor(size_t frames) const {
+  std::unique_lock ul(mutex_);
+  cv_.wait(ul, [&]() { return finished_ || decoded_frames_ >= frames; });
+  return decoded_frames_;
+}
+
+size_t PcmBuffer::Read(size_t frame, float* out, size_t n) const {
+  size_t decoded = decoded_frames();
+  if (frame >= decoded)
+    return 0;
+  n = std::min(n, decoded-frame);
+  std::memcpy(out, data_+frame*channels_, n*channels_*sizeof(float));
+  return n;
+}
+
+size_t PcmBuffer::ReadMono(size_t frame, float* out, size_t n) const {
+  size_t decoded = WaitFor(frame+n);
+  if (frame >= decoded)
+    return 0;
+  n = std::min(n, decoded-frame);
+  const float* in = data_+frame*channels_;
+  for (size_t i=0; i<n; i++) {
+    float sum = 0;
+    for (unsigned int c=0; c<channels_; c++)
+      sum += in[i*channels_+c];
+    out[i] = sum/channels_;
+  }
+  return n;
+}
+
+void PcmBuffer::Write(std::string path) const {
+  size_t num_frames = WaitFor(num_frames_);
+  PcmFileHeader header = {PCM_FILE_MAGIC, PCM_FILE_VERSION, channels_, samplerate_, num_frames};
+
+  // Write to temporary file, then move to final destination.
+  std::string tmp_path = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  std::ofstream write(tmp_path, std::ios::binary);
+  if (!write) {
+    spdlog::get(LOGGER)->error("PcmBuffer::Write: Could not safe at {}", path);
+    return;
+  }
+  write.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  write.write(reinterpret_cast<const char*>(data_), num_frames*channels_*sizeof(float));
+  write.close();
+  if (!write || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+    spdlog::get(LOGGER)->error("PcmBuffer::Write: Could not safe at {}", path);
+    std::remove(tmp_path.c_str());
+  }
+}
+
+size_t PcmBuffer::FileSize(size_t num_frames, unsigned int channels) {
+  return sizeof(PcmFileHeader) + num_frames*channels*sizeof(float);
+}
+
+void PcmBuffer::DecodeAll(ma_decoder* decoder, std::string cache_path) {
+  bool preallocated = num_frames_ > 0;
+  size_t decoded = 0;
+  while (!stop_) {
+    size_t chunk = PCM_DECODE_CHUNK;
+    if (preallocated)
+      chunk = std::min(chunk, num_frames_-decoded);
+    else
+      samples_.resize((decoded+chunk)*channels_);
+    if (chunk == 0)
+      break;
+    size_t read = ma_decoder_read_pcm_frames(decoder, &samples_[decoded*channels_], chunk);
+    decoded += read;
+    if (read < chunk)
+      break;
+    if (preallocated)
+      Publish(decoded, false);
+  }
+  ma_decoder_uninit(decoder);
+  delete decoder;
+
+  if (!preallocated) {
+    samples_.resize(decoded*channels_);
+    data_ = samples_.data();
+  }
+  num_frames_ = decoded;
+  Publish(decoded, true);
+  spdlog::get(LOGGER)->debug("PcmBuffer::DecodeAll: decoded {} frames.", decoded);
+
+  if (cache_path != "" && !stop_)
+    Write(cache_path);
+}
+
+void PcmBuffer::Publish(size_t frames, bool finished) {
+  {
+    std::unique_lock ul(mutex_);
+    decoded_frames_.store(frames, std::memory_order_release);
+    finished_ = finished;
+  }
+  cv_.notify_all();
+}
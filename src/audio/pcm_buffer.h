@@ -0,0 +1,159 @@
+#ifndef SRC_AUDIO_PCM_BUFFER_H_
+#define SRC_AUDIO_PCM_BUFFER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "miniaudio.h"
+
+#define PCM_FILE_MAGIC 0x4d435044  // "DPCM"
+#define PCM_FILE_VERSION 1
+#define PCM_FILE_EXTENSION ".dpcm"
+#define PCM_DECODE_CHUNK 4096  ///< frames decoded before readers are notified.
+
+/**
+ * Fixed size header at the beginning of each pcm cache file, followed by all
+ * frames as interleaved float samples.
+ */
+struct PcmFileHeader {
+  uint32_t magic_;
+  uint32_t version_;
+  uint32_t channels_;
+  uint32_t samplerate_;
+  uint64_t num_frames_;
+};
+
+/**
+ * Decoded audio (interleaved float samples at the source's samplerate), so a
+ * song is decoded only once and shared by analysis and playback.
+ * A buffer is either decoded progressively in a background thread (readers
+ * wait for the frames they need, see `WaitFor`) or memory-mapped from a pcm
+ * cache file, in which case it is complete at once.
+ */
+class PcmBuffer {
+  public:
+    ~PcmBuffer();
+
+    PcmBuffer(const PcmBuffer&) = delete;
+    PcmBuffer& operator=(const PcmBuffer&) = delete;
+
+    /**
+     * Starts decoding audio file in background. Throws if file cannot be
+     * decoded.
+     * @param[in] source_path
+     * @param[in] cache_path if set, buffer is written to this path once
+     * decoding is complete (see `Open`).
+     * @param[in] channels channels to convert to (0: keep source's).
+     * @param[in] samplerate samplerate to resample to (0: keep source's).
+     * @return buffer, filled while decoding.
+     */
+    static std::shared_ptr<PcmBuffer> Decode(std::string source_path, std::string cache_path="",
+        unsigned int channels=0, unsigned int samplerate=0);
+
+    /**
+     * Maps pcm cache file. Throws if file is missing, truncated or has an
+     * outdated version.
+     * @param[in] path
+     * @return complete buffer.
+     */
+    static std::shared_ptr<PcmBuffer> Open(std::string path);
+
+    // getter
+    unsigned int channels() const;
+    unsigned int samplerate() const;
+
+    /**
+     * Gets number of frames (expected number, while still decoding).
+     */
+    size_t num_frames() const;
+    size_t decoded_frames() const;
+    bool complete() const;
+
+    /**
+     * Gets duration in milliseconds (expected duration, while still decoding).
+     */
+    double duration() const;
+
+    // methods
+    /**
+     * Blocks until given number of frames is decoded or decoding finished.
+     * @param[in] frames
+     * @return number of decoded frames.
+     */
+    size_t WaitFor(size_t frames) const;
+
+    /**
+     * Copies decoded frames (interleaved), without waiting for decoder.
+     * @param[in] frame first frame to read.
+     * @param[out] out buffer for n*channels() samples.
+     * @param[in] n number of frames.
+     * @return number of frames copied.
+     */
+    size_t Read(size_t frame, float* out, size_t n) const;
+
+    /**
+     * Reads frames downmixed to mono (average of all channels), waiting for
+     * decoder if required.
+     * @param[in] frame first frame to read.
+     * @param[out] out buffer for n samples.
+     * @param[in] n number of frames.
+     * @return number of frames read (less than n only at end of audio).
+     */
+    size_t ReadMono(size_t frame, float* out, size_t n) const;
+
+    /**
+     * Writes buffer as pcm cache file (waits until decoding is complete).
+     * File is written to a temporary file first and then renamed.
+     * @param[in] path
+     */
+    void Write(std::string path) const;
+
+    /**
+     * Gets the total size of a pcm cache file.
+     * @param[in] num_frames
+     * @param[in] channels
+     * @return size of pcm cache file in bytes.
+     */
+    static size_t FileSize(size_t num_frames, unsigned int channels);
+
+  private:
+    unsigned int channels_;
+    unsigned int samplerate_;
+    std::atomic<size_t> num_frames_;
+    std::atomic<size_t> decoded_frames_;
+    std::atomic<bool> finished_;
+    std::atomic<bool> stop_;
+    std::vector<float> samples_;  ///< decoded samples (empty if mapped).
+    const float* data_;  ///< decoded or mapped samples.
+    void* mapping_;
+    size_t mapping_size_;
+    std::thread decode_thread_;
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cv_;
+
+    PcmBuffer();
+
+    /**
+     * Decodes all frames and writes cache file if set. Runs as thread if
+     * length is known (buffer preallocated), otherwise buffer grows while
+     * decoding and no reader may access it before decoding is finished.
+     * @param[in] decoder opened decoder (deleted when done).
+     * @param[in] cache_path
+     */
+    void DecodeAll(ma_decoder* decoder, std::string cache_path);
+
+    /**
+     * Marks given number of frames as decoded and notifies readers.
+     * @param[in] frames
+     * @param[in] finished whether decoding is finished.
+     */
+    void Publish(size_t frames, bool finished);
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+#include "audio/pcm_stream.h"
+
+size_t PcmStreamFormat::frame_size() const {
+  return channels_ * ((sample_format_ == PCM_S16) ? sizeof(int16_t) : sizeof(float));
+}
+
+PcmSampleFormat PcmStreamFormat::ParseSampleFormat(std::string name) {
+  if (name == "f32")
+    return PCM_F32;
+  if (name == "s16")
+    return PCM_S16;
+  throw "PcmStream: unknown sample format.";
+}
+
+PcmStream::PcmStream(std::string path, PcmStreamFormat format) : fd_(-1), close_fd_(path != "-"),
+  format_(format), frames_read_(0) {
+  if (format_.channels_ == 0 || format_.samplerate_ == 0)
+    throw "PcmStream: invalid format.";
+  fd_ = (close_fd_) ? open(path.c_str(), O_RDONLY) : STDIN_FILENO;
+  if (fd_ == -1)
+    throw "PcmStream: could not open stream.";
+}
+
+PcmStream::~PcmStream() {
+  if (close_fd_)
+    close(fd_);
+}
+
+// getter
+const PcmStreamFormat& PcmStream::format() const {
+  return format_;
+}
+
+size_t PcmStream::frames_read() const {
+  return frames_read_;
+}
+
+// methods
+size_t PcmStream::ReadMono(float* out, size_t n) {
+  // Read until all bytes are available (pipes return partial reads) or writer closed stream.
+  size_t frame_size = format_.frame_size();
+  bytes_.resize(n*frame_size);
+  size_t len = 0;
+  while (len < bytes_.size()) {
+    ssize_t res = read(fd_, bytes_.data()+len, bytes_.size()-len);
+    if (res == -1 && errno == EINTR)
+      continue;
+    if (res <= 0)
+      break;
+    len += res;
+  }
+
+  // Downmix complete frames (an incomplete frame at the end of the stream is dropped).
+  n = len/frame_size;
+  unsigned int channels = format_.channels_;
+  for (size_t i=0; i<n; i++) {
+    float sum = 0;
+    for (unsigned int c=0; c<channels; c++) {
+      if (format_.sample_format_ == PCM_S16) {
+        int16_t sample;
+        std::memcpy(&sample, &bytes_[(i*channels+c)*sizeof(int16_t)], sizeof(sample));
+        sum += sample/32768.0f;
+      }
+      else {
+        float sample;
+        std::memcpy(&sample, &bytes_[(i*channels+c)*sizeof(float)], sizeof(sample));
+        sum += sample;
+      }
+    }
+    out[i] = sum/channels;
+  }
+  frames_read_ += n;
+  return n;
+}
@@ -0,0 +1,74 @@
+#ifndef SRC_AUDIO_PCM_STREAM_H_
+#define SRC_AUDIO_PCM_STREAM_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+enum PcmSampleFormat {
+  PCM_F32 = 0,  ///< 32 bit float (native byte order)
+  PCM_S16 = 1,  ///< 16 bit signed integer (native byte order)
+};
+
+/**
+ * Format of raw (headerless, interleaved) pcm stream.
+ */
+struct PcmStreamFormat {
+  PcmSampleFormat sample_format_;
+  unsigned int samplerate_;
+  unsigned int channels_;
+
+  /**
+   * Gets size of one frame (one sample of each channel).
+   * @return size in bytes.
+   */
+  size_t frame_size() const;
+
+  /**
+   * Parses sample format.
+   * @param[in] name "f32" or "s16"
+   * @return sample format, throws on unknown name.
+   */
+  static PcmSampleFormat ParseSampleFormat(std::string name);
+};
+
+/**
+ * Reads raw pcm from stdin, a named pipe (FIFO) or any other (not
+ * necessarily seekable) file, holding no more than one read in memory.
+ */
+class PcmStream {
+  public:
+    /**
+     * Opens stream. Throws if stream cannot be opened.
+     * @param[in] path path of FIFO or file, "-" for stdin.
+     * @param[in] format
+     */
+    PcmStream(std::string path, PcmStreamFormat format);
+    ~PcmStream();
+
+    PcmStream(const PcmStream&) = delete;
+    PcmStream& operator=(const PcmStream&) = delete;
+
+    // getter
+    const PcmStreamFormat& format() const;
+    size_t frames_read() const;
+
+    // methods
+    /**
+     * Reads frames downmixed to mono (average of all channels), blocking until
+     * frames are available or stream is closed by writer.
+     * @param[out] out buffer for n samples.
+     * @param[in] n number of frames.
+     * @return number of frames read (less than n only at end of stream).
+     */
+    size_t ReadMono(float* out, size_t n);
+
+  private:
+    int fd_;
+    const bool close_fd_;  ///< false for stdin.
+    const PcmStreamFormat format_;
+    std::vector<char> bytes_;  ///< raw bytes of current read.
+    size_t frames_read_;
+};
+
+#endif
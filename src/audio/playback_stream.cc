@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "audio/playback_stream.h"
+#include "spdlog/spdlog.h"
+
+#define LOGGER "logger"
+
+PlaybackStream::PlaybackStream(std::shared_ptr<PcmBuffer> pcm, size_t ring_frames) : pcm_(pcm),
+  channels_(pcm->channels()), samplerate_(pcm->samplerate()), ring_(ring_frames*pcm->channels()), 
+  stop_(false), pause_(false), fed_all_(false), queued_(false), played_frames_(0), latency_frames_(0), underruns_(0), 
+  overruns_(0), gain_(1), fed_frames_(0), start_frame_(0), fade_start_(0), fade_end_(0) {}
+
+PlaybackStream::~PlaybackStream() {
+  Stop();
+}
+
+// getter
+unsigned int PlaybackStream::channels() const {
+  return channels_;
+}
+
+unsigned int PlaybackStream::samplerate() const {
+  return samplerate_;
+}
+
+size_t PlaybackStream::buffered() const {
+  return ring_.size()/channels_;
+}
+
+size_t PlaybackStream::played_frames() const {
+  return played_frames_;
+}
+
+double PlaybackStream::position() const {
+  size_t played = played_frames_.load(std::memory_order_relaxed);
+  size_t latency = latency_frames_.load(std::memory_order_relaxed);
+  return (played > latency) ? (played-latency)*1000.0/samplerate_ : 0;
+}
+
+size_t PlaybackStream::underruns() const {
+  return underruns_;
+}
+
+size_t PlaybackStream::overruns() const {
+  return overruns_;
+}
+
+bool PlaybackStream::paused() const {
+  return pause_;
+}
+
+bool PlaybackStream::finished() const {
+  return fed_all_ && ring_.size() == 0;
+}
+
+bool PlaybackStream::queued() const {
+  return queued_;
+}
+
+// setter
+void PlaybackStream::set_latency(size_t latency_frames) {
+  latency_frames_ = latency_frames;
+}
+
+// methods
+void PlaybackStream::Start() {
+  if (feeder_.joinable())
+    return;
+  stop_ = false;
+  feeder_ = std::thread([this]() { Feed(); });
+}
+
+void PlaybackStream::Stop() {
+  stop_ = true;
+  if (feeder_.joinable())
+    feeder_.join();
+}
+
+void PlaybackStream::Pause() {
+  pause_ = true;
+}
+
+void PlaybackStream::Unpause() {
+  pause_ = false;
+}
+
+size_t PlaybackStream::Queue(std::shared_ptr<PcmBuffer> next, size_t crossfade_frames) {
+  if (next->channels() != channels_ || next->samplerate() != samplerate_)
+    throw "PlaybackStream: queued audio has different format.";
+  std::unique_lock ul(mutex_);
+  next_ = next;
+  queued_ = true;
+  fade_end_ = std::max(pcm_->num_frames(), fed_frames_);
+  fade_start_ = std::max(fade_end_-std::min(crossfade_frames, fade_end_), fed_frames_);
+  spdlog::get(LOGGER)->debug("PlaybackStream::Queue: crossfading {} frames at {}", fade_end_-fade_start_, 
+      start_frame_+fade_start_);
+  return start_frame_+fade_start_;
+}
+
+size_t PlaybackStream::Render(float* out, size_t frames) {
+  bool pause = pause_.load(std::memory_order_relaxed);
+  // Faded out: render silence without consuming ring.
+  if (pause && gain_ <= 0) {
+    std::fill(out, out+frames*channels_, 0.0f);
+    return 0;
+  }
+
+  // Ring only holds complete frames.
+  size_t n = ring_.Pop(out, frames*channels_)/channels_;
+  if (n < frames) {
+    std::fill(out+n*channels_, out+frames*channels_, 0.0f);
+    if (frames*channels_ > ring_.capacity())
+      overruns_.fetch_add(1, std::memory_order_relaxed);
+    else if (!fed_all_.load(std::memory_order_relaxed))
+      underruns_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Fade towards target gain, frame by frame.
+  float target = (pause) ? 0.0f : 1.0f;
+  if (gain_ != target) {
+    float step = (pause) ? -1.0f/PLAYBACK_FADE_FRAMES : 1.0f/PLAYBACK_FADE_FRAMES;
+    for (size_t i=0; i<n; i++) {
+      gain_ = std::max(0.0f, std::min(1.0f, gain_+step));
+      for (unsigned int c=0; c<channels_; c++)
+        out[i*channels_+c] *= gain_;
+    }
+  }
+  played_frames_.fetch_add(n, std::memory_order_relaxed);
+  return n;
+}
+
+void PlaybackStream::Feed() {
+  std::vector<float> chunk(PLAYBACK_FEED_FRAMES*channels_);
+  std::vector<float> next_chunk(PLAYBACK_FEED_FRAMES*channels_);
+  while (!stop_) {
+    bool fed = false;
+    {
+      std::unique_lock ul(mutex_);
+      fed = FeedChunk(chunk.data(), next_chunk.data());
+    }
+    // Ring full, decoder behind or waiting for queued audio.
+    if (!fed)
+      std::this_thread::sleep_for(std::chrono::milliseconds(PLAYBACK_FEED_INTERVAL));
+  }
+  spdlog::get(LOGGER)->debug("PlaybackStream::Feed: fed {} frames, {} underruns, {} overruns", 
+      start_frame_+fed_frames_, underruns_, overruns_);
+}
+
+bool PlaybackStream::FeedChunk(float* chunk, float* next_chunk) {
+  size_t n = std::min(ring_.free()/channels_, static_cast<size_t>(PLAYBACK_FEED_FRAMES));
+  if (n == 0)
+    return false;
+  bool complete = pcm_->complete() && fed_frames_ >= pcm_->decoded_frames();
+
+  // Switch to queued audio (frames crossfaded already are skipped).
+  if (next_ && complete) {
+    size_t start = std::min(fade_start_, fed_frames_);
+    start_frame_ += start;
+    fed_frames_ -= start;
+    pcm_ = std::move(next_);
+    fed_all_ = false;
+    queued_ = false;
+    return true;
+  }
+
+  // Crossfade: mix current audio (fading out) with queued audio (fading in).
+  if (next_ && fed_frames_ >= fade_start_) {
+    size_t next_frame = fed_frames_-fade_start_;
+    size_t read_next = next_->Read(next_frame, next_chunk, n);
+    size_t read = pcm_->Read(fed_frames_, chunk, read_next);
+    // Current audio is only shorter than expected, if it's decoder is finished.
+    if (read < read_next && !pcm_->complete())
+      read_next = read;
+    if (read_next == 0)
+      return false;
+    double fade_frames = fade_end_-fade_start_;
+    for (size_t i=0; i<read_next; i++) {
+      float gain = (fade_frames > 0) ? std::min(1.0, (next_frame+i+1)/fade_frames) : 1.0f;
+      for (unsigned int c=0; c<channels_; c++) {
+        float cur = (i < read) ? chunk[i*channels_+c] : 0.0f;
+        next_chunk[i*channels_+c] = cur*(1-gain) + next_chunk[i*channels_+c]*gain;
+      }
+    }
+    ring_.Push(next_chunk, read_next*channels_);
+    fed_frames_ += read_next;
+    return true;
+  }
+
+  // Feed current audio (up to crossfade, if audio is queued).
+  if (next_)
+    n = std::min(n, fade_start_-fed_frames_);
+  size_t read = pcm_->Read(fed_frames_, chunk, n);
+  if (read > 0) {
+    ring_.Push(chunk, read*channels_);
+    fed_frames_ += read;
+    return true;
+  }
+  if (complete)
+    fed_all_ = true;
+  return false;
+}
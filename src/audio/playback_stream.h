@@ -0,0 +1,169 @@
+#ifndef SRC_AUDIO_PLAYBACK_STREAM_H_
+#define SRC_AUDIO_PLAYBACK_STREAM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "audio/pcm_buffer.h"
+#include "audio/ring_buffer.h"
+
+#define PLAYBACK_RING_FRAMES 16384  ///< frames buffered ahead of device (~370ms at 44.1kHz).
+#define PLAYBACK_FEED_FRAMES 1024  ///< max. frames copied into ring at once.
+#define PLAYBACK_FEED_INTERVAL 2  ///< ms feeder sleeps if ring is full or decoder is behind.
+#define PLAYBACK_FADE_FRAMES 1024  ///< frames to fade out (in) on pause (unpause).
+#define PLAYBACK_CROSSFADE 3000  ///< ms crossfaded between queued songs (see `Queue`).
+
+/**
+ * Feeds decoded audio to the playback device. A feeder thread copies frames
+ * from the pcm buffer (waiting for the decoder, faulting in mapped pages)
+ * into a lock-free ring buffer, so the device callback (`Render`) only does
+ * a wait-free copy from the ring and never blocks.
+ * Further audio can be queued, which is crossfaded into once the current
+ * audio ends, so songs are played gaplessly.
+ */
+class PlaybackStream {
+  public:
+    /**
+     * Constructor.
+     * @param[in] pcm decoded audio (possibly still decoding).
+     * @param[in] ring_frames number of frames buffered ahead of device.
+     */
+    PlaybackStream(std::shared_ptr<PcmBuffer> pcm, size_t ring_frames=PLAYBACK_RING_FRAMES);
+
+    /**
+     * Destructor stopping feeder.
+     */
+    ~PlaybackStream();
+
+    // getter
+    unsigned int channels() const;
+    unsigned int samplerate() const;
+
+    /**
+     * Gets number of frames buffered in ring.
+     */
+    size_t buffered() const;
+    size_t played_frames() const;
+
+    /**
+     * Gets playback position: frames rendered minus frames still buffered by
+     * the device (monotonic, stops while paused or on underruns).
+     * @return position in milliseconds.
+     */
+    double position() const;
+
+    /**
+     * Gets number of callbacks which could not be served completely although
+     * audio was not finished (output padded with silence).
+     */
+    size_t underruns() const;
+
+    /**
+     * Gets number of callbacks requesting more frames than the ring holds
+     * (ring too small for device period, output padded with silence).
+     */
+    size_t overruns() const;
+    bool paused() const;
+
+    /**
+     * Checks whether all frames (of current and queued audio) have been played.
+     */
+    bool finished() const;
+
+    /**
+     * Checks whether queued audio is waiting to be switched to (see `Queue`).
+     */
+    bool queued() const;
+
+    // setter
+    /**
+     * Sets latency of device (frames rendered, but not heard yet).
+     * @param[in] latency_frames
+     */
+    void set_latency(size_t latency_frames);
+
+    // methods
+    /**
+     * Starts feeder thread.
+     */
+    void Start();
+
+    /**
+     * Stops feeder thread (frames already in ring can still be rendered).
+     */
+    void Stop();
+
+    /**
+     * Fades out at the ring head, then renders silence without consuming
+     * the ring.
+     */
+    void Pause();
+
+    /**
+     * Fades in from where playback was paused.
+     */
+    void Unpause();
+
+    /**
+     * Queues audio to play once current audio ends (replacing audio queued
+     * before, so wait until `queued()` is false to play several). The last
+     * frames of the current audio are crossfaded with the first frames of the
+     * queued audio. Throws if channels or samplerate differ from current
+     * audio.
+     * @param[in] next decoded audio (possibly still decoding).
+     * @param[in] crossfade_frames (shortened to the frames of the current audio
+     * not fed to the ring yet).
+     * @return frame (counted from start of playback) queued audio starts at.
+     */
+    size_t Queue(std::shared_ptr<PcmBuffer> next, size_t crossfade_frames);
+
+    /**
+     * Renders frames for device (real-time safe: wait-free, no allocation).
+     * Only one thread may render.
+     * @param[out] out interleaved output for frames*channels() samples.
+     * @param[in] frames
+     * @return number of frames taken from ring.
+     */
+    size_t Render(float* out, size_t frames);
+
+  private:
+    std::shared_ptr<PcmBuffer> pcm_;  ///< audio currently fed.
+    std::shared_ptr<PcmBuffer> next_;  ///< queued audio (may be empty).
+    const unsigned int channels_;
+    const unsigned int samplerate_;
+    RingBuffer<float> ring_;
+    std::thread feeder_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> pause_;
+    std::atomic<bool> fed_all_;  ///< all frames of pcm buffer are in ring.
+    std::atomic<bool> queued_;  ///< queued audio not switched to yet.
+    std::atomic<size_t> played_frames_;
+    std::atomic<size_t> latency_frames_;
+    std::atomic<size_t> underruns_;
+    std::atomic<size_t> overruns_;
+    float gain_;  ///< current gain of fade (only accessed by rendering thread).
+    size_t fed_frames_;  ///< frames of current audio fed to ring.
+    size_t start_frame_;  ///< frame (counted from start of playback) current audio started at.
+    size_t fade_start_;  ///< frame of current audio crossfade starts at.
+    size_t fade_end_;  ///< frame of current audio crossfade ends at.
+    std::mutex mutex_;  ///< locks current and queued audio (not locked by `Render`).
+
+    /**
+     * Copies frames from pcm buffer into ring (runs as thread).
+     */
+    void Feed();
+
+    /**
+     * Copies one chunk into ring, crossfading into or switching to queued
+     * audio. Expects mutex to be locked.
+     * @param[out] chunk buffer for PLAYBACK_FEED_FRAMES frames.
+     * @param[out] next_chunk buffer for PLAYBACK_FEED_FRAMES frames.
+     * @return false if nothing could be fed (ring full, decoder behind or
+     * all audio fed).
+     */
+    bool FeedChunk(float* chunk, float* next_chunk);
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SRC_AUDIO_RING_BUFFER_H_
+#define SRC_AUDIO_RING_BUFFER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * Lock-free single-producer/single-consumer ring buffer. Push and Pop are
+ * wait-free: they never block, but transfer as many elements as fit or are
+ * available. Exactly one thread may push and exactly one thread may pop.
+ */
+template<class T>
+class RingBuffer {
+  public:
+    /**
+     * Constructor.
+     * @param[in] capacity min. number of elements (rounded up to a power of two).
+     */
+    RingBuffer(size_t capacity) : head_(0), tail_(0) {
+      size_t size = 1;
+      while (size < capacity)
+        size *= 2;
+      buffer_.resize(size);
+      mask_ = size-1;
+    }
+
+    // getter
+    size_t capacity() const { return buffer_.size(); }
+
+    /**
+     * Gets number of elements available to pop (exact only for consumer).
+     */
+    size_t size() const {
+      return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Gets number of elements which can be pushed (exact only for producer).
+     */
+    size_t free() const {
+      return capacity() - size();
+    }
+
+    // methods
+    /**
+     * Pushes elements (producer only).
+     * @param[in] data
+     * @param[in] n number of elements.
+     * @return number of elements pushed (less than n if buffer is full).
+     */
+    size_t Push(const T* data, size_t n) {
+      size_t head = head_.load(std::memory_order_relaxed);
+      size_t tail = tail_.load(std::memory_order_acquire);
+      n = std::min(n, capacity() - (head-tail));
+      for (size_t i=0; i<n; i++)
+        buffer_[(head+i) & mask_] = data[i];
+      head_.store(head+n, std::memory_order_release);
+      return n;
+    }
+
+    /**
+     * Pops elements (consumer only).
+     * @param[out] out
+     * @param[in] n max. number of elements.
+     * @return number of elements popped (less than n if buffer is empty).
+     */
+    size_t Pop(T* out, size_t n) {
+      size_t tail = tail_.load(std::memory_order_relaxed);
+      size_t head = head_.load(std::memory_order_acquire);
+      n = std::min(n, head-tail);
+      for (size_t i=0; i<n; i++)
+        out[i] = buffer_[(tail+i) & mask_];
+      tail_.store(tail+n, std::memory_order_release);
+      return n;
+    }
+
+  private:
+    std::vector<T> buffer_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_;  ///< next write position (only written by producer).
+    alignas(64) std::atomic<size_t> tail_;  ///< next read position (only written by consumer).
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef SRC_AUDIO_SIMD_H_
+#define SRC_AUDIO_SIMD_H_
+
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_NEON
+#endif
+
+/**
+ * Helpers shared by the SIMD kernels of the analysis (see LevelMeter and
+ * Decimator): runtime selection of the fastest kernel supported by the cpu
+ * and horizontal sums of vector registers. Kernels themselves are defined
+ * in the translation unit using them, only for the architecture compiled for
+ * (SIMD_X86 or SIMD_NEON).
+ */
+namespace simd {
+
+/**
+ * Kernel (function pointer) with name, as reported by `Kernel()` of the
+ * class using it.
+ */
+template <typename Fn>
+struct Kernel {
+  const char* name_;
+  Fn fn_;
+  bool supported_;  ///< cpu supports instructions used by kernel.
+};
+
+/**
+ * Selects fastest kernel supported by cpu. Call once (f.e. to initialize a
+ * static) as checking cpu features is not free.
+ * @param[in] kernels ordered fastest first, last one must always be supported
+ * (scalar fallback).
+ * @return selected kernel.
+ */
+template <typename Fn>
+Kernel<Fn> Select(std::initializer_list<Kernel<Fn>> kernels) {
+  for (const auto& it : kernels) {
+    if (it.supported_)
+      return it;
+  }
+  return *(kernels.end()-1);
+}
+
+#if defined(SIMD_X86)
+/**
+ * Sums lanes in order (same rounding as adding lanes one by one).
+ */
+__attribute__((target("avx")))
+inline float Sum(__m256 v) {
+  float lanes[8];
+  _mm256_storeu_ps(lanes, v);
+  float res = 0;
+  for (const auto& it : lanes)
+    res += it;
+  return res;
+}
+
+__attribute__((target("sse")))
+inline float Sum(__m128 v) {
+  float lanes[4];
+  _mm_storeu_ps(lanes, v);
+  float res = 0;
+  for (const auto& it : lanes)
+    res += it;
+  return res;
+}
+#elif defined(SIMD_NEON)
+inline float Sum(float32x4_t v) {
+  float lanes[4];
+  vst1q_f32(lanes, v);
+  float res = 0;
+  for (const auto& it : lanes)
+    res += it;
+  return res;
+}
+#endif
+
+}  // namespace simd
+
+#endif
@@ -0,0 +1,32 @@
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+#include "audio/versioned_timeline.h"
+
+VersionedTimeline::VersionedTimeline() : timeline_(std::make_shared<BeatTimeline>()), version_(0) {}
+
+// getter
+size_t VersionedTimeline::version() const {
+  return version_;
+}
+
+std::shared_ptr<const BeatTimeline> VersionedTimeline::Get() const {
+  std::unique_lock ul(mutex_);
+  return timeline_;
+}
+
+std::shared_ptr<const BeatTimeline> VersionedTimeline::Get(size_t& version) const {
+  std::unique_lock ul(mutex_);
+  version = version_;
+  return timeline_;
+}
+
+// methods
+void VersionedTimeline::Swap(std::shared_ptr<const BeatTimeline> timeline) {
+  std::shared_ptr<const BeatTimeline> previous;  // released outside lock.
+  std::unique_lock ul(mutex_);
+  previous = timeline_;
+  timeline_ = timeline;
+  version_++;
+}
@@ -0,0 +1,54 @@
+#ifndef SRC_AUDIO_VERSIONED_TIMELINE_H_
+#define SRC_AUDIO_VERSIONED_TIMELINE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+
+#include "audio/beat_timeline.h"
+
+/**
+ * Versioned reference to the timeline currently played. The analysis swaps
+ * in a new timeline (new song, or refined analysis replacing a coarse one)
+ * while consumers are reading: each consumer holds a snapshot, which stays
+ * valid until released, and re-acquires a snapshot once the version changed.
+ * Checking the version is lock-free.
+ */
+class VersionedTimeline {
+  public:
+    VersionedTimeline();
+
+    // getter
+    /**
+     * Gets version, increased with every swap.
+     */
+    size_t version() const;
+
+    /**
+     * Gets snapshot of current timeline.
+     */
+    std::shared_ptr<const BeatTimeline> Get() const;
+
+    /**
+     * Gets snapshot of current timeline and it's version (consistent).
+     * @param[out] version
+     * @return snapshot of current timeline.
+     */
+    std::shared_ptr<const BeatTimeline> Get(size_t& version) const;
+
+    // methods
+    /**
+     * Replaces current timeline. Consumers holding a snapshot of the previous
+     * timeline keep reading it until re-acquiring.
+     * @param[in] timeline
+     */
+    void Swap(std::shared_ptr<const BeatTimeline> timeline);
+
+  private:
+    std::shared_ptr<const BeatTimeline> timeline_;
+    std::atomic<size_t> version_;
+    mutable std::mutex mutex_;
+};
+
+#endif
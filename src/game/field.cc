@@ -1,11 +1,14 @@
+#include <algorithm>
 #include <cctype>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstdlib>
 #include <curses.h>
 #include <exception>
 #include <iostream>
 #include <locale>
+#include <map>
 #include <mutex>
 #include <shared_mutex>
 #include <stdexcept>
@@ -110,7 +113,8 @@ std::map<int, position_t> Field::AddResources(position_t start_pos) {
 }
 
 void Field::BuildGraph(position_t player_den, position_t enemy_den) {
-  // Add all nodes.
+  // Add all nodes (edges to neighbors are implicit).
+  graph_ = Graph(lines_, cols_);
   for (int l=0; l<lines_; l++) {
     for (int c=0; c<cols_; c++) {
       if (field_[l][c] != SYMBOL_HILL)
@@ -118,40 +122,59 @@ void Field::BuildGraph(position_t player_den, position_t enemy_den) {
     }
   }
 
-  // For each node, add edges.
-  for (auto node : graph_.nodes()) {
-    std::vector<position_t> neighbors = GetAllInRange({node.second->line_, node.second->col_}, 1.5, 1);
-    for (const auto& pos : neighbors) {
-      if (InField(pos) && field_[pos.first][pos.second] != SYMBOL_HILL && graph_.InGraph(pos))
-      graph_.AddEdge(node.second, graph_.nodes().at(pos));
-    }
-  }
-
   // Remove all nodes not in main circle
   graph_.RemoveInvalid(player_den);
-  if (graph_.nodes().count(enemy_den) == 0)
+  if (!graph_.InGraph(enemy_den))
     throw std::logic_error("Invalid world.");
 }
 
 void Field::AddHills(RandomGenerator* gen_1, RandomGenerator* gen_2, unsigned short denceness) {
   spdlog::get(LOGGER)->debug("Field::AddHills: denceness={}", denceness);
 
+  // Draw mountains for all cells at once, then levels of all mountains (in
+  // the same order as drawing cell by cell).
+  std::vector<uint8_t> mountains(lines_*cols_);
+  gen_1->FillBooleans(mountains.data(), mountains.size());
+  std::vector<int> levels(std::count(mountains.begin(), mountains.end(), 1));
+  gen_2->FillInts(levels.data(), levels.size(), 0, 5);
+
+  // Mark mountains and hills around them in bitset (incl. last line and col,
+  // see InField).
+  std::vector<bool> hills((lines_+1)*(cols_+1), false);
+  std::map<int, std::vector<position_t>> offsets;  // per range: hills around mountain.
+  size_t num_mountains = 0;
   for (int l=0; l<lines_; l++) {
     for (int c=0; c<cols_; c++) {
-      if (gen_1->RandomInt(0, 1) == 1) {
-        spdlog::get(LOGGER)->info("Creating muntain");
-        field_[l][c] = SYMBOL_HILL;
-        int level = gen_2->RandomInt(0, 5)-999;
-        if (level < 1)
-          continue;
-        spdlog::get(LOGGER)->info("Creating {} hills", level);
-        auto positions = GetAllInRange({l, c}, level - denceness, 1);
-        for (const auto& pos : positions)
-          field_[pos.first][pos.second] = SYMBOL_HILL;
+      if (mountains[l*cols_+c] != 1)
+        continue;
+      hills[l*(cols_+1)+c] = true;
+      int level = levels[num_mountains++]-999;
+      if (level < 1)
+        continue;
+      int range = level - denceness;
+      if (offsets.count(range) == 0) {
+        for (int i=-range; i<=range; i++) {
+          for (int j=-range; j<=range; j++) {
+            if (utils::InRange({0, 0}, {i, j}, 1, range))
+              offsets[range].push_back({i, j});
+          }
+        }
+      }
+      for (const auto& it : offsets[range]) {
+        position_t pos = {l+it.first, c+it.second};
+        if (InField(pos))
+          hills[pos.first*(cols_+1)+pos.second] = true;
       }
     }
   }
-  spdlog::get(LOGGER)->debug("Field::AddHills: done");
+
+  for (int l=0; l<=lines_; l++) {
+    for (int c=0; c<=cols_; c++) {
+      if (hills[l*(cols_+1)+c])
+        field_[l][c] = SYMBOL_HILL;
+    }
+  }
+  spdlog::get(LOGGER)->debug("Field::AddHills: done ({} mountains)", num_mountains);
 }
 
 std::list<position_t> Field::GetWayForSoldier(position_t start_pos, std::vector<position_t> way_points) {
@@ -41,7 +41,11 @@ class Field {
     void AddBlink(position_t pos);
 
     /**
-     * Adds random natural barriers.
+     * Adds random natural barriers. Draws mountains for all cells at once
+     * (gen_1) and their size (gen_2).
+     * @param[in] gen_1 generator of mountains (boolean per cell).
+     * @param[in] gen_2 generator of size of mountains.
+     * @param[in] denceness reduces size of mountains.
      */
     void AddHills(RandomGenerator*, RandomGenerator*, unsigned short denceness=1);
 
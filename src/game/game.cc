@@ -8,6 +8,7 @@
 #include <exception>
 #include <filesystem>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <shared_mutex>
 #include <stdexcept>
@@ -41,22 +42,22 @@ std::string CheckMissingResources(Costs missing_costs) {
   return res;
 }
 
-Game::Game(int lines, int cols, int left_border, std::string base_path) 
-  : game_over_(false), pause_(false), resigned_(false), audio_(base_path), base_path_(base_path), 
-  lines_(lines), cols_(cols), left_border_(left_border) {
+Game::Game(int lines, int cols, int left_border, std::string base_path, size_t analysis_lead, bool pcm_cache,
+    AnalysisBackend backend, AnalysisProfile profile, uintmax_t cache_budget, bool playlist) 
+  : game_over_(false), pause_(false), resigned_(false), 
+  audio_(base_path, std::make_shared<AnalysisStore>(base_path, cache_budget)), cursor_(audio_.timelines()), 
+  base_path_(base_path), 
+  analysis_lead_(analysis_lead), playlist_(playlist), lines_(lines), cols_(cols), left_border_(left_border), dispatcher_(cursor_) {
 
   spdlog::get(LOGGER)->info("Loading music paths at {}", base_path + "/settings/music_paths.json");
   std::vector<std::string> paths = utils::LoadJsonFromDisc(base_path + "/settings/music_paths.json");
   spdlog::get(LOGGER)->info("Got music paths: {}", paths.size());
 
-  for (const auto& it : paths) {
-    if (it.find("$(HOME)") != std::string::npos)
-      audio_paths_.push_back(getenv("HOME") + it.substr(it.find("/")));
-    else if (it.find("$(DISSONANCE)") != std::string::npos)
-      audio_paths_.push_back(base_path + it.substr(it.find("/")));
-    else
-      audio_paths_.push_back(it);
-  }
+  for (const auto& it : paths)
+    audio_paths_.push_back(utils::ResolvePath(it, base_path));
+  audio_.set_pcm_cache(pcm_cache);
+  audio_.set_analysis_backend(backend);
+  audio_.set_analysis_profile(profile);
 }
 
 void Game::play() {
@@ -86,12 +87,29 @@ void Game::play() {
   std::string source_path = SelectAudio();
   spdlog::get(LOGGER)->info("Selected path: {}", source_path);
   audio_.set_source_path(source_path);
-  audio_.Analyze();
+  if (playlist_)
+    next_songs_ = GetPlaylist(source_path);
+  // Start analysis and wait only for lead (rest is analysed while playing).
+  clear();
+  PrintCentered(LINES/2, "Analysing audio...");
+  try {
+    audio_.StartAnalysis(analysis_lead_);
+  } catch (const char* e) {
+    spdlog::get(LOGGER)->error("Game::play: analysis failed: {}", e);
+    PrintCentered({{"Could not analyse selected audio: " + std::string(e)}});
+    return;
+  }
+  auto lead_data = audio_.lead_data();  // shared by all generators.
+  if (lead_data->data_per_beat_.size() == 0) {
+    PrintCentered({{"Could not analyse selected audio: no beats found."}});
+    return;
+  }
 
-  // Build field.
-  RandomGenerator* ran_gen = new RandomGenerator(audio_.analysed_data(), &RandomGenerator::ran_note);
-  RandomGenerator* map_1 = new RandomGenerator(audio_.analysed_data(), &RandomGenerator::ran_boolean_minor_interval);
-  RandomGenerator* map_2 = new RandomGenerator(audio_.analysed_data(), &RandomGenerator::ran_level_peaks);
+  // Build field (based on lead only, so map is independent of analysis progress).
+  RandomGenerator* ran_gen = new RandomGenerator(lead_data, &RandomGenerator::ran_note, RANDOM_STREAM_GAME);
+  RandomGenerator* map_1 = new RandomGenerator(lead_data, &RandomGenerator::ran_boolean_minor_interval, 
+      RANDOM_STREAM_MOUNTAINS);
+  RandomGenerator* map_2 = new RandomGenerator(lead_data, &RandomGenerator::ran_level_peaks, RANDOM_STREAM_HILLS);
   position_t nucleus_pos_1;
   position_t nucleus_pos_2;
   std::map<int, position_t> resource_positions_1;
@@ -104,8 +122,8 @@ void Game::play() {
 
     field_ = new Field(lines_, cols_, ran_gen, left_border_);
     field_->AddHills(map_1, map_2, denceness++);
-    int player_one_section = (int)audio_.analysed_data().average_bpm_%8+1;
-    int player_two_section = (int)audio_.analysed_data().average_level_%8+1;
+    int player_one_section = (int)lead_data->average_bpm_%8+1;
+    int player_two_section = (int)lead_data->average_level_%8+1;
     if (player_one_section == player_two_section)
       player_two_section = (player_two_section+1)%8;
     nucleus_pos_1 = field_->AddNucleus(player_one_section);
@@ -140,68 +158,70 @@ void Game::play() {
   // Let player two distribute initial iron.
   player_two_->DistributeIron(Resources::OXYGEN);
   player_two_->DistributeIron(Resources::OXYGEN);
-  player_two_->HandleIron(audio_.analysed_data().data_per_beat_.front());
-
-  // Start game
-  audio_.play();
+  player_two_->HandleIron(lead_data->data_per_beat_.front());
+
+  // Start game (next song of playlist is analysed while playing). Beats follow
+  // the frames played by the device, if available.
+  if (audio_.play())
+    cursor_.set_clock([this]() { return audio_.position(); });
+  cursor_.Start();
+  QueueNextSong();
+  render_beats_ = dispatcher_.Subscribe();
+  ki_beats_ = dispatcher_.Subscribe();
+  dispatcher_.Start();
   std::thread thread_actions([this]() { RenderField(); });
   std::thread thread_choices([this]() { (GetPlayerChoice()); });
   std::thread thread_ki([this]() { (HandleActions()); });
   thread_actions.join();
   thread_choices.join();
   thread_ki.join();
+  dispatcher_.Stop();
 }
 
 void Game::RenderField() {
   spdlog::get(LOGGER)->debug("Game::RenderField: started");
-  auto audio_start_time = std::chrono::steady_clock::now();
-  auto analysed_data = audio_.analysed_data();
-  std::list<AudioDataTimePoint> data_per_beat = analysed_data.data_per_beat_;
+  BeatEvent event;
 
   auto last_update = std::chrono::steady_clock::now();
   auto last_resource_player_one = std::chrono::steady_clock::now();
   auto last_resource_player_two = std::chrono::steady_clock::now();
 
-  double ki_resource_update_frequency = data_per_beat.front().bpm_;
-  double player_resource_update_freqeuncy = data_per_beat.front().bpm_;
+  // Lead has at least one beat (current timeline may not be published to yet).
+  double ki_resource_update_frequency = audio_.lead_data()->data_per_beat_.front().bpm_;
+  double player_resource_update_freqeuncy = ki_resource_update_frequency;
   double render_frequency = 40;
 
-  auto pause_start_time = std::chrono::steady_clock::now();
-  double time_in_pause = 0;
-  bool pause_started = false;
-
   bool off_notes = false;
  
   while (!game_over_) {
     auto cur_time = std::chrono::steady_clock::now();
 
+    // Stop playback clock (shared by all game threads) while paused (device clock stops by itself).
     if (pause_) {
-      if (!pause_started) {
-        pause_start_time = std::chrono::steady_clock::now();
-        pause_started = true;
-      }
+      cursor_.Pause();
       continue;
     }
-    else if (pause_started) {
-      time_in_pause += utils::GetElapsed(pause_start_time, cur_time);
-      pause_started = false;
-    }
+    cursor_.Unpause();
 
+    // Continue with next song of playlist once analysed.
+    if (audio_.SpliceNext())
+      QueueNextSong();
 
-    // Analyze audio data.
-    auto elapsed = utils::GetElapsed(audio_start_time, cur_time)-time_in_pause;
-    auto data_at_beat = data_per_beat.front();
-    if (elapsed >= data_at_beat.time_) {
+    // Analyze audio data of beats played since last update.
+    while (render_beats_->TryPop(event)) {
+      const auto& data_at_beat = event.data_at_beat_;
       render_frequency = 60000.0/(data_at_beat.bpm_*16);
       ki_resource_update_frequency = (60000.0/data_at_beat.bpm_); //*(data_at_beat.level_/50.0);
       player_resource_update_freqeuncy = 60000.0/(static_cast<double>(data_at_beat.bpm_)/2);
     
-      off_notes = audio_.MoreOffNotes(data_at_beat);
-      data_per_beat.pop_front();
-      played_levels_.push_back(audio_.analysed_data().average_level_-data_at_beat.level_);
+      off_notes = event.off_notes_;
+      played_levels_.push_back(audio_.lead_data()->average_level_-data_at_beat.level_);
+      if (played_levels_.size() > static_cast<size_t>(cols_))
+        played_levels_.erase(played_levels_.begin());
     }
 
-    if (player_two_->HasLost() || player_one_->HasLost() || data_per_beat.size() == 0) {
+    bool song_over = dispatcher_.finished() && render_beats_->size() == 0 && !audio_.next_queued();
+    if (player_two_->HasLost() || player_one_->HasLost() || song_over) {
       SetGameOver((player_two_->HasLost()) ? "YOU WON" : "YOU LOST");
       audio_.Stop();
       break;
@@ -240,40 +260,14 @@ void Game::RenderField() {
 
 void Game::HandleActions() {
   spdlog::get(LOGGER)->debug("Game::HandleActions: started");
-  auto audio_start_time = std::chrono::steady_clock::now();
-  auto analysed_data = audio_.analysed_data();
-  std::list<AudioDataTimePoint> data_per_beat = analysed_data.data_per_beat_;
-
-  auto pause_start_time = std::chrono::steady_clock::now();
-  double time_in_pause = 0;
-  bool pause_started = false;
+  BeatEvent event;
 
-  // Handle building neurons and potentials.
+  // Handle building neurons and potentials (no beats are dispatched while paused).
   while(!game_over_) {
-    auto cur_time = std::chrono::steady_clock::now(); 
-
-    if (pause_) {
-      if (!pause_started) {
-        pause_start_time = std::chrono::steady_clock::now();
-        pause_started = true;
-      }
+    if (!ki_beats_->Pop(event, UPDATE_FREQUENCY))
       continue;
-    }
-    else if (pause_started) {
-      time_in_pause += utils::GetElapsed(pause_start_time, cur_time);
-      pause_started = false;
-    }
-
-    // Analyze audio data.
-    auto elapsed = utils::GetElapsed(audio_start_time, cur_time)-time_in_pause;
-    if (data_per_beat.size() == 0)
-      continue;
-    auto data_at_beat = data_per_beat.front();
-    if (elapsed >= data_at_beat.time_) {
-      player_two_->DoAction(data_at_beat);
-      player_two_->set_last_time_point(data_at_beat);
-      data_per_beat.pop_front();
-    }
+    player_two_->DoAction(event.data_at_beat_);
+    player_two_->set_last_time_point(event.data_at_beat_);
   }
 }
 
@@ -776,10 +770,9 @@ void Game::PrintFieldAndStatus() {
     mvaddstr(i, 0, clear_string.c_str());
   // Print music bar.
   auto played_levels = played_levels_;
-  int played_levels_len = played_levels.size();
-  if (played_levels_len > cols_)
-    played_levels = utils::SliceVector(played_levels, played_levels_len-cols_, cols_);
-  double percent_played = static_cast<double>(played_levels_len*100)/audio_.analysed_data().data_per_beat_.size();
+  double percent_played = static_cast<double>(dispatcher_.next_beat()*100)/std::max(audio_.timeline()->ExpectedSize(), 
+      static_cast<size_t>(1));
+  int max_peak = std::max(audio_.lead_data()->max_peak_, 1);
   if (percent_played < 50)
     attron(COLOR_PAIR(COLOR_MSG));
   else if (percent_played < 80)
@@ -787,7 +780,7 @@ void Game::PrintFieldAndStatus() {
   else
     attron(COLOR_PAIR(COLOR_ERROR));
   for (unsigned int i=0; i<played_levels.size(); i++) {
-    int level = (played_levels[i]*4)/audio_.analysed_data().max_peak_;
+    int level = (played_levels[i]*4)/max_peak;
     if (level > 4) level = 4;
     if (level < -4) level = -4;
     mvaddstr(8+level, left_border_+cols_/2+i, "-");
@@ -883,6 +876,27 @@ void Game::ClearField() {
   refresh();
 }
 
+std::vector<std::string> Game::GetPlaylist(std::string source_path) {
+  std::filesystem::path path(source_path);
+  std::vector<std::string> songs;
+  std::error_code ec;
+  for (const auto& it : std::filesystem::directory_iterator(path.parent_path(), ec)) {
+    if (it.path().extension() == ".mp3" || it.path().extension() == ".wav")
+      songs.push_back(it.path().string());
+  }
+  std::sort(songs.begin(), songs.end());
+  auto following = std::upper_bound(songs.begin(), songs.end(), path.string());
+  return std::vector<std::string>(following, songs.end());
+}
+
+void Game::QueueNextSong() {
+  if (next_songs_.size() == 0)
+    return;
+  spdlog::get(LOGGER)->info("Game::QueueNextSong: queued {}", next_songs_.front());
+  audio_.QueueNext(next_songs_.front());
+  next_songs_.erase(next_songs_.begin());
+}
+
 std::string Game::SelectAudio() {
   ClearField();
   AudioSelector selector = SetupAudioSelector("", "select audio", audio_paths_);
@@ -3,6 +3,7 @@
 
 #include <cstddef>
 #include <curses.h>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <stdio.h>
@@ -11,6 +12,8 @@
 #include <vector>
 
 #include "audio/audio.h"
+#include "audio/beat_cursor.h"
+#include "audio/beat_dispatcher.h"
 #include "constants/texts.h"
 #include "game/field.h"
 #include "player/audio_ki.h"
@@ -24,8 +27,17 @@ class Game {
      * Constructor initializing game with availible lines and columns.
      * @param[in] lines availible lines.
      * @param[in] cols availible cols
+     * @param[in] analysis_lead number of analysed intervals to wait for before starting game.
+     * @param[in] pcm_cache whether to keep decoded audio on disc (see Audio::set_pcm_cache).
+     * @param[in] backend analysis backend (see Audio::set_analysis_backend).
+     * @param[in] profile analysis profile (see Audio::set_analysis_profile).
+     * @param[in] cache_budget max. size (bytes) of analysis store (see AnalysisStore).
+     * @param[in] playlist if set, the game continues with the following songs
+     * of the selected song's directory (see Audio::QueueNext).
      */
-    Game(int lines, int cols, int left_border, std::string audio_base_path);
+    Game(int lines, int cols, int left_border, std::string audio_base_path, size_t analysis_lead=1, 
+        bool pcm_cache=false, AnalysisBackend backend=BACKEND_AUBIO, AnalysisProfile profile=PROFILE_DEFAULT,
+        uintmax_t cache_budget=ANALYSIS_STORE_BUDGET, bool playlist=false);
 
     /**
      * Starts game.
@@ -40,8 +52,12 @@ class Game {
     bool pause_;
     bool resigned_;
     Audio audio_;
+    BeatCursor cursor_;  ///< playback position shared by all game threads.
     const std::string base_path_;
     std::vector<std::string> audio_paths_;
+    const size_t analysis_lead_;
+    const bool playlist_;
+    std::vector<std::string> next_songs_;  ///< songs of playlist not queued yet.
 
     const int lines_;
     const int cols_;
@@ -49,7 +65,10 @@ class Game {
 
     int difficulty_;
 
-    std::vector<int> played_levels_;
+    std::vector<int> played_levels_;  ///< levels of last beats played (at most one per column).
+    BeatDispatcher dispatcher_;  ///< publishes played beats to render- and ki-thread.
+    std::shared_ptr<BeatQueue> render_beats_;
+    std::shared_ptr<BeatQueue> ki_beats_;
 
     std::shared_mutex mutex_print_field_;  ///< mutex locked, when printing field.
 
@@ -110,6 +129,18 @@ class Game {
 
     std::string SelectAudio();
 
+    /**
+     * Gets songs following given song in it's directory (in alphabetical order).
+     * @param[in] source_path
+     * @return paths of following songs.
+     */
+    static std::vector<std::string> GetPlaylist(std::string source_path);
+
+    /**
+     * Queues next song of playlist for pre-analysis (see Audio::QueueNext).
+     */
+    void QueueNextSong();
+
     struct AudioSelector {
       std::string path_;
       std::string title_;
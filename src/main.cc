@@ -8,7 +8,9 @@
 #include <sstream>
 #include <stdlib.h>
 #include <lyra/lyra.hpp>
+#include <nlohmann/json.hpp>
 #include "audio/audio.h"
+#include "audio/library_analyzer.h"
 #include "game/game.h"
 
 #include <spdlog/spdlog.h>
@@ -25,6 +27,18 @@ int main(int argc, const char** argv) {
   bool relative_size = false;
   bool show_help = false;
   bool clear_log = false;
+  bool analyze_library = false;
+  unsigned int num_threads = 0;
+  size_t analysis_lead = 1;
+  bool pcm_cache = false;
+  bool playlist = false;
+  std::string analysis_backend = "aubio";
+  std::string analysis_profile = "default";
+  uintmax_t cache_size = ANALYSIS_STORE_BUDGET/(1 << 20);
+  std::string analyze_stream = "";
+  std::string stream_format = "f32";
+  unsigned int stream_rate = 44100;
+  unsigned int stream_channels = 2;
   std::string log_level = "warn";
   std::string base_path = getenv("HOME");
   base_path += "/.dissonance/";
@@ -33,7 +47,19 @@ int main(int argc, const char** argv) {
     | lyra::opt(relative_size) ["-r"]["--relative-size"]("If set, adjusts map size to terminal size.")
     | lyra::opt(clear_log) ["-c"]["--clear-log"]("If set, removes all log-files before starting the game.")
     | lyra::opt(log_level, "options: [warn, info, debug], default: \"warn\"") ["-l"]["--log_level"]("set log-level")
-    | lyra::opt(base_path, "path to dissonance files") ["-p"]["--base-path"]("Set path to dissonance files (logs, settings, data)");
+    | lyra::opt(base_path, "path to dissonance files") ["-p"]["--base-path"]("Set path to dissonance files (logs, settings, data)")
+    | lyra::opt(analyze_library) ["-a"]["--analyze-library"]("If set, analyzes all songs in music paths and exits.")
+    | lyra::opt(num_threads, "threads, default: number of cores") ["-j"]["--threads"]("Set number of threads for --analyze-library")
+    | lyra::opt(analysis_lead, "intervals, default: 1") ["--analysis-lead"]("Set number of analysed intervals to wait for before starting game")
+    | lyra::opt(cache_size, "MB, default: 1024") ["--cache-size"]("Set max. size of stored analyses (least recently used songs are removed first)")
+    | lyra::opt(pcm_cache) ["--pcm-cache"]("If set, keeps decoded songs on disc, so replays start instantly.")
+    | lyra::opt(playlist) ["--playlist"]("If set, continues with the following songs of the selected song's directory (crossfaded, map and AI continue).")
+    | lyra::opt(analysis_backend, "options: [aubio, fused], default: \"aubio\"") ["--analysis-backend"]("Set backend used to analyse songs")
+    | lyra::opt(analysis_profile, "options: [fast, default, accurate], default: \"default\"") ["--analysis-profile"]("Set speed/accuracy trade-off of analysis (samplerate songs are analysed at)")
+    | lyra::opt(analyze_stream, "path to FIFO, \"-\" for stdin") ["--analyze-stream"]("Analyzes raw pcm stream, prints beats (json lines) and exits.")
+    | lyra::opt(stream_format, "options: [f32, s16], default: \"f32\"") ["--stream-format"]("Set sample format for --analyze-stream")
+    | lyra::opt(stream_rate, "samplerate, default: 44100") ["--stream-rate"]("Set samplerate for --analyze-stream")
+    | lyra::opt(stream_channels, "channels, default: 2") ["--stream-channels"]("Set number of channels for --analyze-stream");
     
   cli.add_argument(lyra::help(show_help));
   auto result = cli.parse({ argc, argv });
@@ -66,9 +92,50 @@ int main(int argc, const char** argv) {
 
   // Initialize audio
   Audio::Initialize();
+  if (analysis_backend != "aubio" && analysis_backend != "fused") {
+    std::cout << "Unknown analysis backend: " << analysis_backend << std::endl;
+    return 1;
+  }
+  AnalysisBackend backend = (analysis_backend == "fused") ? BACKEND_FUSED : BACKEND_AUBIO;
+  AnalysisProfile profile = PROFILE_DEFAULT;
+  if (analysis_profile == Audio::ProfileName(PROFILE_FAST))
+    profile = PROFILE_FAST;
+  else if (analysis_profile == Audio::ProfileName(PROFILE_ACCURATE))
+    profile = PROFILE_ACCURATE;
+  else if (analysis_profile != Audio::ProfileName(PROFILE_DEFAULT)) {
+    std::cout << "Unknown analysis profile: " << analysis_profile << std::endl;
+    return 1;
+  }
 
-  // Initialize random numbers.
-  srand (time(NULL));
+  // Analyze complete music library (headless), then exit.
+  if (analyze_library) {
+    LibraryAnalyzer library_analyzer(base_path, num_threads, backend, profile, cache_size << 20);
+    size_t analyzed = library_analyzer.Run(true);
+    std::cout << "Analyzed " << analyzed << " files." << std::endl;
+    return 0;
+  }
+
+  // Analyze raw pcm stream (headless), printing each beat as soon as published, then exit.
+  if (analyze_stream != "") {
+    try {
+      PcmStreamFormat format = {PcmStreamFormat::ParseSampleFormat(stream_format), stream_rate, stream_channels};
+      Audio audio(base_path);
+      audio.set_analysis_backend(backend);
+      audio.set_analysis_profile(profile);
+      audio.AnalyzeStream(analyze_stream, format, [](const AudioDataTimePoint& beat) {
+        std::vector<int> midis;
+        for (const auto& note : beat.notes_)
+          midis.push_back(note.midi_note_);
+        nlohmann::json data = {{"time", beat.time_}, {"bpm", beat.bpm_}, {"level", beat.level_}, 
+          {"notes", midis}, {"interval", beat.interval_}};
+        std::cout << data.dump() << std::endl;
+      });
+    } catch (const char* e) {
+      std::cout << e << std::endl;
+      return 1;
+    }
+    return 0;
+  }
 
   // Initialize curses
   setlocale(LC_ALL, "");
@@ -99,7 +166,8 @@ int main(int argc, const char** argv) {
     left_border = 10;
   }
   // Initialize game.
-  Game game(lines, cols, left_border, base_path);
+  Game game(lines, cols, left_border, base_path, analysis_lead, pcm_cache, backend, profile, cache_size << 20, 
+      playlist);
   // Start game
   game.play();
   
@@ -107,5 +175,6 @@ int main(int argc, const char** argv) {
   refresh();
   clear();
   endwin();
+  aubio_cleanup();
   exit(0);
 }
@@ -16,13 +16,15 @@
 AudioKi::AudioKi(position_t nucleus_pos, Field* field, Audio* audio, RandomGenerator* ran_gen,
     std::map<int, position_t> resource_positions) 
   : Player(nucleus_pos, field, ran_gen, resource_positions), 
-    average_bpm_(audio->analysed_data().average_bpm_), 
-    average_level_(audio->analysed_data().average_level_) 
+    average_bpm_(audio->lead_data()->average_bpm_), 
+    average_level_(audio->lead_data()->average_level_) 
 {
   audio_ = audio;
   max_activated_neurons_ = 3;
   nucleus_pos_ = nucleus_pos;
-  cur_interval_ = audio_->analysed_data().intervals_[0];
+  // Read from lead (current timeline may not have published an interval yet).
+  auto lead_data = audio_->lead_data();
+  cur_interval_ = (lead_data->intervals_.count(0) > 0) ? lead_data->intervals_.at(0) : Interval();
 
   // TODO (fux): increase iron by one.
   attack_strategies_ = {{Tactics::EPSP_FOCUSED, 1}, {Tactics::IPSP_FOCUSED, 1}, {Tactics::AIM_NUCLEUS, 1},
@@ -51,9 +53,11 @@ void AudioKi::SetUpTactics(bool economy_tactics) {
   if (economy_tactics)
     SetEconomyTactics();
   
-  // Increase interval.
-  if (cur_interval_.id_+1 < audio_->analysed_data().intervals_.size())
-    cur_interval_ = audio_->analysed_data().intervals_[cur_interval_.id_+1];
+  // Increase interval (of current timeline snapshot, which may be swapped in by refined analysis).
+  auto timeline = audio_->timeline();
+  size_t next_interval = std::max(cur_interval_.id_+1, timeline->first_interval());
+  if (next_interval < timeline->num_intervals())
+    cur_interval_ = timeline->interval(next_interval);
 }
 
 void AudioKi::SetBattleTactics() {
@@ -185,6 +189,10 @@ void AudioKi::SetEconomyTactics() {
 
 void AudioKi::DoAction(const AudioDataTimePoint& data_at_beat) {
   spdlog::get(LOGGER)->debug("AudioKi::DoAction.");
+  // Next song of playlist may have been spliced on.
+  auto lead_data = audio_->lead_data();
+  average_bpm_ = lead_data->average_bpm_;
+  average_level_ = lead_data->average_level_;
   // Change tactics when interval changes:
   if (data_at_beat.interval_ > last_data_point_.interval_)
     SetUpTactics(false);
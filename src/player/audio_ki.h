@@ -25,8 +25,8 @@ class AudioKi : public Player {
   private:
     // members
     Audio* audio_;
-    const float average_bpm_;
-    const float average_level_;
+    float average_bpm_;  ///< of current song (see `Audio::lead_data`).
+    float average_level_;  ///< of current song (see `Audio::lead_data`).
     size_t max_activated_neurons_;
     position_t nucleus_pos_;
 
@@ -0,0 +1,49 @@
+#include "random/counter_rng.h"
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+const uint64_t kGamma = 0x9e3779b97f4a7c15ULL;  ///< golden ratio (SplitMix64 increment).
+
+CounterRng::CounterRng(uint64_t key, uint64_t stream) : counter_(0) {
+  // Mix stream into key, so that streams of similar ids are unrelated.
+  seed_ = Mix(key ^ Mix((stream+1) * kGamma));
+}
+
+// getter
+uint64_t CounterRng::counter() const {
+  return counter_;
+}
+
+// methods
+uint64_t CounterRng::at(uint64_t counter) const {
+  return Mix(seed_ + (counter+1) * kGamma);
+}
+
+size_t CounterRng::at(uint64_t counter, size_t min, size_t max) const {
+  return min + at(counter) % (max - min + 1);
+}
+
+uint64_t CounterRng::Next() {
+  return at(counter_++);
+}
+
+size_t CounterRng::Next(size_t min, size_t max) {
+  return at(counter_++, min, max);
+}
+
+void CounterRng::Seek(uint64_t counter) {
+  counter_ = counter;
+}
+
+CounterRng& CounterRng::ThreadLocal() {
+  static thread_local CounterRng rng((static_cast<uint64_t>(std::random_device()()) << 32)
+      ^ std::random_device()());
+  return rng;
+}
+
+uint64_t CounterRng::Mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
@@ -0,0 +1,80 @@
+#ifndef SRC_RANDOM_COUNTER_RNG_H_
+#define SRC_RANDOM_COUNTER_RNG_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Counter-based random number generator (SplitMix64 style). The n-th number
+ * of a stream is a pure function of key, stream id and n, so any number can
+ * be drawn independently of all others (`at`), and generators on different
+ * threads never share state. Equal key and stream give equal numbers.
+ */
+class CounterRng {
+  public:
+    /**
+     * Constructor.
+     * @param[in] key (f.e. fingerprint of audio data).
+     * @param[in] stream id of independent stream for same key.
+     */
+    CounterRng(uint64_t key, uint64_t stream=0);
+
+    // getter
+    uint64_t counter() const;
+
+    // methods
+    /**
+     * Gets number at given position in stream (does not change counter).
+     * @param[in] counter
+     * @return random 64-bit number.
+     */
+    uint64_t at(uint64_t counter) const;
+
+    /**
+     * Gets number at given position in stream in range (does not change counter).
+     * @param[in] counter
+     * @param[in] min
+     * @param[in] max
+     * @return random number between min and max.
+     */
+    size_t at(uint64_t counter, size_t min, size_t max) const;
+
+    /**
+     * Gets next number in stream and increases counter.
+     * @return random 64-bit number.
+     */
+    uint64_t Next();
+
+    /**
+     * Gets next number in stream in range and increases counter.
+     * @param[in] min
+     * @param[in] max
+     * @return random number between min and max.
+     */
+    size_t Next(size_t min, size_t max);
+
+    /**
+     * Sets position in stream.
+     * @param[in] counter
+     */
+    void Seek(uint64_t counter);
+
+    /**
+     * Gets generator of calling thread, keyed by system entropy (not
+     * reproducible). Use for ids and other numbers which need not be
+     * reproduced.
+     */
+    static CounterRng& ThreadLocal();
+
+  private:
+    uint64_t seed_;  ///< derived from key and stream.
+    uint64_t counter_;
+
+    /**
+     * Mixes bits (SplitMix64 finalizer).
+     * @param[in] x
+     */
+    static uint64_t Mix(uint64_t x);
+};
+
+#endif
@@ -1,90 +1,149 @@
 #include "random/random.h"
+#include "audio/analysis_store.h"
 #include "audio/audio.h"
 #include "constants/codes.h"
+#include "random/counter_rng.h"
 #include "spdlog/spdlog.h"
 #include <algorithm>
 #include <cstddef>
-#include <cstdlib>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #define LOGGER "logger"
 
-RandomGenerator::RandomGenerator() {
+RandomGenerator::RandomGenerator() : rng_(CounterRng::ThreadLocal().Next()) {
   get_ran_ = &RandomGenerator::ran;
-  last_point_ = 0;
+  counter_ = 0;
+  max_peak_ = 0;
 }
 
-RandomGenerator::RandomGenerator(AudioData analysed_data, size_t(RandomGenerator::*generator)(size_t, size_t)) {
-  analysed_data_ = analysed_data;
+RandomGenerator::RandomGenerator(std::shared_ptr<const AudioData> analysed_data, 
+    size_t(RandomGenerator::*generator)(uint64_t, size_t, size_t) const, uint64_t stream) 
+    : analysed_data_(analysed_data), rng_(Fingerprint(*analysed_data), stream) {
   get_ran_ = generator;
-  last_point_ = 0;
+  counter_ = 0;
+
+  const auto& beats = analysed_data_->data_per_beat_;
+  for (size_t i=0; i<beats.size(); i++) {
+    if (beats.num_notes(i) > 0)
+      note_beats_.push_back(i);
+  }
+  // Intervals are expensive to compute: compute once per beat, if needed.
+  if (get_ran_ == &RandomGenerator::ran_boolean_minor_interval) {
+    minor_intervals_.resize(beats.size(), false);
+    for (const auto& i : note_beats_)
+      minor_intervals_[i] = HasMinorInterval(beats.at(i).notes_);
+  }
 
   std::vector<int> cur;
   int above = 0;
-  for (const auto& tp : analysed_data_.data_per_beat_) {
-    int level = tp.level_;
-    if (above == 1 && level <= analysed_data_.average_level_) {
+  for (int level : analysed_data_->data_per_beat_.levels()) {
+    if (above == 1 && level <= analysed_data_->average_level_) {
       peaks_.push_back(*std::max_element(cur.begin(), cur.end()));
       cur.clear();
     }
-    else if (above == -1 && level >= analysed_data_.average_level_) {
+    else if (above == -1 && level >= analysed_data_->average_level_) {
       peaks_.push_back(*std::max_element(cur.begin(), cur.end()));
       cur.clear();
     }
-    if (level != analysed_data.average_level_) {
-        above = (level > analysed_data_.average_level_) ? 1 : 0;
-        cur.push_back(level - analysed_data_.average_level_);
+    if (level != analysed_data_->average_level_) {
+        above = (level > analysed_data_->average_level_) ? 1 : 0;
+        cur.push_back(level - analysed_data_->average_level_);
     }
   }
+  max_peak_ = (peaks_.size() > 0) ? *std::max_element(peaks_.begin(), peaks_.end()) : 0;
+}
+
+// getter
+uint64_t RandomGenerator::counter() const {
+  return counter_;
+}
+
+// setter
+void RandomGenerator::Seek(uint64_t counter) {
+  counter_ = counter;
 }
 
+// methods
 int RandomGenerator::RandomInt(size_t min, size_t max) {
-  unsigned int random_faktor = (this->*get_ran_)(min, max);
+  unsigned int random_faktor = (this->*get_ran_)(counter_++, min, max);
   spdlog::get(LOGGER)->info("RandomGenerator::RandomInt: retuning {} < {} < {}", min, random_faktor, max);
   return random_faktor;
 }
 
-size_t RandomGenerator::ran(size_t min, size_t max) {
-  return min + (rand()% (max - min + 1)); 
+int RandomGenerator::RandomIntAt(uint64_t counter, size_t min, size_t max) const {
+  return (this->*get_ran_)(counter, min, max);
+}
+
+void RandomGenerator::FillBooleans(uint8_t* out, size_t n) {
+  for (size_t i=0; i<n; i++)
+    out[i] = (this->*get_ran_)(counter_++, 0, 1);
+  spdlog::get(LOGGER)->debug("RandomGenerator::FillBooleans: {} booleans", n);
 }
 
-size_t RandomGenerator::ran_note(size_t min, size_t max) {
-  auto data_at_beat = GetNextTimePointWithNotes(); 
-  unsigned int random_faktor = data_at_beat.notes_.front().midi_note_;
+void RandomGenerator::FillInts(int* out, size_t n, size_t min, size_t max) {
+  for (size_t i=0; i<n; i++)
+    out[i] = (this->*get_ran_)(counter_++, min, max);
+  spdlog::get(LOGGER)->debug("RandomGenerator::FillInts: {} numbers {}-{}", n, min, max);
+}
+
+uint64_t RandomGenerator::Fingerprint(const AudioData& audio_data) {
+  const auto& beats = audio_data.data_per_beat_;
+  uint64_t digest = AnalysisStore::Digest(beats.times().data(), beats.times().size()*sizeof(double));
+  digest = AnalysisStore::Digest(beats.bpms().data(), beats.bpms().size()*sizeof(int32_t), digest);
+  digest = AnalysisStore::Digest(beats.levels().data(), beats.levels().size()*sizeof(int32_t), digest);
+  digest = AnalysisStore::Digest(beats.note_offsets().data(), beats.note_offsets().size()*sizeof(uint32_t), digest);
+  return AnalysisStore::Digest(beats.note_pool().data(), beats.note_pool().size(), digest);
+}
+
+size_t RandomGenerator::ran(uint64_t counter, size_t min, size_t max) const {
+  return rng_.at(counter, min, max);
+}
+
+size_t RandomGenerator::ran_note(uint64_t counter, size_t min, size_t max) const {
+  if (note_beats_.size() == 0)
+    return ran(counter, min, max);
+  // Read columns directly (no beat assembled).
+  const auto& beats = analysed_data_->data_per_beat_;
+  size_t i = BeatWithNotes(counter);
+  unsigned int random_faktor = beats.note_pool()[beats.note_offsets()[i]];
   // Multiply random midi note by 1. bpm, 2. level if note remains below max.
   if (max > random_faktor) 
-    random_faktor *= data_at_beat.bpm_;
+    random_faktor *= beats.bpms()[i];
   if (max > random_faktor)
-    random_faktor += data_at_beat.level_;
+    random_faktor += beats.levels()[i];
   return min + (random_faktor % (max - min + 1)); 
 }
 
-size_t RandomGenerator::ran_boolean_minor_interval(size_t min, size_t max) {
-  auto data_at_beat = GetNextTimePointWithNotes(); 
-  auto intervals = Audio::GetInterval(data_at_beat.notes_);
-  for (const auto& it : {MINOR_THIRD, MINOR_SEVENTH}) {
-    if (std::find(intervals.begin(), intervals.end(), it) != intervals.end())
-      return 1;
-  }
-  return 0;
+size_t RandomGenerator::ran_boolean_minor_interval(uint64_t counter, size_t min, size_t max) const {
+  if (note_beats_.size() == 0)
+    return ran(counter, min, max);
+  size_t i = BeatWithNotes(counter);
+  if (minor_intervals_.size() > 0)
+    return minor_intervals_[i];
+  return HasMinorInterval(analysed_data_->data_per_beat_.at(i).notes_);
 }
 
-size_t RandomGenerator::ran_level_peaks(size_t, size_t max) {
-  if (last_point_ == peaks_.size())
-    last_point_ = 0;
-  size_t peak = peaks_[last_point_++];
+size_t RandomGenerator::ran_level_peaks(uint64_t counter, size_t, size_t max) const {
+  // No peaks (f.e. silent or empty analysis): no mountains.
+  if (peaks_.size() == 0 || max_peak_ == 0)
+    return 999;
+  size_t peak = peaks_[rng_.at(counter) % peaks_.size()];
   // trim to max:
-  int n = *std::max_element(peaks_.begin(), peaks_.end());
-  int x = static_cast<double>(peak * max)/n;
+  int x = static_cast<double>(peak * max)/max_peak_;
   return 999+x;
 }
 
-AudioDataTimePoint RandomGenerator::GetNextTimePointWithNotes() {
-  if (last_point_ == analysed_data_.data_per_beat_.size())
-    last_point_ = 0;
-  auto it = analysed_data_.data_per_beat_.begin();
-  std::advance(it, last_point_++);
-  if (it->notes_.size() == 0)
-    return GetNextTimePointWithNotes();
-  return *it;
+size_t RandomGenerator::BeatWithNotes(uint64_t counter) const {
+  return note_beats_[rng_.at(counter) % note_beats_.size()];
+}
+
+bool RandomGenerator::HasMinorInterval(const std::vector<Note>& notes) {
+  auto intervals = Audio::GetInterval(notes);
+  for (const auto& it : {MINOR_THIRD, MINOR_SEVENTH}) {
+    if (std::find(intervals.begin(), intervals.end(), it) != intervals.end())
+      return true;
+  }
+  return false;
 }
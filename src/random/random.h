@@ -2,24 +2,55 @@
 #define SRC_RANDOM_RANDOM_H_
 
 #include "audio/audio.h"
+#include "random/counter_rng.h"
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 
+#define RANDOM_STREAM_GAME 0  ///< stream of positions in field and of players.
+#define RANDOM_STREAM_MOUNTAINS 1  ///< stream of mountains (`Field::AddHills`).
+#define RANDOM_STREAM_HILLS 2  ///< stream of size of mountains (`Field::AddHills`).
+
+/**
+ * Generates random numbers based on audio data. The n-th number drawn is a
+ * pure function of the audio data, the stream and n (see `RandomIntAt`), so
+ * equal songs give equal games and numbers can be drawn in parallel.
+ */
 class RandomGenerator {
   public:
     /** 
-     * Constructor for tests (no audio needed). Uses simple system random
-     * function.
+     * Constructor for tests (no audio needed). Uses counter-based random
+     * function (`ran`) with a random key.
      */
     RandomGenerator();
 
     /**
-     * Constructor with audio data and custom random function.
+     * Constructor with audio data and custom random function. The audio data
+     * is shared (not copied), as it is immutable. Beats with notes and level
+     * peaks are indexed once, so each random number is drawn in O(1).
      * @param[in] analysed_data used for generating random numbers.
      * @param[in] generator custom function to generate random numbers based on
      * audio data.
+     * @param[in] stream id of stream (generators with equal audio data and
+     * stream draw equal numbers, other streams pick other beats and peaks).
+     */
+    RandomGenerator(std::shared_ptr<const AudioData> analysed_data, 
+        size_t(RandomGenerator::*generator)(uint64_t, size_t, size_t) const, uint64_t stream=RANDOM_STREAM_GAME);
+
+    // getter
+    /**
+     * Gets number of random numbers drawn (position of next draw).
      */
-    RandomGenerator(AudioData analysed_data, size_t(RandomGenerator::*generator)(size_t, size_t));
+    uint64_t counter() const;
 
+    // setter
+    /**
+     * Sets position of next draw.
+     * @param[in] counter
+     */
+    void Seek(uint64_t counter);
+
+    // methods
     /**
      * Base function calling set random number generator.
      * @param[in] min
@@ -28,46 +59,99 @@ class RandomGenerator {
      */
     int RandomInt(size_t min, size_t max);
 
+    /**
+     * Gets random number at given position without drawing it (thread-safe).
+     * @param[in] counter position of draw.
+     * @param[in] min
+     * @param[in] max
+     * @return random number between min and max (as `RandomInt` at `counter`).
+     */
+    int RandomIntAt(uint64_t counter, size_t min, size_t max) const;
+
+    /**
+     * Fills array with random booleans (0 or 1). Draws the same numbers as
+     * calling `RandomInt(0, 1)` n times, but without logging each draw.
+     * @param[out] out array of at least n elements.
+     * @param[in] n number of booleans.
+     */
+    void FillBooleans(uint8_t* out, size_t n);
+
+    /**
+     * Fills array with random numbers. Draws the same numbers as calling
+     * `RandomInt(min, max)` n times, but without logging each draw.
+     * @param[out] out array of at least n elements.
+     * @param[in] n number of random numbers.
+     * @param[in] min
+     * @param[in] max
+     */
+    void FillInts(int* out, size_t n, size_t min, size_t max);
+
+    /**
+     * Computes fingerprint of audio data (digest of beats), used as key of
+     * random numbers.
+     * @param[in] audio_data
+     * @return fingerprint.
+     */
+    static uint64_t Fingerprint(const AudioData& audio_data);
+
     // generators
     /**
-     * Gets random number from std::random.
+     * Gets counter-based random number (independent of audio).
+     * @param[in] counter
+     * @param[in] min
+     * @param[in] max
+     * @return random number between min and max.
      */
-    size_t ran(size_t min, size_t max);
+    size_t ran(uint64_t counter, size_t min, size_t max) const;
 
     /**
      * Gets random number based on the first note at beat. Uses multiplication
      * with bpm and level, if base-factor is to small.
+     * @param[in] counter
      * @param[in] min
      * @param[in] maz
      * @return random number between min and max.
      */
-    size_t ran_note(size_t min, size_t max);
+    size_t ran_note(uint64_t counter, size_t min, size_t max) const;
 
     /**
      * Gets random number based on the existance of a minor third intervals in
      * the last notes played. Only use for boolean values!
+     * @param[in] counter
      * @param[in] min
      * @param[in] max
      * @return random number between min and max.
      */
-    size_t ran_boolean_minor_interval(size_t min, size_t max);
+    size_t ran_boolean_minor_interval(uint64_t counter, size_t min, size_t max) const;
 
-    size_t ran_level_peaks(size_t min, size_t max);
+    size_t ran_level_peaks(uint64_t counter, size_t min, size_t max) const;
 
   private:
     // member
-    AudioData analysed_data_;
-    size_t last_point_;
+    std::shared_ptr<const AudioData> analysed_data_;
+    CounterRng rng_;
+    uint64_t counter_;
+    std::vector<uint32_t> note_beats_;  ///< indices of beats with notes.
+    std::vector<bool> minor_intervals_;  ///< per beat: minor interval in notes (only for `ran_boolean_minor_interval`).
     std::vector<int> peaks_;
-    size_t(RandomGenerator::*get_ran_)(size_t min, size_t max);
+    int max_peak_;  ///< max. of peaks.
+    size_t(RandomGenerator::*get_ran_)(uint64_t counter, size_t min, size_t max) const;
 
     // functions:
 
     /**
-     * Gets next data_at_beat. Cycles through all data (if end is reached,
-     * starts at the beginning again.). Skips time point if notes are empty.
+     * Gets index of beat with notes for given position. The beat is picked by
+     * the counter-based number at this position, so streams over the same
+     * song pick different beats. Expects at least one beat with notes.
+     * @param[in] counter
+     */
+    size_t BeatWithNotes(uint64_t counter) const;
+
+    /**
+     * Checks whether notes contain a minor third or minor seventh.
+     * @param[in] notes
      */
-    AudioDataTimePoint GetNextTimePointWithNotes();
+    static bool HasMinorInterval(const std::vector<Note>& notes);
 };
 
 #endif
@@ -2,116 +2,143 @@
 #define SRC_GRAPH_H_
 
 #include <algorithm>
-#include <curses.h>
-#include <iostream>
-#include <utility>
+#include <cstddef>
 #include <list>
-#include <map>
-
-struct Node {
-  int line_;
-  int col_;
-  std::list<Node*> nodes_;
-};
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 typedef std::pair<int, int> position_t;
 
+/**
+ * Graph of passable positions of a grid. Positions are stored densely by
+ * index (line*cols+col) in a passability bitset. Each position is connected
+ * to its (up to) 8 passable neighbors, so edges are implicit.
+ */
 class Graph {
   public:
-    Graph() { }
+    Graph() : lines_(0), cols_(0), size_(0) { }
+
+    /**
+     * Constructor for grid of given size (no position passable).
+     * @param[in] lines
+     * @param[in] cols
+     */
+    Graph(int lines, int cols) : lines_(lines), cols_(cols), size_(0), passable_(lines*cols, false) { }
 
     // getter:
-    const std::map<position_t, Node*>& nodes() const {
-      return nodes_; 
-    }
+    int lines() const { return lines_; }
+    int cols() const { return cols_; }
+    /**
+     * Gets number of nodes (passable positions).
+     */
+    size_t size() const { return size_; }
 
+    /**
+     * Adds node (marks position as passable).
+     * @param[in] line
+     * @param[in] col
+     */
     void AddNode(int line, int col) {
-      position_t pos = {line, col};
-      nodes_[pos] = new Node({line, col, {}});
+      if (!InGrid({line, col}) || passable_[Index({line, col})])
+        return;
+      passable_[Index({line, col})] = true;
+      size_++;
     };
 
-    void AddEdge(Node* a, Node* b) {
-      a->nodes_.push_back(b);
-    }
-
     bool InGraph(position_t pos) const {
-      return nodes_.count(pos) > 0;
+      return InGrid(pos) && passable_[Index(pos)];
     }
 
+    /**
+     * Removes all nodes not reachable from given position.
+     * @param[in] pos_a
+     * @return number of nodes removed.
+     */
     int RemoveInvalid(position_t pos_a) {
-      // Initialize all nodes as not-vistited.
-      std::map<position_t, bool> visited; 
-      for (auto node : nodes_) {
-        position_t pos = {node.second->line_, node.second->col_};
-        visited[pos] = false;
-      }
-      // Get all nodes which can be visited from player-den.
-      std::list<Node*> queue;
-      visited[pos_a] = true;
-      queue.push_back(nodes_[pos_a]);
-      while(!queue.empty()) {
-        auto cur = queue.front();
-        queue.pop_front();
-        for (auto node : cur->nodes_) {
-          position_t pos = {node->line_, node->col_};
-          if (!visited[pos]) {
-            visited[pos] = true;
-            queue.push_back(node);
-          }
-        }
-      }
-      // erase all nodes not visited
+      std::vector<int> parents = Search(pos_a, {-1, -1});
       int removed_nodes = 0;
-      for (auto it : visited) {
-        if (!it.second) {
-          delete nodes_[it.first];
-          nodes_.erase(it.first);
+      for (size_t i=0; i<passable_.size(); i++) {
+        if (passable_[i] && parents[i] == -1) {
+          passable_[i] = false;
           removed_nodes++;
         }
       }
+      size_ -= removed_nodes;
       return removed_nodes;
     }
 
+    /**
+     * Finds shortest way (breadth-first search).
+     * @param[in] pos_a start
+     * @param[in] pos_b target
+     * @return positions from start to target (both included).
+     */
     std::list<position_t> find_way(position_t pos_a, position_t pos_b) const {
-      std::map<position_t, position_t> visited; 
-      for (auto node : nodes_) {
-        position_t pos = {node.second->line_, node.second->col_};
-        visited[pos] = {-1, -1};
-      }
-
-      // Get all nodes which can be visited from player-den.
-      std::list<Node*> queue;
-      visited[pos_a] = {pos_a.first, pos_a.second};
-      queue.push_back(nodes_.at(pos_a));
-      while(!queue.empty()) {
-        auto cur = queue.front();
-        queue.pop_front();
-        // Check if desired node was found.
-        if (pos_b.first == cur->line_ && pos_b.second == cur->col_)
-          break;
-        // iterate over children.
-        for (auto node : cur->nodes_) {
-          position_t pos = {node->line_, node->col_};
-          if (visited[pos] == std::make_pair(-1, -1)) {
-            visited[pos] = {cur->line_, cur->col_};
-            queue.push_back(node);
-          }
-        }
-      }
-      if (visited[pos_b] == std::make_pair(-1, -1))
+      if (!InGraph(pos_a) || !InGraph(pos_b))
+        throw std::out_of_range("Graph::find_way: position not in graph");
+      std::vector<int> parents = Search(pos_a, pos_b);
+      if (parents[Index(pos_b)] == -1)
         throw "Could not find enemy den!.";
-      
+
       std::list<position_t> way = { pos_b };
-      while (way.back() != pos_a) {
-        way.push_back({visited[way.back()].first, visited[way.back()].second});
-      }
+      for (int i=Index(pos_b); i!=Index(pos_a); i=parents[i])
+        way.push_back(Position(parents[i]));
       //Reverse path and return.
       std::reverse(std::begin(way), std::end(way));
       return way;
     }
 
   private:
-    std::map<position_t, Node*> nodes_;
+    int lines_;
+    int cols_;
+    size_t size_;
+    std::vector<bool> passable_;
+
+    bool InGrid(position_t pos) const {
+      return pos.first >= 0 && pos.first < lines_ && pos.second >= 0 && pos.second < cols_;
+    }
+    int Index(position_t pos) const {
+      return pos.first*cols_ + pos.second;
+    }
+    position_t Position(int index) const {
+      return {index/cols_, index%cols_};
+    }
+
+    /**
+     * Breadth-first search from start until target is reached (or all
+     * reachable nodes are visited). Neighbors are visited line by line.
+     * @param[in] pos_a start (must be in graph, otherwise nothing is visited).
+     * @param[in] pos_b target (or {-1, -1} to visit all reachable nodes).
+     * @return parent index per index (-1: not visited, start: itself).
+     */
+    std::vector<int> Search(position_t pos_a, position_t pos_b) const {
+      std::vector<int> parents(passable_.size(), -1);
+      if (!InGraph(pos_a))
+        return parents;
+      std::vector<int> queue = { Index(pos_a) };
+      parents[queue.front()] = queue.front();
+      int target = InGraph(pos_b) ? Index(pos_b) : -1;
+      for (size_t next=0; next<queue.size(); next++) {
+        int cur = queue[next];
+        // Check if desired node was found.
+        if (cur == target)
+          break;
+        // iterate over neighbors.
+        int line = cur/cols_;
+        int col = cur%cols_;
+        for (int l=std::max(0, line-1); l<=std::min(lines_-1, line+1); l++) {
+          for (int c=std::max(0, col-1); c<=std::min(cols_-1, col+1); c++) {
+            int i = l*cols_ + c;
+            if (passable_[i] && parents[i] == -1) {
+              parents[i] = cur;
+              queue.push_back(i);
+            }
+          }
+        }
+      }
+      return parents;
+    }
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "utils.h"
 #include "curses.h"
 #include "nlohmann/json.hpp"
+#include "random/counter_rng.h"
 #include <cctype>
 #include <cstddef>
 #include <cstdlib>
@@ -82,6 +83,14 @@ std::vector<std::string> utils::GetAllPathsInDirectory(std::string path) {
   return paths;
 }
 
+std::string utils::ResolvePath(std::string path, std::string base_path) {
+  if (path.find("$(HOME)") != std::string::npos)
+    return getenv("HOME") + path.substr(path.find("/"));
+  else if (path.find("$(DISSONANCE)") != std::string::npos)
+    return base_path + path.substr(path.find("/"));
+  return path;
+}
+
 std::string utils::Dtos(double value, unsigned int precision) {
   std::stringstream stream;
   stream << std::fixed << std::setprecision(precision) << value;
@@ -91,7 +100,7 @@ std::string utils::Dtos(double value, unsigned int precision) {
 std::string utils::CreateId(std::string type) {
   std::string id = type;
   for (int i=0; i<32; i++) {
-    int ran = rand() % 9;
+    int ran = CounterRng::ThreadLocal().Next(0, 8);
     id += std::to_string(ran);
   }
   return id;
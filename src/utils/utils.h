@@ -86,6 +86,14 @@ namespace utils {
    */
   std::vector<std::string> GetAllPathsInDirectory(std::string path);
 
+  /**
+   * Replaces placeholders `$(HOME)` and `$(DISSONANCE)` in given path.
+   * @param[in] path
+   * @param[in] base_path path to dissonance files (replaces `$(DISSONANCE)`).
+   * @return path with placeholders replaced.
+   */
+  std::string ResolvePath(std::string path, std::string base_path);
+
   /**
    * Gets string representation of double value with given precision.
    * @param[in] value
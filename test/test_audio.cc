@@ -1,20 +1,46 @@
 #include "catch2/catch.hpp"
 #include "audio/audio.h"
+#include "audio/beat_cursor.h"
+#include "audio/beat_dispatcher.h"
+#include "audio/decimator.h"
+#include "audio/feature_extractor.h"
+#include "audio/level_meter.h"
+#include "audio/library_analyzer.h"
+#include "audio/pcm_buffer.h"
+#include "audio/pcm_stream.h"
+#include "audio/playback_stream.h"
+#include "audio/ring_buffer.h"
+#include "audio/versioned_timeline.h"
 #include "constants/codes.h"
+#include "game/field.h"
+#include "random/random.h"
+#include "utils/utils.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
-const std::vector<std::string> note_names_ = {
-  "C", "C#", "D", "Eb", "E", "F", "F#", "G", "Ab", "A", "Bb", "B"
-};
-
 Note ConvertMidiToNote(int midi_note) {
-  Note note = Note();
-  note.midi_note_ = midi_note;
-  note.note_ = (midi_note-24)%12;
-  note.note_name_ = note_names_[note.note_];
-  note.ocatve_ = (midi_note-12)/12;
-  return note;
+  return Note::FromMidi(midi_note);
+}
+
+void WriteWav(std::string path, const std::vector<float>& frames, unsigned int channels, unsigned int samplerate) {
+  ma_encoder_config config = ma_encoder_config_init(ma_resource_format_wav, ma_format_f32, channels, samplerate);
+  ma_encoder encoder;
+  REQUIRE(ma_encoder_init_file(path.c_str(), &config, &encoder) == MA_SUCCESS);
+  ma_encoder_write_pcm_frames(&encoder, frames.data(), frames.size()/channels);
+  ma_encoder_uninit(&encoder);
 }
 
 TEST_CASE("test createing intervals", "[main]") {
@@ -37,12 +63,1324 @@ TEST_CASE("test analysing audio", "[main]") {
   SECTION("test analysing wav-file") {
     audio.set_source_path("dissonance/data/examples/elle_rond_elle_bon_et_blonde.wav");
     audio.Analyze();
-    REQUIRE(audio.analysed_data().data_per_beat_.size() > 0);
+    REQUIRE(audio.analysed_data()->data_per_beat_.size() > 0);
   }
 
   SECTION("test analysing mp3-file") {
     audio.set_source_path("dissonance/data/examples/airtone_-_blackSnow_1.mp3");
     audio.Analyze();
-    REQUIRE(audio.analysed_data().data_per_beat_.size() > 0);
+    REQUIRE(audio.analysed_data()->data_per_beat_.size() > 0);
+  }
+}
+
+TEST_CASE("test segmented analysis matches sequential analysis", "[main]") {
+  // Tolerances of segmented compared to sequential analysis.
+  const double max_beat_count_deviation = 0.02;
+  const double max_beat_time_deviation = 30;  // ms
+  const double min_matching_beats = 0.95;
+  const double max_bpm_deviation = 0.02;
+
+  Audio::Initialize();
+  Audio sequential("dissonance");
+  sequential.set_source_path("dissonance/data/examples/airtone_-_blackSnow_1.mp3");
+  sequential.Analyze();
+  auto sequential_beats = sequential.analysed_data()->data_per_beat_;
+  REQUIRE(sequential_beats.size() > 0);
+
+  // Analyse with store in other directory, so sequential result is not loaded from cache.
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_segments";
+  std::filesystem::remove_all(base_path);
+  // Segments shorter than default, so example song is split regardless of it's length.
+  const double segment_min_length = 20000;  // ms
+  REQUIRE(sequential.analysed_data()->duration_ >= 2*segment_min_length);
+  Audio segmented(base_path);
+  segmented.set_analysis_threads(4);
+  segmented.set_segment_min_length(segment_min_length);
+  segmented.set_source_path("dissonance/data/examples/airtone_-_blackSnow_1.mp3");
+  segmented.Analyze();
+  REQUIRE(segmented.num_segments() > 1);
+  auto segmented_beats = segmented.analysed_data()->data_per_beat_;
+  std::filesystem::remove_all(base_path);
+
+  double beat_count_deviation = std::abs(static_cast<double>(segmented_beats.size()) - sequential_beats.size())
+    / sequential_beats.size();
+  REQUIRE(beat_count_deviation <= max_beat_count_deviation);
+  size_t matching = 0;
+  auto it = sequential_beats.begin();
+  for (const auto& beat : segmented_beats) {
+    while (std::next(it) != sequential_beats.end() && std::next(it)->time_ <= beat.time_)
+      it++;
+    double deviation = std::abs(it->time_ - beat.time_);
+    if (std::next(it) != sequential_beats.end())
+      deviation = std::min(deviation, std::abs(std::next(it)->time_ - beat.time_));
+    if (deviation <= max_beat_time_deviation)
+      matching++;
+  }
+  REQUIRE(static_cast<double>(matching)/segmented_beats.size() >= min_matching_beats);
+  REQUIRE(std::abs(segmented.analysed_data()->average_bpm_ - sequential.analysed_data()->average_bpm_) 
+      <= sequential.analysed_data()->average_bpm_*max_bpm_deviation);
+}
+
+TEST_CASE("test stitching segments", "[main]") {
+  // Beats every 500ms (120 bpm), segment boundary at 10000ms. Second segment
+  // detects last beat of first segment (9990ms) slightly later (10002ms).
+  std::vector<AudioDataTimePoint> first;
+  std::vector<AudioDataTimePoint> second;
+  for (double time=490; time<12000; time+=500)
+    first.push_back({time, 120, 50, {}, 0});
+  for (double time=8002; time<20000; time+=500)
+    second.push_back({time, (time < 11000) ? 240 : 121, 50, {}, 0});
+
+  std::vector<AudioDataTimePoint> beats;
+  Audio::StitchSegment(beats, first, 0, 10000);
+  REQUIRE(beats.size() == 20);
+  REQUIRE(beats.back().time_ == 9990);
+  Audio::StitchSegment(beats, second, 10000, 20000);
+
+  // Warm-up beats and duplicate of second segment are dropped.
+  REQUIRE(beats[20].time_ == 10502);
+  // Beats are ordered and no two beats closer than half a beat.
+  for (size_t i=1; i<beats.size(); i++)
+    REQUIRE(beats[i].time_ - beats[i-1].time_ >= 250);
+  // Doubled bpm within first overlap reconciled, later bpm kept.
+  for (const auto& it : beats) {
+    if (it.time_ < 11000) 
+      REQUIRE(it.bpm_ == 120);
+    else
+      REQUIRE(it.bpm_ == 121);
+  }
+}
+
+TEST_CASE("test collecting music library", "[main]") {
+  // Set up library with nested directory, non-audio files and a recently
+  // played song also found in music paths.
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_library";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path + "/settings");
+  std::filesystem::create_directories(base_path + "/music/album");
+  for (const auto& it : {"/music/a.mp3", "/music/album/b.wav", "/music/album/c.txt", "/single.mp3"})
+    std::ofstream(base_path + it) << "no audio";
+  nlohmann::json music_paths = {"$(DISSONANCE)/music"};
+  utils::WriteJsonFromDisc(base_path + "/settings/music_paths.json", music_paths);
+  nlohmann::json recently_played = {base_path + "/single.mp3", base_path + "/music/a.mp3"};
+  utils::WriteJsonFromDisc(base_path + "/settings/recently_played.json", recently_played);
+
+  LibraryAnalyzer library_analyzer(base_path, 2);
+  REQUIRE(library_analyzer.num_threads() == 2);
+  auto audio_files = library_analyzer.GetUncachedAudioFiles();
+  REQUIRE(audio_files.size() == 3);
+  REQUIRE(std::find(audio_files.begin(), audio_files.end(), base_path + "/music/album/b.wav") != audio_files.end());
+
+  // Invalid audio-files are skipped without stopping other workers.
+  REQUIRE(library_analyzer.Run() == 0);
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test binary analysis file", "[main]") {
+  AudioData audio_data = AudioData();
+  audio_data.average_bpm_ = 120.5;
+  audio_data.average_level_ = 42.25;
+  audio_data.duration_ = 1800.0;
+  audio_data.profile_ = PROFILE_FAST;
+  audio_data.samplerate_ = 11025;
+  audio_data.data_per_beat_.push_back({500.0, 120, 40, {ConvertMidiToNote(60), ConvertMidiToNote(67)}, 0});
+  audio_data.data_per_beat_.push_back({1000.0, 121, 44, {}, 0});
+  audio_data.data_per_beat_.push_back({1500.5, 119, 43, {ConvertMidiToNote(87)}, 1});
+  std::string path = std::filesystem::temp_directory_path().string() + "/dissonance_test" ANALYSIS_FILE_EXTENSION;
+
+  SECTION("test writing and loading binary file") {
+    AnalysisFile::Write(path, audio_data);
+    REQUIRE(std::filesystem::file_size(path) == AnalysisFile::FileSize(3, 3));
+    AudioData loaded = Audio::Load(path);
+    REQUIRE(loaded.average_bpm_ == audio_data.average_bpm_);
+    REQUIRE(loaded.average_level_ == audio_data.average_level_);
+    REQUIRE(loaded.duration_ == audio_data.duration_);
+    REQUIRE(loaded.profile_ == PROFILE_FAST);
+    REQUIRE(loaded.samplerate_ == 11025);
+    REQUIRE(loaded.data_per_beat_.size() == 3);
+    auto it = audio_data.data_per_beat_.begin();
+    for (const auto& beat : loaded.data_per_beat_) {
+      REQUIRE(beat.time_ == it->time_);
+      REQUIRE(beat.bpm_ == it->bpm_);
+      REQUIRE(beat.level_ == it->level_);
+      REQUIRE(beat.interval_ == it->interval_);
+      REQUIRE(beat.notes_.size() == it->notes_.size());
+      for (size_t i=0; i<beat.notes_.size(); i++) {
+        REQUIRE(beat.notes_[i].midi_note_ == it->notes_[i].midi_note_);
+        REQUIRE(beat.notes_[i].note_name() == it->notes_[i].note_name());
+      }
+      it++;
+    }
+  }
+
+  SECTION("test truncated file is rejected") {
+    AnalysisFile::Write(path, audio_data);
+    std::filesystem::resize_file(path, AnalysisFile::FileSize(3, 3)-1);
+    REQUIRE_THROWS(Audio::Load(path));
+  }
+
+  SECTION("test json export and import") {
+    Audio::SafeJson(audio_data, path);
+    AudioData loaded = Audio::LoadJson(path);
+    REQUIRE(loaded.data_per_beat_.size() == 3);
+    REQUIRE(loaded.data_per_beat_.back().notes_.front().midi_note_ == 87);
+  }
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("test content-addressed analysis store", "[main]") {
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_store";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path + "/music");
+  std::ofstream(base_path + "/music/a.mp3") << "some audio bytes";
+
+  SECTION("test digest (xxh64)") {
+    REQUIRE(AnalysisStore::Digest("", 0) == 0xEF46DB3751D8E999ULL);
+    REQUIRE(AnalysisStore::Digest("abc", 3) == 0x44BC2CF5AD770999ULL);
+    std::string long_str = "Nobody inspects the spammish repetition";
+    REQUIRE(AnalysisStore::Digest(long_str.c_str(), long_str.size()) == 0xFBCEA83C8A378BF1ULL);
+  }
+
+  SECTION("test moving file keeps key, changing content changes key") {
+    AnalysisStore store(base_path);
+    std::string key = store.GetKey(base_path + "/music/a.mp3");
+    REQUIRE(key.find(Audio::AnalysisVersion()) != std::string::npos);
+    std::filesystem::rename(base_path + "/music/a.mp3", base_path + "/b.mp3");
+    REQUIRE(store.GetKey(base_path + "/b.mp3") == key);
+    std::ofstream(base_path + "/b.mp3") << "re-encoded audio bytes";
+    REQUIRE(store.GetKey(base_path + "/b.mp3") != key);
+    REQUIRE(store.GetKey(base_path + "/missing.mp3") == "");
+  }
+
+  SECTION("test side index is persisted") {
+    std::string key;
+    {
+      AnalysisStore store(base_path);
+      key = store.GetKey(base_path + "/music/a.mp3");
+    }
+    nlohmann::json index = utils::LoadJsonFromDisc(base_path + "/data/analysis/index.json");
+    REQUIRE(index["paths"].contains(base_path + "/music/a.mp3"));
+    AnalysisStore store(base_path);
+    REQUIRE(store.GetKey(base_path + "/music/a.mp3") == key);
+    REQUIRE(store.Contains(key) == false);
+  }
+
+  SECTION("test cached lookup does not check unrelated index entries") {
+    std::string stale_path = base_path + "/music/removed.mp3";
+    {
+      AnalysisStore store(base_path);
+      std::ofstream(stale_path) << "removed audio bytes";
+      REQUIRE(store.GetKey(stale_path) != "");
+      REQUIRE(store.GetKey(base_path + "/music/a.mp3") != "");
+    }
+    std::filesystem::remove(stale_path);
+    {
+      // Cached load: key lookup, touch and index write only.
+      AnalysisStore store(base_path);
+      std::string key = store.GetKey(base_path + "/music/a.mp3");
+      store.Add(store.GetPath(key), 10);
+      store.Touch(store.GetPath(key));
+      store.SafeIndex();
+      nlohmann::json index = utils::LoadJsonFromDisc(base_path + "/data/analysis/index.json");
+      REQUIRE(index["paths"].contains(stale_path));
+      // Stale entries are only forgotten when pruning explicitly.
+      REQUIRE(store.PrunePaths() == 1);
+      REQUIRE(store.PrunePaths() == 0);
+      store.SafeIndex();
+    }
+    nlohmann::json index = utils::LoadJsonFromDisc(base_path + "/data/analysis/index.json");
+    REQUIRE(index["paths"].contains(stale_path) == false);
+    REQUIRE(index["paths"].contains(base_path + "/music/a.mp3"));
+  }
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test size-capped lru analysis store", "[main]") {
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_lru";
+  std::string analysis_path = base_path + "/data/analysis/";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(analysis_path);
+  auto write_file = [&](std::string key, std::string extension) {
+    std::ofstream(analysis_path + key + extension) << std::string(40, 'x');
+    return analysis_path + key + extension;
+  };
+
+  {
+    AnalysisStore store(base_path, 100);
+    std::string a = write_file("a_v1", ANALYSIS_FILE_EXTENSION);
+    std::string b = write_file("b_v1", ANALYSIS_FILE_EXTENSION);
+    store.Add(a, 40);
+    store.Add(b, 40);
+    REQUIRE(store.Contains("a_v1"));
+    REQUIRE(store.Contains("c_v1") == false);
+    REQUIRE(store.total_size() == 80);
+    // Using a makes b the least recently used file, evicted once budget is exceeded.
+    REQUIRE(store.Touch(a));
+    REQUIRE(store.Touch(analysis_path + "missing.dsna") == false);
+    store.Add(write_file("c", PCM_FILE_EXTENSION), 40);
+    store.WaitForCompaction();
+    REQUIRE(store.num_files() == 2);
+    REQUIRE(store.total_size() == 80);
+    REQUIRE(store.Contains("b_v1") == false);
+    REQUIRE(std::filesystem::exists(b) == false);
+    REQUIRE(std::filesystem::exists(a));
+    // The most recently used file is kept, even if exceeding the budget alone.
+    store.set_budget(10);
+    store.WaitForCompaction();
+    REQUIRE(store.num_files() == 1);
+    REQUIRE(std::filesystem::exists(analysis_path + "c" PCM_FILE_EXTENSION));
+    store.set_budget(100);
+    store.Add(write_file("a_v1", ANALYSIS_FILE_EXTENSION), 40);
+  }
+
+  SECTION("test index is persisted in lru order") {
+    AnalysisStore store(base_path, 100);
+    REQUIRE(store.num_files() == 2);
+    REQUIRE(store.total_size() == 80);
+    REQUIRE(store.Contains("a_v1"));
+    // c is least recently used.
+    store.Add(write_file("d_v1", ANALYSIS_FILE_EXTENSION), 40);
+    store.WaitForCompaction();
+    REQUIRE(std::filesystem::exists(analysis_path + "c" PCM_FILE_EXTENSION) == false);
+    REQUIRE(store.Contains("a_v1"));
+  }
+
+  SECTION("test files are listed once, if index has no file list") {
+    nlohmann::json index = nlohmann::json::object();  // old format: paths only.
+    utils::WriteJsonFromDisc(analysis_path + "index.json", index);
+    std::ofstream(analysis_path + "ignored.tmp") << "x";
+    AnalysisStore store(base_path, 100);
+    REQUIRE(store.num_files() == 2);
+    REQUIRE(store.Contains("a_v1"));
+    std::filesystem::remove(analysis_path + "index.json");
+    AnalysisStore rebuilt(base_path, 50);
+    rebuilt.WaitForCompaction();
+    REQUIRE(rebuilt.num_files() == 1);
+  }
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test streaming beat timeline", "[main]") {
+  BeatTimeline timeline;
+  size_t num_intervals = 4;
+  size_t beats_per_interval = 3000;  // spans several chunks.
+  timeline.Reset(num_intervals*beats_per_interval*10.0);
+  REQUIRE(timeline.size() == 0);
+  REQUIRE(timeline.finished() == false);
+
+  // Producer publishes key of each interval, followed by it's beats.
+  std::thread producer([&]() {
+    for (size_t i=0; i<num_intervals; i++) {
+      Interval interval = Interval();
+      interval.id_ = i;
+      interval.key_ = (i%2 == 0) ? "C" : "Am";
+      timeline.AddInterval(interval);
+      for (size_t j=0; j<beats_per_interval; j++) {
+        double time = (i*beats_per_interval+j)*10.0;
+        timeline.AddBeat({time, 100, static_cast<int>(i*10+j%10), {}, static_cast<int>(i)});
+      }
+    }
+    timeline.Finish();
+  });
+
+  // Lead contains all beats of first interval (and only those).
+  timeline.WaitFor(1);
+  REQUIRE(timeline.num_intervals() >= 2);
+  REQUIRE(timeline.size() >= beats_per_interval);
+  AudioData lead = timeline.Snapshot(1);
+  REQUIRE(lead.data_per_beat_.size() == beats_per_interval);
+  REQUIRE(lead.intervals_.size() == 1);
+  REQUIRE(lead.average_bpm_ == 100);
+  REQUIRE(lead.average_level_ == Approx(4.5));
+  REQUIRE(lead.max_peak_ == 4);  // peak above average level.
+
+  // Consumer reads published beats in order while producer keeps adding.
+  size_t next_beat = 0;
+  double last_time = -1;
+  while (!timeline.finished() || next_beat < timeline.size()) {
+    if (next_beat >= timeline.size())
+      continue;
+    const auto& beat = timeline.at(next_beat++);
+    REQUIRE(beat.time_ > last_time);
+    REQUIRE(timeline.interval(beat.interval_).id_ == static_cast<size_t>(beat.interval_));
+    last_time = beat.time_;
+  }
+  producer.join();
+  REQUIRE(next_beat == num_intervals*beats_per_interval);
+  REQUIRE(timeline.ExpectedSize() == timeline.size());
+  REQUIRE(timeline.interval(3).key_ == "Am");
+}
+
+TEST_CASE("test paging beat timeline", "[main]") {
+  Audio::Initialize();
+  BeatTimeline timeline;
+  size_t num_chunks = 4*TIMELINE_WINDOW_CHUNKS;
+  size_t num_beats = num_chunks*TIMELINE_CHUNK_SIZE + 10;
+  timeline.Reset(num_beats*100.0);
+  Interval interval = Interval();
+  interval.key_mask_ = Audio::KeyMask(0, true);
+  timeline.AddInterval(interval);
+  // Only beat 5000 has off-key notes (C#), all others one or two notes.
+  for (size_t i=0; i<num_beats; i++) {
+    std::vector<Note> notes = {ConvertMidiToNote((i == 5000) ? 61 : 60)};
+    if (i%2 == 0)
+      notes.push_back(ConvertMidiToNote(64 + i%3));
+    timeline.AddBeat({i*100.0, static_cast<int>(100+i%50), static_cast<int>(i%100), notes, 0});
+  }
+  timeline.Finish();
+
+  // Memory is bounded by window (and chunk filled last), independent of number of beats.
+  REQUIRE(timeline.resident_chunks() <= TIMELINE_WINDOW_CHUNKS+1);
+
+  SECTION("test reading all beats pages chunks in and out") {
+    for (size_t i=0; i<num_beats; i++) {
+      auto beat = timeline.at(i);
+      REQUIRE(beat.time_ == i*100.0);
+      REQUIRE(beat.bpm_ == static_cast<int>(100+i%50));
+      REQUIRE(beat.notes_.size() == ((i%2 == 0) ? 2u : 1u));
+      if (i%2 == 0)
+        REQUIRE(beat.notes_[1].midi_note_ == 64 + i%3);
+      REQUIRE(timeline.resident_chunks() <= TIMELINE_WINDOW_CHUNKS+1);
+    }
+    // Reading backwards pages in evicted chunks again.
+    REQUIRE(timeline.at(0).time_ == 0);
+    REQUIRE(timeline.MoreOffNotes(5000) == true);
+  }
+
+  SECTION("test seeking and next off-note beat across chunks") {
+    REQUIRE(timeline.Seek(-1) == 0);
+    REQUIRE(timeline.Seek(0) == 1);
+    REQUIRE(timeline.Seek(TIMELINE_CHUNK_SIZE*100.0 - 50) == TIMELINE_CHUNK_SIZE);
+    REQUIRE(timeline.Seek(TIMELINE_CHUNK_SIZE*100.0) == TIMELINE_CHUNK_SIZE+1);
+    REQUIRE(timeline.Seek(123456789) == num_beats);
+    REQUIRE(timeline.NextOffNotes(0) == 5000);
+    REQUIRE(timeline.NextOffNotes(5000) == 5000);
+    REQUIRE(timeline.NextOffNotes(5001) == num_beats);
+    REQUIRE(timeline.resident_chunks() <= TIMELINE_WINDOW_CHUNKS+1);
+  }
+
+  SECTION("test chunks not read back from page file") {
+    // Truncate page file (the only unlinked temporary file opened).
+    size_t truncated = 0;
+    for (const auto& it : std::filesystem::directory_iterator("/proc/self/fd")) {
+      std::error_code ec;
+      std::string target = std::filesystem::read_symlink(it.path(), ec).string();
+      if (!ec && target.find("(deleted)") != std::string::npos && truncate(it.path().c_str(), 0) == 0)
+        truncated++;
+    }
+    REQUIRE(truncated == 1);
+    // Evicted chunks are read as beats without notes at time of chunk's first beat.
+    size_t first = 2*TIMELINE_WINDOW_CHUNKS*TIMELINE_CHUNK_SIZE;
+    auto beat = timeline.at(first+1);
+    REQUIRE(beat.time_ == first*100.0);
+    REQUIRE(beat.notes_.size() == 0);
+    REQUIRE(timeline.time(first+TIMELINE_CHUNK_SIZE+1) == (first+TIMELINE_CHUNK_SIZE)*100.0);
+    REQUIRE(timeline.Seek(first*100.0 + 50) == first);
+    REQUIRE(timeline.MoreOffNotes(5000) == false);
+    REQUIRE(timeline.NextOffNotes(5000) == num_beats);
+    // Resident chunks are still read.
+    REQUIRE(timeline.at(num_beats-1).time_ == (num_beats-1)*100.0);
+    REQUIRE(timeline.at(1).time_ == 100.0);
+  }
+}
+
+TEST_CASE("test beat timeline without paging spills surplus notes", "[main]") {
+  BeatTimeline timeline;
+  size_t num_beats = 3*TIMELINE_CHUNK_SIZE;
+  size_t notes_per_beat = 2*TIMELINE_CHUNK_NOTES/TIMELINE_CHUNK_SIZE;
+  timeline.Reset(num_beats*100.0, false);
+  timeline.AddInterval(Interval());
+  for (size_t i=0; i<num_beats; i++) {
+    std::vector<Note> notes;
+    for (size_t j=0; j<notes_per_beat; j++)
+      notes.push_back(ConvertMidiToNote(40 + (i+j)%40));
+    timeline.AddBeat({i*100.0, 100, 0, notes, 0});
+  }
+  timeline.Finish();
+
+  // All chunks are kept in memory.
+  REQUIRE(timeline.resident_chunks() == 3);
+  // Notes of beats in second half of each chunk exceed chunk, but are not lost.
+  for (size_t i : {static_cast<size_t>(0), static_cast<size_t>(TIMELINE_CHUNK_SIZE-1), num_beats-1}) {
+    auto beat = timeline.at(i);
+    REQUIRE(beat.notes_.size() == notes_per_beat);
+    for (size_t j=0; j<notes_per_beat; j++)
+      REQUIRE(beat.notes_[j].midi_note_ == 40 + (i+j)%40);
+  }
+}
+
+TEST_CASE("test column-wise beat data", "[main]") {
+  BeatData beats;
+  size_t num_beats = 10000;
+  beats.reserve(num_beats, num_beats*2);
+  for (size_t i=0; i<num_beats; i++) {
+    std::vector<Note> notes;
+    for (size_t j=0; j<i%4; j++)
+      notes.push_back(ConvertMidiToNote(60+i%12+j));
+    beats.push_back({i*500.0, static_cast<int>(100+i%40), static_cast<int>(i%90), notes, static_cast<int>(i%8)});
+  }
+  REQUIRE(beats.size() == num_beats);
+  REQUIRE(beats.note_offsets().size() == num_beats+1);
+  REQUIRE(beats.note_pool().size() == (num_beats/4)*6);
+
+  // Beats are assembled as before, incl. note names.
+  auto beat = beats.at(15);
+  REQUIRE(beat.time_ == 7500.0);
+  REQUIRE(beat.bpm_ == 115);
+  REQUIRE(beat.level_ == 15);
+  REQUIRE(beat.interval_ == 7);
+  REQUIRE(beat.notes_.size() == 3);
+  REQUIRE(beat.notes_[0].midi_note_ == 63);
+  REQUIRE(beat.notes_[0].note_name() == "Eb");
+  REQUIRE(beat.notes_[2].note_name() == "F");
+  REQUIRE(beats.back().time_ == (num_beats-1)*500.0);
+  size_t counter = 0;
+  for (const auto& it : beats)
+    REQUIRE(it.time_ == (counter++)*500.0);
+
+  // Less than 44 bytes per beat (incl. 1.5 notes per beat on average and
+  // chroma), a list of beats owning note vectors took ~250 bytes.
+  REQUIRE(beats.MemoryUsage()/num_beats < 44);
+
+  // Appending raw columns (as from a mapped file) keeps notes of each beat.
+  BeatData copy;
+  copy.push_back(beats.at(0));
+  copy.Append(2, &beats.times()[2], &beats.bpms()[2], &beats.levels()[2], &beats.intervals()[2],
+      &beats.note_offsets()[2], beats.note_pool().data(), beats.chromas()[2].data());
+  REQUIRE(copy.size() == 3);
+  REQUIRE(copy.num_notes(1) == 2);
+  REQUIRE(copy.num_notes(2) == 3);
+  REQUIRE(copy.at(2).notes_[0].midi_note_ == beats.at(3).notes_[0].midi_note_);
+}
+
+TEST_CASE("test pitch-class masks", "[main]") {
+  Audio::Initialize();
+  // Keys contain seven pitch classes, starting at the key note.
+  for (size_t i=0; i<12; i++) {
+    for (bool major : {false, true}) {
+      REQUIRE(__builtin_popcount(Audio::KeyMask(i, major)) == 7);
+      REQUIRE((Audio::KeyMask(i, major) & (1 << i)) != 0);
+    }
+  }
+  // "CMajor": C, D, Eb, F, G, Ab, Bb
+  REQUIRE(Audio::KeyMask(0, true) == 0b010110101101);
+  REQUIRE(Note::Mask({ConvertMidiToNote(60), ConvertMidiToNote(72), ConvertMidiToNote(64)}) == 0b10001);
+
+  // Off-key status is precomputed when beat is published.
+  BeatTimeline timeline;
+  timeline.Reset(2000);
+  Interval interval = Interval();
+  interval.key_ = "CMajor";
+  interval.key_mask_ = Audio::KeyMask(0, true);
+  timeline.AddInterval(interval);
+  timeline.AddBeat({0, 120, 50, {ConvertMidiToNote(61), ConvertMidiToNote(64)}, 0});  // C#, E: off
+  timeline.AddBeat({500, 120, 50, {ConvertMidiToNote(60), ConvertMidiToNote(62)}, 0});  // C, D: in key
+  timeline.AddBeat({1000, 120, 50, {ConvertMidiToNote(60), ConvertMidiToNote(61)}, 0});  // C, C#: mixed
+  timeline.AddBeat({1500, 120, 50, {}, 0});
+  timeline.Finish();
+  REQUIRE(timeline.MoreOffNotes(0) == true);
+  REQUIRE(timeline.MoreOffNotes(0, false) == false);
+  REQUIRE(timeline.MoreOffNotes(1) == false);
+  REQUIRE(timeline.MoreOffNotes(1, false) == true);
+  for (size_t i : {2, 3}) {
+    REQUIRE(timeline.MoreOffNotes(i) == false);
+    REQUIRE(timeline.MoreOffNotes(i, false) == false);
+  }
+}
+
+TEST_CASE("test seeking beat timeline", "[main]") {
+  Audio::Initialize();
+  auto shared_timeline = std::make_shared<BeatTimeline>();
+  BeatTimeline& timeline = *shared_timeline;
+  timeline.Reset(10000);
+  Interval interval = Interval();
+  interval.key_mask_ = Audio::KeyMask(0, true);
+  timeline.AddInterval(interval);
+  // Beats every 100ms, every 7th beat has only off-key notes (C#).
+  size_t num_beats = 3000;
+  for (size_t i=0; i<num_beats; i++) {
+    std::vector<Note> notes = {ConvertMidiToNote((i%7 == 3) ? 61 : 60)};
+    timeline.AddBeat({i*100.0, 120, 50, notes, 0});
+  }
+
+  SECTION("test seeking by time") {
+    REQUIRE(timeline.Seek(-1) == 0);
+    REQUIRE(timeline.Seek(0) == 1);
+    REQUIRE(timeline.Seek(50) == 1);
+    REQUIRE(timeline.Seek(100) == 2);
+    REQUIRE(timeline.Seek(123456789) == num_beats);
+  }
+
+  SECTION("test next off-note beat") {
+    for (size_t i=0; i<num_beats; i++) {
+      size_t expected = i;
+      while (expected < num_beats && expected%7 != 3)
+        expected++;
+      // Beats after last off-note beat do not know their next one yet.
+      if (i > num_beats-7 && expected == num_beats)
+        REQUIRE(timeline.NextOffNotes(i) == num_beats);
+      else
+        REQUIRE(timeline.NextOffNotes(i) == expected);
+    }
+  }
+
+  SECTION("test shared cursor") {
+    VersionedTimeline timelines;
+    timelines.Swap(shared_timeline);
+    BeatCursor cursor(timelines);
+    cursor.Start(250);
+    REQUIRE(cursor.position() == 3);
+    cursor.Pause();
+    double paused_at = cursor.elapsed();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE(cursor.elapsed() == paused_at);
+    cursor.Unpause();
+    REQUIRE(cursor.elapsed() < paused_at + 20);
+    REQUIRE(cursor.finished() == false);
+    cursor.Start(num_beats*100.0);
+    timeline.Finish();
+    REQUIRE(cursor.finished() == true);
+
+    // External clock replaces steady clock, pausing is up to the clock.
+    double clock = 250;
+    cursor.set_clock([&clock]() { return clock; });
+    cursor.Start();
+    REQUIRE(cursor.position() == 3);
+    cursor.Pause();
+    clock = 450;
+    REQUIRE(cursor.elapsed() == 450);
+    REQUIRE(cursor.position() == 5);
+  }
+
+  SECTION("test swapping in refined timeline") {
+    VersionedTimeline timelines;
+    timelines.Swap(shared_timeline);
+    BeatCursor cursor(timelines);
+    std::shared_ptr<const BeatTimeline> snapshot;
+    size_t version = 0;
+    size_t next_beat = 0;
+    REQUIRE(cursor.Refresh(snapshot, version, next_beat) == true);
+    REQUIRE(snapshot == shared_timeline);
+    REQUIRE(cursor.Refresh(snapshot, version, next_beat) == false);
+    next_beat = 10;  // handled all beats up to 900ms.
+
+    // Refined timeline has a beat every 50ms.
+    auto refined = std::make_shared<BeatTimeline>();
+    refined->Reset(10000);
+    refined->AddInterval(interval);
+    for (size_t i=0; i<2*num_beats; i++)
+      refined->AddBeat({i*50.0, 120, 50, {}, 0});
+    refined->Finish();
+    timelines.Swap(refined);
+
+    // Snapshot held stays valid until re-acquired, then continues after last beat handled.
+    REQUIRE(snapshot->size() == num_beats);
+    REQUIRE(cursor.Refresh(snapshot, version, next_beat) == true);
+    REQUIRE(snapshot == refined);
+    REQUIRE(version == timelines.version());
+    REQUIRE(next_beat == 19);
+    REQUIRE(snapshot->time(next_beat) == 950);
+    cursor.Start(2000);
+    REQUIRE(cursor.position(*snapshot) == 41);
+    REQUIRE(cursor.position() == 41);
+  }
+}
+
+TEST_CASE("test beat dispatcher", "[main]") {
+  Audio::Initialize();
+  // Beats every 100ms, every 7th beat has only off-key notes (C#).
+  Interval interval = Interval();
+  interval.key_mask_ = Audio::KeyMask(0, true);
+  auto timeline = std::make_shared<BeatTimeline>();
+  timeline->Reset(10000);
+  timeline->AddInterval(interval);
+  for (size_t i=0; i<100; i++)
+    timeline->AddBeat({i*100.0, 120, 50, {ConvertMidiToNote((i%7 == 3) ? 61 : 60)}, 0});
+  timeline->Finish();
+  VersionedTimeline timelines;
+  timelines.Swap(timeline);
+  BeatCursor cursor(timelines);
+  std::atomic<double> clock(-1);
+  cursor.set_clock([&clock]() { return clock.load(); });
+
+  // Subscriber with small queue is waited for.
+  BeatDispatcher dispatcher(cursor);
+  auto queue = dispatcher.Subscribe();
+  auto small_queue = dispatcher.Subscribe(4);
+  dispatcher.Start();
+  BeatEvent event;
+  REQUIRE(queue->Pop(event, 20) == false);
+  clock = 950;
+  std::vector<double> times;
+  while (times.size() < 10 && small_queue->Pop(event, 1000))
+    times.push_back(event.data_at_beat_.time_);
+  REQUIRE(times.size() == 10);
+  REQUIRE(times.back() == 900);
+
+  // Beats of a refined timeline are dispatched from the last beat dispatched.
+  auto refined = std::make_shared<BeatTimeline>();
+  refined->Reset(10000);
+  refined->AddInterval(interval);
+  for (size_t i=0; i<200; i++)
+    refined->AddBeat({i*50.0, 120, 50, {ConvertMidiToNote((i%7 == 3) ? 61 : 60)}, 0});
+  refined->Finish();
+  timelines.Swap(refined);
+  clock = 10000;
+  while (small_queue->Pop(event, 1000))
+    times.push_back(event.data_at_beat_.time_);
+  REQUIRE(times.size() == 10+181);
+  REQUIRE(times[10] == 950);
+  REQUIRE(std::is_sorted(times.begin(), times.end()));
+  REQUIRE(std::adjacent_find(times.begin(), times.end()) == times.end());
+
+  // Every subscriber gets every beat once.
+  size_t off_notes = 0;
+  for (size_t i=0; i<times.size(); i++) {
+    REQUIRE(queue->TryPop(event));
+    REQUIRE(event.data_at_beat_.time_ == times[i]);
+    off_notes += event.off_notes_;
+  }
+  REQUIRE(queue->TryPop(event) == false);
+  REQUIRE(off_notes > 0);
+  REQUIRE(dispatcher.finished());
+  REQUIRE(dispatcher.next_beat() == refined->size());
+  dispatcher.Stop();
+}
+
+TEST_CASE("test level kernel matches scalar fallback", "[main]") {
+  // Noise of different loudness incl. silence, lengths not multiple of simd width.
+  std::vector<float> samples(4096+7);
+  for (size_t i=0; i<samples.size(); i++)
+    samples[i] = ((rand()%2000)/1000.0 - 1.0) * ((i/512)%3 == 0 ? 0.0001 : 0.8);
+
+  for (size_t n : {0, 1, 7, 8, 255, 256, 4096+7}) {
+    float scalar = LevelMeter::SumOfSquaresScalar(samples.data(), n);
+    float kernel = LevelMeter::SumOfSquares(samples.data(), n);
+    REQUIRE(kernel == Approx(scalar).epsilon(1e-5).margin(1e-12));
+  }
+  for (size_t i=0; i+256<=samples.size(); i+=256) {
+    float scalar = LevelMeter::SumOfSquaresScalar(&samples[i], 256);
+    float kernel = LevelMeter::SumOfSquares(&samples[i], 256);
+    REQUIRE(kernel == Approx(scalar).epsilon(1e-5));
+    REQUIRE(std::abs(LevelMeter::HopLevel(&samples[i], 256) - LevelMeter::HopLevel(&samples[i], 256, true)) <= 1);
+  }
+
+  // Silence is 101, full scale square wave is 100 (0 dB).
+  std::vector<float> silence(256, 0.0);
+  std::vector<float> full(256, 1.0);
+  REQUIRE(LevelMeter::HopLevel(silence.data(), 256) == 101);
+  REQUIRE(LevelMeter::HopLevel(full.data(), 256) == 100);
+
+  // Running average equals average of single hop levels.
+  LevelMeter meter;
+  double sum = 0;
+  for (size_t i=0; i+256<=samples.size(); i+=256) {
+    meter.AddHop(&samples[i], 256);
+    sum += LevelMeter::HopLevel(&samples[i], 256);
+  }
+  REQUIRE(meter.num_hops() == samples.size()/256);
+  REQUIRE(meter.TakeAverage() == static_cast<int>(sum/(samples.size()/256)));
+  REQUIRE(meter.num_hops() == 0);
+  REQUIRE(meter.TakeAverage() == 0);
+}
+
+TEST_CASE("test decoding audio once into pcm buffer", "[main]") {
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_pcm";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+
+  // Write one second of stereo wav (left: ramp, right: constant).
+  size_t samplerate = 44100;
+  std::vector<float> frames(2*samplerate);
+  for (size_t i=0; i<samplerate; i++) {
+    frames[2*i] = (i%100)/100.0;
+    frames[2*i+1] = 0.5;
+  }
+  std::string wav_path = base_path + "/test.wav";
+  WriteWav(wav_path, frames, 2, samplerate);
+
+  // Decode and write cache.
+  std::string cache_path = base_path + "/test" PCM_FILE_EXTENSION;
+  auto pcm = PcmBuffer::Decode(wav_path, cache_path);
+  REQUIRE(pcm->channels() == 2);
+  REQUIRE(pcm->samplerate() == samplerate);
+  REQUIRE(pcm->WaitFor(samplerate) == samplerate);
+  REQUIRE(pcm->num_frames() == samplerate);
+  REQUIRE(pcm->duration() == Approx(1000));
+
+  std::vector<float> mono(256);
+  REQUIRE(pcm->ReadMono(1000, mono.data(), 256) == 256);
+  for (size_t i=0; i<256; i++)
+    REQUIRE(mono[i] == Approx((frames[2*(1000+i)] + 0.5)/2));
+  // Reading at the end returns only remaining frames.
+  REQUIRE(pcm->ReadMono(samplerate-10, mono.data(), 256) == 10);
+  REQUIRE(pcm->ReadMono(samplerate, mono.data(), 256) == 0);
+
+  // Mapped cache is identical to decoded audio.
+  pcm = nullptr;  // joins decoder, which writes cache.
+  REQUIRE(std::filesystem::exists(cache_path));
+  auto cached = PcmBuffer::Open(cache_path);
+  REQUIRE(cached->complete());
+  REQUIRE(cached->channels() == 2);
+  REQUIRE(cached->samplerate() == samplerate);
+  REQUIRE(cached->num_frames() == samplerate);
+  std::vector<float> read(2*samplerate);
+  REQUIRE(cached->Read(0, read.data(), samplerate) == samplerate);
+  REQUIRE(read == frames);
+
+  // Invalid files are rejected.
+  REQUIRE_THROWS(PcmBuffer::Decode(base_path + "/missing.wav"));
+  REQUIRE_THROWS(PcmBuffer::Open(wav_path));
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test lock-free ring buffer", "[main]") {
+  RingBuffer<int> ring(5);
+  REQUIRE(ring.capacity() == 8);
+
+  SECTION("test wrapping around") {
+    std::vector<int> in = {1, 2, 3, 4, 5, 6};
+    std::vector<int> out(8);
+    REQUIRE(ring.Push(in.data(), 6) == 6);
+    REQUIRE(ring.Pop(out.data(), 4) == 4);
+    REQUIRE(ring.Push(in.data(), 6) == 6);
+    REQUIRE(ring.free() == 0);
+    REQUIRE(ring.Push(in.data(), 1) == 0);
+    REQUIRE(ring.Pop(out.data(), 8) == 8);
+    REQUIRE(out == std::vector<int>({5, 6, 1, 2, 3, 4, 5, 6}));
+    REQUIRE(ring.Pop(out.data(), 1) == 0);
+  }
+
+  SECTION("test producer and consumer threads") {
+    int num = 100000;
+    std::thread producer([&]() {
+      for (int i=0; i<num;) {
+        if (ring.Push(&i, 1) == 1)
+          i++;
+      }
+    });
+    bool in_order = true;
+    for (int expected=0; expected<num;) {
+      int value[3];
+      size_t n = ring.Pop(value, 3);
+      for (size_t i=0; i<n; i++)
+        in_order = in_order && value[i] == expected++;
+    }
+    producer.join();
+    REQUIRE(in_order);
+    REQUIRE(ring.size() == 0);
+  }
+}
+
+TEST_CASE("test playback stream", "[main]") {
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_playback";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+  std::vector<float> frames(2*20000);
+  for (size_t i=0; i<frames.size(); i++)
+    frames[i] = 0.5 + (i%100)/1000.0;
+  WriteWav(base_path + "/test.wav", frames, 2, 44100);
+  auto pcm = PcmBuffer::Decode(base_path + "/test.wav");
+  pcm->WaitFor(pcm->num_frames());
+
+  PlaybackStream stream(pcm, 4096);
+  stream.set_latency(441);
+  stream.Start();
+  while (stream.buffered() < 4096) 
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // Frames are rendered unchanged.
+  std::vector<float> out(2*512);
+  REQUIRE(stream.position() == 0);
+  REQUIRE(stream.Render(out.data(), 512) == 512);
+  REQUIRE(std::equal(out.begin(), out.end(), frames.begin()));
+  REQUIRE(stream.position() == Approx((512-441)*1000.0/44100));
+
+  // Pausing fades out at ring head, then renders silence without consuming frames.
+  stream.Pause();
+  std::vector<float> fade(2*PLAYBACK_FADE_FRAMES);
+  REQUIRE(stream.Render(fade.data(), PLAYBACK_FADE_FRAMES) == PLAYBACK_FADE_FRAMES);
+  REQUIRE(fade[0] < frames[2*512]);
+  REQUIRE(fade[0] > 0);
+  REQUIRE(fade.back() == 0);
+  double paused_at = stream.position();
+  REQUIRE(stream.Render(out.data(), 512) == 0);
+  REQUIRE(std::all_of(out.begin(), out.end(), [](float sample) { return sample == 0; }));
+  REQUIRE(stream.played_frames() == 512 + PLAYBACK_FADE_FRAMES);
+  REQUIRE(stream.position() == paused_at);
+
+  // Unpausing fades in where paused.
+  stream.Unpause();
+  REQUIRE(stream.Render(fade.data(), PLAYBACK_FADE_FRAMES) == PLAYBACK_FADE_FRAMES);
+  REQUIRE(fade.back() == frames[2*(512+2*PLAYBACK_FADE_FRAMES)-1]);
+
+  // Render until finished, never requesting more than buffered: no underruns.
+  while (!stream.finished()) {
+    size_t n = std::min(stream.buffered(), static_cast<size_t>(512));
+    if (n > 0)
+      stream.Render(out.data(), n);
+  }
+  REQUIRE(stream.played_frames() == 20000);
+  REQUIRE(stream.underruns() == 0);
+  REQUIRE(stream.overruns() == 0);
+
+  // Device periods larger than ring are counted as overruns.
+  std::vector<float> large(2*8192);
+  stream.Render(large.data(), 8192);
+  REQUIRE(stream.overruns() == 1);
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test crossfading queued audio", "[main]") {
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_crossfade";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+  WriteWav(base_path + "/first.wav", std::vector<float>(10000, 0.5), 1, 44100);
+  WriteWav(base_path + "/second.wav", std::vector<float>(10000, -0.5), 1, 44100);
+  WriteWav(base_path + "/stereo.wav", std::vector<float>(2*10000, 0), 2, 44100);
+  auto first = PcmBuffer::Decode(base_path + "/first.wav");
+  auto second = PcmBuffer::Decode(base_path + "/second.wav");
+  auto stereo = PcmBuffer::Decode(base_path + "/stereo.wav");
+  first->WaitFor(first->num_frames());
+  second->WaitFor(second->num_frames());
+
+  PlaybackStream stream(first, 4096);
+  REQUIRE_THROWS(stream.Queue(stereo, 1000));
+  REQUIRE(stream.Queue(second, 1000) == 9000);
+  stream.Start();
+  std::vector<float> out;
+  std::vector<float> period(512);
+  while (!stream.finished()) {
+    size_t n = stream.Render(period.data(), std::min(stream.buffered(), static_cast<size_t>(512)));
+    out.insert(out.end(), period.begin(), period.begin()+n);
+  }
+
+  // Last frames of first audio are mixed with first frames of second audio: no gap.
+  REQUIRE(out.size() == 19000);
+  REQUIRE(stream.underruns() == 0);
+  REQUIRE(std::all_of(out.begin(), out.begin()+9000, [](float sample) { return sample == 0.5; }));
+  REQUIRE(std::is_sorted(out.begin()+9000, out.begin()+10000, std::greater<float>()));
+  REQUIRE(out[9500] == Approx(0).margin(0.01));
+  REQUIRE(std::all_of(out.begin()+10000, out.end(), [](float sample) { return sample == -0.5; }));
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test crossfading several queued audios one after another", "[main]") {
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_crossfade_several";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+  std::vector<float> samples = {0.5, -0.5, 0.25};
+  std::vector<std::shared_ptr<PcmBuffer>> pcms;
+  for (size_t i=0; i<samples.size(); i++) {
+    WriteWav(base_path + "/" + std::to_string(i) + ".wav", std::vector<float>(10000, samples[i]), 1, 44100);
+    pcms.push_back(PcmBuffer::Decode(base_path + "/" + std::to_string(i) + ".wav"));
+    pcms.back()->WaitFor(pcms.back()->num_frames());
+  }
+
+  // Next audio is only queued, once stream switched to audio queued before.
+  PlaybackStream stream(pcms[0], 4096);
+  REQUIRE(!stream.queued());
+  REQUIRE(stream.Queue(pcms[1], 1000) == 9000);
+  REQUIRE(stream.queued());
+  stream.Start();
+  std::vector<float> out;
+  std::vector<float> period(512);
+  size_t next = 2;
+  while (!stream.finished()) {
+    if (next < pcms.size() && !stream.queued())
+      REQUIRE(stream.Queue(pcms[next++], 1000) == 18000);
+    size_t n = stream.Render(period.data(), std::min(stream.buffered(), static_cast<size_t>(512)));
+    out.insert(out.end(), period.begin(), period.begin()+n);
+  }
+
+  // All audios are played completely (except for crossfades).
+  REQUIRE(next == pcms.size());
+  REQUIRE(out.size() == 28000);
+  REQUIRE(std::all_of(out.begin(), out.begin()+9000, [](float sample) { return sample == 0.5; }));
+  REQUIRE(std::all_of(out.begin()+10000, out.begin()+18000, [](float sample) { return sample == -0.5; }));
+  REQUIRE(std::all_of(out.begin()+19000, out.end(), [](float sample) { return sample == 0.25; }));
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test splicing queued song on to timeline", "[main]") {
+  Audio::Initialize();
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_splice";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+  // Clicks every 500ms (120 bpm), starting at 250ms (second song: 100ms).
+  unsigned int samplerate = 44100;
+  for (size_t start : {samplerate/4, samplerate/10}) {
+    std::vector<float> frames(20*samplerate);
+    for (size_t i=start; i<frames.size(); i+=samplerate/2) {
+      for (size_t j=0; j<200 && i+j<frames.size(); j++)
+        frames[i+j] = 0.9*std::sin(2*M_PI*1000*j/samplerate);
+    }
+    WriteWav(base_path + "/clicks_" + std::to_string(start) + ".wav", frames, 1, samplerate);
+  }
+
+  Audio audio(base_path);
+  audio.set_analysis_backend(BACKEND_FUSED);
+  audio.set_source_path(base_path + "/clicks_" + std::to_string(samplerate/4) + ".wav");
+  audio.StartAnalysis(1);
+  REQUIRE(!audio.SpliceNext());
+  audio.QueueNext(base_path + "/clicks_" + std::to_string(samplerate/10) + ".wav");
+  REQUIRE(audio.next_queued());
+  for (size_t i=0; i<1000 && !audio.SpliceNext(); i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE(!audio.next_queued());
+
+  // Beats of current song up to crossfade, followed by beats of queued song shifted to crossfade.
+  auto timeline = audio.timeline();
+  double start = 20000-PLAYBACK_CROSSFADE;
+  REQUIRE(audio.song_start() == Approx(start));
+  REQUIRE(timeline->finished());
+  REQUIRE(timeline->num_intervals() == 2*ANALYSIS_INTERVALS);
+  REQUIRE(timeline->duration() == Approx(start+20000));
+  size_t first = timeline->Seek(start);
+  REQUIRE(first > 0);
+  REQUIRE(timeline->time(first-1) < start);
+  REQUIRE(static_cast<size_t>(timeline->at(first-1).interval_) < ANALYSIS_INTERVALS);
+  REQUIRE(static_cast<size_t>(timeline->at(first).interval_) >= ANALYSIS_INTERVALS);
+  REQUIRE(timeline->size()-first == audio.analysed_data()->data_per_beat_.size());
+  REQUIRE(std::fmod(timeline->time(timeline->size()-1)-start, 500) == Approx(100).margin(15));
+  for (size_t i=1; i<timeline->size(); i++)
+    REQUIRE(timeline->time(i) > timeline->time(i-1));
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test splicing several queued songs one after another", "[main]") {
+  Audio::Initialize();
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_splice_several";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+  // Clicks every 500ms (120 bpm), each song starting at a different offset.
+  unsigned int samplerate = 44100;
+  std::vector<size_t> offsets = {250, 100, 400};  // ms
+  for (size_t offset : offsets) {
+    std::vector<float> frames(20*samplerate);
+    for (size_t i=offset*samplerate/1000; i<frames.size(); i+=samplerate/2) {
+      for (size_t j=0; j<200 && i+j<frames.size(); j++)
+        frames[i+j] = 0.9*std::sin(2*M_PI*1000*j/samplerate);
+    }
+    WriteWav(base_path + "/clicks_" + std::to_string(offset) + ".wav", frames, 1, samplerate);
+  }
+
+  Audio audio(base_path);
+  audio.set_analysis_backend(BACKEND_FUSED);
+  audio.set_source_path(base_path + "/clicks_" + std::to_string(offsets[0]) + ".wav");
+  audio.StartAnalysis(1);
+  for (size_t song=1; song<offsets.size(); song++) {
+    double previous_start = audio.song_start();
+    audio.QueueNext(base_path + "/clicks_" + std::to_string(offsets[song]) + ".wav");
+    for (size_t i=0; i<1000 && !audio.SpliceNext(); i++)
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(!audio.next_queued());
+
+    // Beats of previous song up to crossfade, followed by all beats of spliced song.
+    auto timeline = audio.timeline();
+    double start = previous_start + 20000-PLAYBACK_CROSSFADE;
+    REQUIRE(audio.song_start() == Approx(start));
+    size_t first = timeline->Seek(start);
+    REQUIRE(first > 0);
+    REQUIRE(timeline->time(0) >= previous_start);
+    REQUIRE(std::fmod(timeline->time(first-1)-previous_start, 500) == Approx(offsets[song-1]).margin(15));
+    REQUIRE(timeline->size()-first == audio.analysed_data()->data_per_beat_.size());
+    REQUIRE(std::fmod(timeline->time(first)-start, 500) == Approx(offsets[song]).margin(15));
+    for (size_t i=1; i<timeline->size(); i++)
+      REQUIRE(timeline->time(i) > timeline->time(i-1));
+    // Interval ids keep counting up across all splices.
+    REQUIRE(timeline->first_interval() == (song-1)*ANALYSIS_INTERVALS);
+    REQUIRE(timeline->num_intervals() == (song+1)*ANALYSIS_INTERVALS);
+    REQUIRE(static_cast<size_t>(timeline->at(0).interval_) >= (song-1)*ANALYSIS_INTERVALS);
+    REQUIRE(static_cast<size_t>(timeline->at(first).interval_) >= song*ANALYSIS_INTERVALS);
+    for (size_t i=1; i<timeline->size(); i++)
+      REQUIRE(timeline->at(i).interval_ >= timeline->at(i-1).interval_);
+    REQUIRE(timeline->interval(song*ANALYSIS_INTERVALS).id_ == song*ANALYSIS_INTERVALS);
+    // Averages and peak are those of the spliced song.
+    REQUIRE(audio.lead_data() == audio.analysed_data());
+  }
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test reading raw pcm stream", "[main]") {
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_stream";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+
+  SECTION("test s16 stereo file with incomplete last frame") {
+    std::vector<int16_t> samples = {16384, 0, -16384, -16384, 32767, 32767, 1};
+    std::ofstream write(base_path + "/test.raw", std::ios::binary);
+    write.write(reinterpret_cast<const char*>(samples.data()), samples.size()*sizeof(int16_t));
+    write.close();
+    PcmStream stream(base_path + "/test.raw", {PCM_S16, 44100, 2});
+    std::vector<float> mono(2);
+    REQUIRE(stream.ReadMono(mono.data(), 2) == 2);
+    REQUIRE(mono[0] == Approx(0.25));
+    REQUIRE(mono[1] == Approx(-0.5));
+    REQUIRE(stream.ReadMono(mono.data(), 2) == 1);
+    REQUIRE(mono[0] == Approx(1.0).epsilon(0.001));
+    REQUIRE(stream.ReadMono(mono.data(), 2) == 0);
+    REQUIRE(stream.frames_read() == 3);
+  }
+
+  SECTION("test f32 from named pipe") {
+    std::string fifo_path = base_path + "/test.fifo";
+    REQUIRE(mkfifo(fifo_path.c_str(), 0600) == 0);
+    // Writer produces hops in small, uneven pieces.
+    std::thread writer([&]() {
+      std::ofstream write(fifo_path, std::ios::binary);
+      for (int i=0; i<1000; i++) {
+        float sample = i;
+        write.write(reinterpret_cast<const char*>(&sample), sizeof(float));
+        if (i%7 == 0)
+          write.flush();
+      }
+    });
+    PcmStream stream(fifo_path, {PCM_F32, 44100, 1});
+    std::vector<float> mono(256);
+    std::vector<float> all;
+    size_t read = 0;
+    while ((read = stream.ReadMono(mono.data(), 256)) > 0) {
+      all.insert(all.end(), mono.begin(), mono.begin()+read);
+      if (read < 256)
+        break;
+    }
+    writer.join();
+    REQUIRE(all.size() == 1000);
+    for (size_t i=0; i<all.size(); i++)
+      REQUIRE(all[i] == i);
+  }
+
+  SECTION("test analysing stream finishes timeline") {
+    std::vector<float> samples(44100);
+    for (size_t i=0; i<samples.size(); i++)
+      samples[i] = (i%22050 < 100) ? 0.9 : 0.0;
+    std::ofstream write(base_path + "/test.raw", std::ios::binary);
+    write.write(reinterpret_cast<const char*>(samples.data()), samples.size()*sizeof(float));
+    write.close();
+    Audio audio(base_path);
+    size_t published = 0;
+    audio.AnalyzeStream(base_path + "/test.raw", {PCM_F32, 44100, 1}, 
+        [&](const AudioDataTimePoint&) { published++; });
+    REQUIRE(audio.timeline()->finished());
+    REQUIRE(audio.timeline()->size() == published);
+  }
+
+  REQUIRE_THROWS(PcmStream(base_path + "/missing.raw", {PCM_F32, 44100, 2}));
+  REQUIRE_THROWS(PcmStreamFormat::ParseSampleFormat("u8"));
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test progressive analysis swaps in refined timeline", "[main]") {
+  Audio::Initialize();
+  std::string base_path = std::filesystem::temp_directory_path().string() + "/dissonance_test_progressive";
+  std::filesystem::remove_all(base_path);
+  std::filesystem::create_directories(base_path);
+  // Clicks every 500ms (120 bpm), starting at 250ms.
+  unsigned int samplerate = 44100;
+  std::vector<float> frames(30*samplerate);
+  for (size_t i=samplerate/4; i<frames.size(); i+=samplerate/2) {
+    for (size_t j=0; j<200 && i+j<frames.size(); j++)
+      frames[i+j] = 0.9*std::sin(2*M_PI*1000*j/samplerate);
+  }
+  WriteWav(base_path + "/clicks.wav", frames, 1, samplerate);
+
+  Audio audio(base_path);
+  audio.set_analysis_backend(BACKEND_FUSED);
+  audio.set_source_path(base_path + "/clicks.wav");
+  size_t version = 0;
+  audio.StartAnalysis(3);
+  auto coarse = audio.timelines().Get(version);
+  auto uncached_lead = audio.lead_data();
+  audio.WaitForAnalysis();
+
+  // Lead is taken from coarse timeline (and stored).
+  auto coarse_lead = coarse->Snapshot(3);
+  REQUIRE(uncached_lead->data_per_beat_.times() == coarse_lead.data_per_beat_.times());
+  REQUIRE(uncached_lead->max_peak_ == coarse_lead.max_peak_);
+
+  // Coarse timeline stays valid, while refined timeline has replaced it.
+  REQUIRE(coarse->finished());
+  REQUIRE(coarse->size() > 0);
+  REQUIRE(audio.timelines().version() == version+1);
+  auto refined = audio.timeline();
+  REQUIRE(refined->finished());
+  REQUIRE(refined->size() == audio.analysed_data()->data_per_beat_.size());
+  REQUIRE(std::abs(static_cast<double>(refined->size()) - coarse->size()) <= 2);
+  REQUIRE(std::fmod(refined->time(refined->size()-1), 500) == Approx(250).margin(15));
+
+  // Cached analysis is published at once (no refinement).
+  audio.StartAnalysis(3);
+  audio.timelines().Get(version);
+  audio.WaitForAnalysis();
+  REQUIRE(audio.timelines().version() == version);
+  REQUIRE(audio.timeline()->size() == refined->size());
+
+  // Lead (and map created from it) does not depend on whether song was cached.
+  auto cached_lead = audio.lead_data();
+  REQUIRE(uncached_lead->data_per_beat_.size() > 0);
+  REQUIRE(uncached_lead->data_per_beat_.times() == cached_lead->data_per_beat_.times());
+  REQUIRE(uncached_lead->average_level_ == cached_lead->average_level_);
+  REQUIRE(uncached_lead->max_peak_ == cached_lead->max_peak_);
+  REQUIRE(uncached_lead->intervals_.size() == cached_lead->intervals_.size());
+  REQUIRE(uncached_lead->intervals_.at(2).key_ == cached_lead->intervals_.at(2).key_);
+  REQUIRE(RandomGenerator::Fingerprint(*uncached_lead) == RandomGenerator::Fingerprint(*cached_lead));
+  std::vector<std::vector<std::string>> maps;
+  for (const auto& lead : {uncached_lead, cached_lead}) {
+    RandomGenerator ran_gen(lead, &RandomGenerator::ran_note, RANDOM_STREAM_GAME);
+    RandomGenerator map_1(lead, &RandomGenerator::ran_boolean_minor_interval, RANDOM_STREAM_MOUNTAINS);
+    RandomGenerator map_2(lead, &RandomGenerator::ran_level_peaks, RANDOM_STREAM_HILLS);
+    Field field(40, 60, &ran_gen);
+    field.AddHills(&map_1, &map_2, 0);
+    maps.push_back({});
+    for (int l=0; l<=40; l++) {
+      for (int c=0; c<=60; c++)
+        maps.back().push_back(field.GetSymbolAtPos({l, c}));
+    }
+  }
+  REQUIRE(maps[0] == maps[1]);
+  std::filesystem::remove_all(base_path);
+}
+
+TEST_CASE("test fused feature extractor", "[main]") {
+  Audio::Initialize();
+  unsigned int samplerate = 44100;
+
+  SECTION("test fft matches naive dft") {
+    std::vector<std::complex<float>> data(64);
+    for (size_t i=0; i<data.size(); i++)
+      data[i] = std::complex<float>(std::sin(i*0.3) + 0.5*std::cos(i*1.1), 0.0f);
+    std::vector<std::complex<float>> expected(data.size());
+    for (size_t k=0; k<data.size(); k++) {
+      for (size_t i=0; i<data.size(); i++)
+        expected[k] += data[i]*std::polar(1.0f, static_cast<float>(-2*M_PI*k*i/data.size()));
+    }
+    FeatureExtractor::Fft(data);
+    for (size_t k=0; k<data.size(); k++) {
+      REQUIRE(data[k].real() == Approx(expected[k].real()).margin(0.001));
+      REQUIRE(data[k].imag() == Approx(expected[k].imag()).margin(0.001));
+    }
+  }
+
+  SECTION("test chroma of sine") {
+    FeatureExtractor extractor(samplerate, ANALYSIS_WIN_SIZE, ANALYSIS_HOP_SIZE);
+    std::vector<float> hop(ANALYSIS_HOP_SIZE);
+    for (size_t h=0; h<100; h++) {
+      for (size_t i=0; i<hop.size(); i++)
+        hop[i] = 0.5*std::sin(2*M_PI*440*(h*hop.size()+i)/samplerate);
+      extractor.Do(hop.data());
+    }
+    Chroma chroma;
+    std::vector<Note> notes;
+    extractor.TakeBeat(chroma, notes);
+    REQUIRE(std::max_element(chroma.begin(), chroma.end()) - chroma.begin() == 9);  // A
+    REQUIRE(notes.size() == 1);
+    REQUIRE(notes[0].midi_note_ == 69);
+    // Chroma is reset once taken.
+    extractor.TakeBeat(chroma, notes);
+    REQUIRE(chroma == Chroma{});
+    REQUIRE(notes.empty());
+  }
+
+  SECTION("test tempo and beats of click track") {
+    // Clicks every 500ms (120 bpm), starting at 250ms.
+    std::vector<float> samples(20*samplerate);
+    for (size_t i=samplerate/4; i<samples.size(); i+=samplerate/2) {
+      for (size_t j=0; j<200 && i+j<samples.size(); j++)
+        samples[i+j] = 0.9*std::sin(2*M_PI*1000*j/samplerate);
+    }
+    FeatureExtractor extractor(samplerate, ANALYSIS_WIN_SIZE, ANALYSIS_HOP_SIZE);
+    std::vector<double> beats;
+    for (size_t i=0; i+ANALYSIS_HOP_SIZE<=samples.size(); i+=ANALYSIS_HOP_SIZE) {
+      if (extractor.Do(&samples[i]))
+        beats.push_back(extractor.last_beat_ms());
+    }
+    REQUIRE(extractor.bpm() == Approx(120).margin(3));
+    REQUIRE(beats.size() > 10);
+    for (size_t i=beats.size()-10; i<beats.size(); i++)
+      REQUIRE(beats[i]-beats[i-1] == Approx(500).margin(15));
+    // Beats are placed at clicks.
+    REQUIRE(std::fmod(beats.back(), 500) == Approx(250).margin(15));
+  }
+
+  SECTION("test chroma weights key of interval") {
+    // Without chroma, each note counts: two Cs and one Eb, E each.
+    std::vector<AudioDataTimePoint> beats = {
+      {0, 120, 50, {ConvertMidiToNote(60), ConvertMidiToNote(63)}, 0},
+      {500, 120, 50, {ConvertMidiToNote(60), ConvertMidiToNote(64)}, 0},
+    };
+    Interval interval = Audio::CalcLevel(0, beats);
+    REQUIRE(interval.key_note_ == 0);
+    REQUIRE(interval.notes_out_key_ == 1);
+    // With chroma, weak pitch classes neither decide key nor count as present.
+    Chroma chroma = {};
+    chroma[4] = 255;  // E
+    chroma[0] = 100;  // C
+    chroma[3] = 60;  // Eb
+    beats.push_back({1000, 120, 50, {ConvertMidiToNote(64)}, 0, chroma});
+    beats.push_back({1500, 120, 50, {ConvertMidiToNote(64)}, 0, chroma});
+    interval = Audio::CalcLevel(0, beats);
+    REQUIRE(interval.key_note_ == 4);
+    REQUIRE(interval.notes_in_key_ + interval.notes_out_key_ == 3);
+  }
+}
+
+TEST_CASE("test polyphase decimator", "[main]") {
+  // Largest power of two keeping samplerate above target.
+  REQUIRE(Decimator::Factor(44100, Audio::ProfileSamplerate(PROFILE_FAST)) == 4);
+  REQUIRE(Decimator::Factor(44100, Audio::ProfileSamplerate(PROFILE_DEFAULT)) == 2);
+  REQUIRE(Decimator::Factor(44100, Audio::ProfileSamplerate(PROFILE_ACCURATE)) == 1);
+  REQUIRE(Decimator::Factor(48000, 22050) == 2);
+  REQUIRE(Decimator::Factor(32000, 22050) == 1);
+  REQUIRE(Decimator::Factor(192000, 11025) == DECIMATOR_MAX_FACTOR);
+  // Profiles are cached separately.
+  REQUIRE(Audio::AnalysisVersion(BACKEND_AUBIO, PROFILE_FAST) != Audio::AnalysisVersion());
+
+  unsigned int samplerate = 44100;
+  std::vector<float> samples(samplerate);
+  auto decimate = [&samples](Decimator& decimator, double freq, bool scalar) {
+    for (size_t i=0; i<samples.size(); i++)
+      samples[i] = 0.5*std::sin(2*M_PI*freq*i/44100);
+    // Input is processed in hops of uneven size.
+    std::vector<float> out;
+    for (size_t i=0; i<samples.size(); i+=300)
+      decimator.Process(&samples[i], std::min(static_cast<size_t>(300), samples.size()-i), out, scalar);
+    return out;
+  };
+
+  SECTION("test kernel matches scalar fallback") {
+    std::vector<float> a(101), b(101);
+    for (size_t i=0; i<a.size(); i++) {
+      a[i] = std::sin(i*0.1);
+      b[i] = std::cos(i*0.3);
+    }
+    REQUIRE(Decimator::DotProduct(a.data(), b.data(), a.size()) 
+        == Approx(Decimator::DotProductScalar(a.data(), b.data(), a.size())).margin(1e-4));
+    Decimator simd(4);
+    Decimator scalar(4);
+    std::vector<float> out_simd = decimate(simd, 1000, false);
+    std::vector<float> out_scalar = decimate(scalar, 1000, true);
+    REQUIRE(out_simd.size() == out_scalar.size());
+    for (size_t i=0; i<out_simd.size(); i++)
+      REQUIRE(out_simd[i] == Approx(out_scalar[i]).margin(1e-5));
+  }
+
+  SECTION("test pass band is kept without delay") {
+    for (unsigned int factor : {1, 2, 4}) {
+      Decimator decimator(factor);
+      std::vector<float> out = decimate(decimator, 1000, false);
+      // Only the last half filter length is still held back.
+      REQUIRE(out.size() <= samples.size()/factor);
+      REQUIRE(out.size() + decimator.taps().size()/factor >= samples.size()/factor);
+      for (size_t i=decimator.taps().size(); i<out.size(); i++)
+        REQUIRE(out[i] == Approx(samples[i*factor]).margin(0.01));
+    }
+  }
+
+  SECTION("test frequencies above new nyquist frequency are removed") {
+    Decimator decimator(4);
+    std::vector<float> out = decimate(decimator, 8000, false);
+    for (size_t i=decimator.taps().size(); i<out.size(); i++)
+      REQUIRE(std::abs(out[i]) < 0.01);
   }
 }
@@ -1,7 +1,11 @@
 #include <catch2/catch.hpp>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
 #include <algorithm>
+#include <memory>
+#include <set>
+#include <vector>
 #include "constants/codes.h"
 #include "game/field.h"
 #include "objects/units.h"
@@ -45,23 +49,42 @@ TEST_CASE("test_field", "[main]") {
   }
 
   SECTION("Test BuildGraph with all positions free.") {
-    Graph graph;
-    // Add all nodes.
+    Graph graph(field->lines(), field->cols());
+    // Add all nodes (edges to neighbors are implicit).
     for (int l=0; l<field->lines(); l++)
       for (int c=0; c<field->cols(); c++)
         graph.AddNode(l, c);
-    // For each node, add edges.
-    for (auto node : graph.nodes()) {
-      auto neighbors = field->GetAllInRange({node.second->line_, node.second->col_}, 1.5, 1);
-      if (node.second->line_ > 0 && node.second->line_ < field->lines() && node.second->col_ > 0 
-          && node.second->col_ < field->cols())
-        REQUIRE(neighbors.size() == 8);
-      for (const auto& pos : neighbors) {
-        if (graph.InGraph(pos))
-          graph.AddEdge(node.second, graph.nodes().at(pos));
-      }
-    }
+    REQUIRE(graph.size() == static_cast<size_t>(field->lines()*field->cols()));
     REQUIRE(graph.RemoveInvalid({50, 50}) == 0);
+    // Diagonal neighbors are connected.
+    REQUIRE(graph.find_way({0, 0}, {5, 5}).size() == 6);
+  }
+
+  SECTION("Test graph removes unreachable nodes and finds way around walls.") {
+    Graph graph(10, 10);
+    for (int l=0; l<10; l++)
+      for (int c=0; c<10; c++)
+        if (c != 5 || l == 9)  // wall with gap at the bottom.
+          graph.AddNode(l, c);
+    auto way = graph.find_way({0, 0}, {0, 9});
+    REQUIRE(way.front() == (position_t){0, 0});
+    REQUIRE(way.back() == (position_t){0, 9});
+    REQUIRE(std::find(way.begin(), way.end(), (position_t){9, 5}) != way.end());
+    for (auto it=std::next(way.begin()); it!=way.end(); it++)
+      REQUIRE(utils::Dist(*std::prev(it), *it) < 1.5);
+    REQUIRE(way.size() == 19);
+
+    // Close gaps: right side is unreachable.
+    Graph walled(10, 10);
+    for (int l=0; l<10; l++)
+      for (int c=0; c<10; c++)
+        if (c != 5)
+          walled.AddNode(l, c);
+    REQUIRE(walled.RemoveInvalid({0, 0}) == 40);
+    REQUIRE(walled.size() == 50);
+    REQUIRE(!walled.InGraph({0, 9}));
+    REQUIRE(walled.InGraph({9, 4}));
+    REQUIRE(!walled.InGraph({10, 0}));
   }
 
   SECTION("test GetAllInRange") {
@@ -133,6 +156,56 @@ TEST_CASE("test_field", "[main]") {
       REQUIRE(utils::Dist(center_positions[0], it) <= 30);
   }
 
+  SECTION("test AddHills draws same hills as cell by cell") {
+    // Audio data with minor intervals and level peaks.
+    AudioData audio_data;
+    audio_data.average_level_ = 50;
+    for (size_t i=0; i<500; i++) {
+      std::vector<Note> notes;
+      for (size_t j=0; j<i%4; j++)
+        notes.push_back(Note::FromMidi(48 + (i*5+j*3)%24));
+      audio_data.data_per_beat_.push_back({i*500.0, 120, static_cast<int>(30+(i*31)%41), notes, 0});
+    }
+    auto data = std::make_shared<const AudioData>(audio_data);
+    RandomGenerator gen_1(data, &RandomGenerator::ran_boolean_minor_interval);
+    RandomGenerator gen_2(data, &RandomGenerator::ran_level_peaks);
+    RandomGenerator expected_gen_1(data, &RandomGenerator::ran_boolean_minor_interval);
+    RandomGenerator expected_gen_2(data, &RandomGenerator::ran_level_peaks);
+
+    // Bulk draws match single draws.
+    std::vector<uint8_t> booleans(100);
+    gen_1.FillBooleans(booleans.data(), booleans.size());
+    std::vector<int> ints(100);
+    gen_2.FillInts(ints.data(), ints.size(), 0, 5);
+    for (size_t i=0; i<100; i++) {
+      REQUIRE(booleans[i] == expected_gen_1.RandomInt(0, 1));
+      REQUIRE(ints[i] == expected_gen_2.RandomInt(0, 5));
+    }
+
+    Field hills_field(40, 60, ran_gen);
+    hills_field.AddHills(&gen_1, &gen_2, 1);
+    // Expected: draw cell by cell.
+    Field expected_field(40, 60, ran_gen);
+    std::set<position_t> expected_hills;
+    for (int l=0; l<40; l++) {
+      for (int c=0; c<60; c++) {
+        if (expected_gen_1.RandomInt(0, 1) == 1) {
+          expected_hills.insert({l, c});
+          int level = expected_gen_2.RandomInt(0, 5)-999;
+          if (level < 1)
+            continue;
+          for (const auto& it : expected_field.GetAllInRange({l, c}, level-1, 1))
+            expected_hills.insert(it);
+        }
+      }
+    }
+    REQUIRE(expected_hills.size() > 0);
+    for (int l=0; l<=40; l++) {
+      for (int c=0; c<=60; c++)
+        REQUIRE((hills_field.GetSymbolAtPos({l, c}) == SYMBOL_HILL) == (expected_hills.count({l, c}) > 0));
+    }
+  }
+
   SECTION("test AddResources") {
     field->BuildGraph({0, 0}, {field->lines()-1, field->cols()-1}); // Check free also checks in graph.
     auto resource_positions = field->AddResources(t_utils::GetRandomPositionInField(field, ran_gen));
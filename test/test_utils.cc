@@ -1,9 +1,15 @@
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <catch2/catch.hpp>
 #include <map>
+#include <memory>
 #include <list>
+#include <string>
 #include <vector>
+#include "audio/audio_data.h"
+#include "random/counter_rng.h"
+#include "random/random.h"
 #include "utils/utils.h"
 
 TEST_CASE ("test_dist", "[utils]") {
@@ -80,3 +86,68 @@ TEST_CASE("erase from vector", "") {
   REQUIRE(vec.size() == size-1);
   REQUIRE(vec.front() == 2);
 }
+
+TEST_CASE("test counter-based random numbers", "[utils]") {
+  CounterRng rng(42, 1);
+  std::vector<uint64_t> drawn;
+  for (size_t i=0; i<100; i++)
+    drawn.push_back(rng.Next());
+  REQUIRE(rng.counter() == 100);
+  // Any number can be drawn by index, and after seeking.
+  REQUIRE(rng.at(57) == drawn[57]);
+  rng.Seek(10);
+  REQUIRE(rng.Next() == drawn[10]);
+  // Equal key and stream draw equal numbers, other streams and keys don't.
+  REQUIRE(CounterRng(42, 1).at(0) == drawn[0]);
+  REQUIRE(CounterRng(42, 2).at(0) != drawn[0]);
+  REQUIRE(CounterRng(43, 1).at(0) != drawn[0]);
+  for (size_t i=0; i<1000; i++) {
+    size_t x = rng.Next(3, 7);
+    REQUIRE((x >= 3 && x <= 7));
+  }
+
+  SECTION("random generator is reproducible by index") {
+    AudioData audio_data;
+    for (size_t i=0; i<100; i++)
+      audio_data.data_per_beat_.push_back({i*500.0, 120, static_cast<int>(i%20), {}, 0});
+    auto data = std::make_shared<const AudioData>(audio_data);
+    // No notes: falls back to counter-based numbers keyed by audio.
+    RandomGenerator gen(data, &RandomGenerator::ran_note, RANDOM_STREAM_GAME);
+    std::vector<int> drawn_ints;
+    for (size_t i=0; i<100; i++)
+      drawn_ints.push_back(gen.RandomInt(0, 1000));
+    RandomGenerator same_song(data, &RandomGenerator::ran_note, RANDOM_STREAM_GAME);
+    RandomGenerator other_stream(data, &RandomGenerator::ran_note, RANDOM_STREAM_MOUNTAINS);
+    size_t equal = 0;
+    for (size_t i=0; i<100; i++) {
+      REQUIRE(same_song.RandomIntAt(i, 0, 1000) == drawn_ints[i]);
+      equal += (other_stream.RandomInt(0, 1000) == drawn_ints[i]);
+    }
+    REQUIRE(equal < 10);
+    same_song.Seek(50);
+    REQUIRE(same_song.RandomInt(0, 1000) == drawn_ints[50]);
+  }
+
+  SECTION("streams over same song pick different beats") {
+    AudioData audio_data;
+    for (size_t i=0; i<100; i++)
+      audio_data.data_per_beat_.push_back({i*500.0, 120, static_cast<int>(i%20), {Note::FromMidi(40+i%40)}, 0});
+    auto data = std::make_shared<const AudioData>(audio_data);
+    RandomGenerator game(data, &RandomGenerator::ran_note, RANDOM_STREAM_GAME);
+    RandomGenerator same_stream(data, &RandomGenerator::ran_note, RANDOM_STREAM_GAME);
+    RandomGenerator other_stream(data, &RandomGenerator::ran_note, RANDOM_STREAM_MOUNTAINS);
+    size_t equal = 0;
+    for (size_t i=0; i<100; i++) {
+      int x = game.RandomInt(0, 1000);
+      REQUIRE(same_stream.RandomInt(0, 1000) == x);
+      equal += (other_stream.RandomInt(0, 1000) == x);
+    }
+    REQUIRE(equal < 20);
+  }
+
+  SECTION("ids are random") {
+    std::string id = utils::CreateId("epsp");
+    REQUIRE(id.size() == 4+32);
+    REQUIRE(id != utils::CreateId("epsp"));
+  }
+}